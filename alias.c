@@ -22,18 +22,25 @@
 #include <stdio.h>
 #include <assert.h>
 
-int AliasInit(AliasTable t, const uint32_t counts[], int max_symbol) {
+int AliasInit(AliasTable* const t, const uint32_t counts[], int max_symbol,
+              int log_tab_size, int log2_size) {
   // partition: small symbols at bottom, larges on top
   uint8_t symbols[ALIAS_MAX_SYMBOLS];
-  int l = ALIAS_MAX_SYMBOLS, s = 0;
+  const int size = 1 << log2_size;
+  int l = size, s = 0;
   int i;
   alias_tab_t proba[ALIAS_MAX_SYMBOLS];
-  const uint32_t cut = MAX_TAB_SIZE >> LOG2_MAX_SYMBOLS;   // 1/n
+  AliasPair* const pairs = t->pairs_;
+  const uint32_t tab_size = 1u << log_tab_size;
+  const uint32_t cut = tab_size >> log2_size;   // 1/n
   uint32_t total = 0;
-  assert((MAX_TAB_SIZE % ALIAS_MAX_SYMBOLS) == 0);
-  if (max_symbol > ALIAS_MAX_SYMBOLS || max_symbol <= 0) return 0;
+  if (log2_size < 0 || log2_size > LOG2_MAX_SYMBOLS) return 0;
+  if (log2_size > log_tab_size || log_tab_size > MAX_LOG_TAB_SIZE) return 0;
+  if (max_symbol > size || max_symbol <= 0) return 0;
+  t->log2_size_ = log2_size;
+  t->shift_ = log_tab_size - log2_size;
 
-  for (i = 0; i < ALIAS_MAX_SYMBOLS; ++i) {
+  for (i = 0; i < size; ++i) {
     proba[i] = (i < max_symbol) ? counts[i] : 0;
     total += proba[i];
     if (proba[i] >= cut) {
@@ -44,14 +51,14 @@ int AliasInit(AliasTable t, const uint32_t counts[], int max_symbol) {
     assert(s <= l);
   }
   assert(s == l);
-  if (total != MAX_TAB_SIZE) return 0;   // unnormalized
+  if (total != tab_size) return 0;   // unnormalized
 
   while (s > 0) {
     const int S = symbols[--s];
     const int L = symbols[l++];
     assert(proba[S] < cut);       // check that S is a small one
-    t[S].cut_ = proba[S] + S * cut;
-    t[S].other_ = L;
+    pairs[S].cut_ = proba[S] + S * cut;
+    pairs[S].other_ = L;
     proba[L] -= cut - proba[S];   // decrease large proba
     if (proba[L] >= cut) {
       --l;                // large symbol stays large. Reuse the slot.
@@ -59,20 +66,22 @@ int AliasInit(AliasTable t, const uint32_t counts[], int max_symbol) {
       symbols[s++] = L;   // large becomes small
     }
   }
-  while (l < ALIAS_MAX_SYMBOLS) {
+  while (l < size) {
     const int L = symbols[l++];
-    t[L].other_ = L;
-    t[L].cut_ = cut + L * cut;  // large symbols with max proba
+    pairs[L].other_ = L;
+    pairs[L].cut_ = cut + L * cut;  // large symbols with max proba
   }
 
   // Accumulate counts and compute the start_.
-  uint32_t c[MAX_SYMBOLS] = { 0 };
-  for (s = 0; s < MAX_SYMBOLS; ++s) {
-    const int other = t[s].other_;
-    const int count_s = t[s].cut_ - s * cut;
+  uint32_t c[ALIAS_MAX_SYMBOLS];
+  memset(c, 0, size * sizeof(c[0]));
+  for (s = 0; s < size; ++s) {
+    AliasPair* const p = &pairs[s];
+    const int other = p->other_;
+    const int count_s = p->cut_ - s * cut;
     const int count_other = cut - count_s;    // complement to 'cut'
-    t[s].start_       = s * cut - c[s];
-    t[s].other_start_ = s * cut + count_s - c[other];
+    p->start_       = s * cut - c[s];
+    p->other_start_ = s * cut + count_s - c[other];
     c[s]     += count_s;
     c[other] += count_other;
   }
@@ -81,9 +90,10 @@ int AliasInit(AliasTable t, const uint32_t counts[], int max_symbol) {
 
 //------------------------------------------------------------------------------
 
-void AliasGenerateMap(const AliasTable t, alias_t map[MAX_TAB_SIZE]) {
+void AliasGenerateMap(const AliasTable* const t, alias_t map[MAX_TAB_SIZE]) {
+  const int tab_size = 1 << (t->log2_size_ + t->shift_);
   int r;
-  for (r = 0; r < MAX_TAB_SIZE; ++r) {
+  for (r = 0; r < tab_size; ++r) {
     uint32_t dummy;
     map[r] = AliasSearchSymbol(t, r, &dummy);
   }
@@ -92,52 +102,140 @@ void AliasGenerateMap(const AliasTable t, alias_t map[MAX_TAB_SIZE]) {
 int AliasSpreadMap(int max_symbol, const uint32_t counts[],
                    int log_tab_size, uint8_t symbols[]) {
   AliasTable t;
-  int i;
-  assert(log_tab_size == MAX_LOG_TAB_SIZE);  // TODO(skal): support more sizes!
-  if (!AliasInit(t, counts, max_symbol)) return 0;
-  for (i = 0; i < (1 << log_tab_size); ++i) {
-    uint32_t dummy;
-    symbols[i] = AliasSearchSymbol(t, i, &dummy);
-  }
+  const int log2_size = AliasLog2Size(max_symbol);
+  if (!AliasInit(&t, counts, max_symbol, log_tab_size, log2_size)) return 0;
+  AliasGenerateMap(&t, symbols);
   return 1;
 }
 
 int AliasBuildEncMap(const uint32_t counts[], int max_symbol,
+                     int log_tab_size, int log2_size,
                      uint16_t map[MAX_TAB_SIZE]) {
   AliasTable t;
   uint32_t r;
   uint32_t starts[MAX_SYMBOLS];
   uint32_t start = 0;
-  if (!AliasInit(t, counts, max_symbol)) return 0;
-  
+  const uint32_t tab_size = 1u << log_tab_size;
+  if (!AliasInit(&t, counts, max_symbol, log_tab_size, log2_size)) return 0;
+
   for (r = 0; r < max_symbol; ++r) {
     starts[r] = start;
     start += counts[r];
   }
-  if (start != MAX_TAB_SIZE) return 0;
+  if (start != tab_size) return 0;
 
-  for (r = 0; r < MAX_TAB_SIZE; ++r) {
+  for (r = 0; r < tab_size; ++r) {
     uint32_t rank;
-    const uint32_t s = AliasSearchSymbol(t, r, &rank);
+    const uint32_t s = AliasSearchSymbol(&t, r, &rank);
     map[rank + starts[s]] = r;
   }
   return 1;
 }
 
+static uint32_t PieceDelta(const AliasPiece* const p) {
+  return (uint16_t)(p->slot_ - p->rank_);
+}
+
+int AliasBuildEncTable(const AliasTable* const t, const uint32_t counts[],
+                       int max_symbol, AliasEncTable* const et) {
+  const int size = 1 << t->log2_size_;
+  const uint32_t cut = 1u << t->shift_;
+  int b, s;
+  uint16_t start[ALIAS_MAX_SYMBOLS + 1];  // first piece of each symbol
+  uint16_t next[ALIAS_MAX_SYMBOLS];       // next free piece of each symbol
+  AliasPiece* const pieces = et->pieces_;
+  int nb_chunks = 0;
+  if (max_symbol > size) return 0;
+  et->shift_ = t->shift_;
+
+  // count the non-empty pieces of each symbol, plus one sentinel
+  for (s = 0; s <= size; ++s) start[s] = 1;
+  for (b = 0; b < size; ++b) {
+    const AliasPair* const p = &t->pairs_[b];
+    const uint32_t count_b = p->cut_ - b * cut;
+    if (count_b > 0) ++start[b + 1];
+    if (count_b < cut) ++start[p->other_ + 1];
+  }
+  start[0] = 0;
+  for (s = 0; s < size; ++s) {
+    start[s + 1] += start[s];
+    next[s] = start[s];
+  }
+  // Store the pieces in bucket order, which is also the rank order.
+  for (b = 0; b < size; ++b) {
+    const AliasPair* const p = &t->pairs_[b];
+    const uint32_t slot = b * cut;
+    const uint32_t count_b = p->cut_ - slot;
+    if (count_b > 0) {
+      AliasPiece* const piece = &pieces[next[b]++];
+      piece->slot_ = slot;
+      piece->rank_ = slot - p->start_;
+    }
+    if (count_b < cut) {
+      AliasPiece* const piece = &pieces[next[p->other_]++];
+      piece->slot_ = p->cut_;
+      piece->rank_ = p->cut_ - p->other_start_;
+    }
+  }
+  // Close each symbol's list with a sentinel and index the chunks.
+  for (s = 0; s < size; ++s) {
+    pieces[next[s]].rank_ = 0xffffu;   // ranks are < count <= 0xffff
+    pieces[next[s]].slot_ = 0;
+  }
+  for (s = 0; s < max_symbol; ++s) {
+    uint32_t j;
+    int k = start[s];
+    et->first_[s] = nb_chunks;
+    et->pieces_start_[s] = k;
+    for (j = 0; j < counts[s]; j += cut) {
+      AliasChunk* const c = &et->chunks_[nb_chunks++];
+      while (pieces[k + 1].rank_ <= j) ++k;
+      c->limit_ = pieces[k + 1].rank_;
+      c->deltas_ = PieceDelta(&pieces[k]);
+      if (c->limit_ == 0xffffu) {   // last piece
+        c->end_ = c->limit_;
+      } else {
+        c->end_ = pieces[k + 2].rank_;
+        c->deltas_ |= PieceDelta(&pieces[k + 1]) << 16;
+      }
+    }
+  }
+  return 1;
+}
+
+//------------------------------------------------------------------------------
+
+int AliasBuildDecTable(const AliasTable* const t, const uint32_t counts[],
+                       int max_symbol, AliasEntry entries[ALIAS_MAX_SYMBOLS]) {
+  const int size = 1 << t->log2_size_;
+  int b;
+  for (b = 0; b < size; ++b) {
+    const AliasPair* const p = &t->pairs_[b];
+    const uint32_t freq = (b < max_symbol) ? counts[b] : 0;
+    const uint32_t other_freq = counts[p->other_];
+    if (freq > 0xffffu || other_freq > 0xffffu) return 0;
+    entries[b].cut_ = p->cut_;
+    entries[b].start_ = (uint32_t)p->start_ | (freq << 16);
+    entries[b].other_start_ = (uint32_t)p->other_start_ | (other_freq << 16);
+    entries[b].symbols_ = (uint32_t)b | ((uint32_t)p->other_ << 8);
+  }
+  return 1;
+}
+
 //------------------------------------------------------------------------------
 
-int AliasVerifyTable(const AliasTable t,
+int AliasVerifyTable(const AliasTable* const t,
                      const uint32_t counts[], int max_symbol) {
   int error = 0;
 #ifdef DEBUG_ALIAS
   int i, s;
   uint32_t c[MAX_SYMBOLS] = { 0 };
-  const float norm = 100.f / MAX_TAB_SIZE;
+  const int tab_size = 1 << (t->log2_size_ + t->shift_);
   {
     uint32_t r;
     alias_t map[MAX_TAB_SIZE];
     AliasGenerateMap(t, map);
-    for (r = 0; r < MAX_TAB_SIZE; ++r) ++c[map[r]];
+    for (r = 0; r < tab_size; ++r) ++c[map[r]];
   }
   for (s = 0; s < max_symbol; ++s) {
     error += abs(c[s] - counts[s]);
@@ -147,16 +245,17 @@ int AliasVerifyTable(const AliasTable t,
   }
 
   memset(c, 0, sizeof(c));
-  for (i = 0; i < MAX_TAB_SIZE; ++i) {
+  for (i = 0; i < tab_size; ++i) {
     uint32_t rank;
     const int s = AliasSearchSymbol(t, i, &rank);
     const int count = c[s]++;
     if (rank != count) {
-      const int r = i >> (MAX_LOG_TAB_SIZE - LOG2_MAX_SYMBOLS);
-      const int use_alias = (i >= t[r].cut_);
+      const int r = i >> t->shift_;
+      const AliasPair* const p = &t->pairs_[r];
+      const int use_alias = (i >= p->cut_);
       printf("%c s=%d%c %d / %d   r=%d  bucket=%d offset=%d | %d\n",
              " !"[rank != count], s, " *"[use_alias], rank, count, i, r,
-             t[r].start_, t[r].other_start_);
+             p->start_, p->other_start_);
       error += (rank != count);
     }
   }
@@ -39,26 +39,108 @@ typedef struct {
   int32_t other_start_;
 } AliasPair;
 
-typedef AliasPair AliasTable[ALIAS_MAX_SYMBOLS];
-
-static inline alias_t AliasSearchSymbol(const AliasTable t, uint32_t r,
-                                        uint32_t* const rank) {
-  const int s = r >> (MAX_LOG_TAB_SIZE - LOG2_MAX_SYMBOLS);
-  const int use_alias = (r >= t[s].cut_);
-  *rank = r - (use_alias ? t[s].other_start_ : t[s].start_);
-  return use_alias ? t[s].other_ : (alias_t)s;
+// Only the first (1 << log2_size_) pairs are used. The smallest table that
+// can hold an alphabet of max_symbol symbols is AliasLog2Size(max_symbol).
+typedef struct {
+  int log2_size_;    // log2 of the number of buckets
+  int shift_;        // log_tab_size - log2_size_
+  AliasPair pairs_[ALIAS_MAX_SYMBOLS];
+} AliasTable;
+
+static inline int AliasLog2Size(int max_symbol) {
+  int log2_size = 0;
+  while ((1 << log2_size) < max_symbol) ++log2_size;
+  return log2_size;
 }
 
-int AliasInit(AliasTable t, const uint32_t counts[], int max_symbol);
-void AliasGenerateMap(const AliasTable t, alias_t map[MAX_TAB_SIZE]);
+// 'r' is the residual in [0, 1 << log_tab_size)
+static inline alias_t AliasSearchSymbol(const AliasTable* const t,
+                                        uint32_t r, uint32_t* const rank) {
+  const int s = r >> t->shift_;
+  const AliasPair* const p = &t->pairs_[s];
+  const int use_alias = (r >= p->cut_);
+  *rank = r - (use_alias ? p->other_start_ : p->start_);
+  return use_alias ? p->other_ : (alias_t)s;
+}
 
-int AliasVerifyTable(const AliasTable t,
+// 'counts' must be normalized to 1 << log_tab_size. The table will use
+// 1 << log2_size buckets, with log2_size in [AliasLog2Size(max_symbol),
+// min(LOG2_MAX_SYMBOLS, log_tab_size)].
+int AliasInit(AliasTable* const t, const uint32_t counts[], int max_symbol,
+              int log_tab_size, int log2_size);
+void AliasGenerateMap(const AliasTable* const t, alias_t map[MAX_TAB_SIZE]);
+
+int AliasVerifyTable(const AliasTable* const t,
                      const uint32_t counts[], int max_symbol);   // debug
 
+// decoding:
+
+// Packed form of an AliasPair, with the symbols' frequencies folded in, so
+// that a bucket is resolved with one 16-byte load (and several buckets can
+// be resolved at once with vector compares and blends).
+typedef struct {
+  uint32_t cut_;
+  uint32_t start_;          // start_ | (freq of the bucket's symbol << 16)
+  uint32_t other_start_;    // other_start_ | (freq of other_ << 16)
+  uint32_t symbols_;        // bucket's symbol | (other_ << 8)
+} AliasEntry;
+
+// Fills the (1 << t->log2_size_) first entries[]. Frequencies must fit
+// in 16 bits, which excludes the single-symbol case.
+int AliasBuildDecTable(const AliasTable* const t, const uint32_t counts[],
+                       int max_symbol, AliasEntry entries[ALIAS_MAX_SYMBOLS]);
+
 // encoding:
+
+// Map-based version: map[start + rank] is the residual for the 'rank'-th
+// occurrence of a symbol starting at 'start'. Needs MAX_TAB_SIZE entries.
 int AliasBuildEncMap(const uint32_t counts[], int max_symbol,
+                     int log_tab_size, int log2_size,
                      uint16_t map[MAX_TAB_SIZE]);
 
+// Map-free version: each bucket holds at most two 'pieces' of consecutive
+// residuals (its own symbol below cut_, the 'other' one above). Pieces
+// are stored per symbol, in increasing rank order and followed by a
+// sentinel. To avoid searching, each multiple of the bucket width in a
+// symbol's rank range has a 'chunk' caching the piece containing it and the
+// following one, which together almost always cover the whole chunk and
+// can be selected without branching. Everything fits in ~8k.
+typedef struct {
+  uint16_t rank_;    // rank of the first residual in the piece
+  uint16_t slot_;    // first residual of the piece
+} AliasPiece;
+
+typedef struct {
+  uint16_t limit_;      // rank where the first cached piece ends
+  uint16_t end_;        // rank where the second cached piece ends
+  uint32_t deltas_;     // slot - rank for each piece, modulo 2^16
+} AliasChunk;
+
+typedef struct {
+  int shift_;                                       // log2 of bucket width
+  uint16_t first_[ALIAS_MAX_SYMBOLS];               // first chunk of symbol
+  uint16_t pieces_start_[ALIAS_MAX_SYMBOLS];        // first piece of symbol
+  AliasChunk chunks_[2 * ALIAS_MAX_SYMBOLS];
+  AliasPiece pieces_[3 * ALIAS_MAX_SYMBOLS];        // pieces + sentinels
+} AliasEncTable;
+
+int AliasBuildEncTable(const AliasTable* const t, const uint32_t counts[],
+                       int max_symbol, AliasEncTable* const et);
+
+static inline uint32_t AliasEncodeSlot(const AliasEncTable* const et,
+                                       int symbol, uint32_t rank) {
+  const int chunk = et->first_[symbol] + (rank >> et->shift_);
+  const AliasChunk* const c = &et->chunks_[chunk];
+  if (rank < c->end_) {
+    const int shift = (rank >= c->limit_) << 4;   // selects the piece
+    return (uint16_t)(rank + (c->deltas_ >> shift));
+  } else {
+    const AliasPiece* p = &et->pieces_[et->pieces_start_[symbol]];
+    while (rank >= p[1].rank_) ++p;
+    return p->slot_ + rank - p->rank_;
+  }
+}
+
 // Spread function for alias look-up.
 int AliasSpreadMap(int max_symbol, const uint32_t counts[],
                    int log_tab_size, uint8_t symbols[]);
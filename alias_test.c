@@ -0,0 +1,161 @@
+//Copyright 2014 The FSC Authors. All Rights Reserved.
+//
+//Licensed under the Apache License, Version 2.0 (the "License");
+//you may not use this file except in compliance with the License.
+//You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+//    Unless required by applicable law or agreed to in writing, software
+//    distributed under the License is distributed on an "AS IS" BASIS,
+//    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//    See the License for the specific language governing permissions and
+//    limitations under the License.
+//------------------------------------------------------------------------------
+//
+// Test for the alias encoding tables: checks that the map-free look-up
+// matches the map-based one exactly, and compares their speed.
+//
+
+#include "./fsc_utils.h"
+#include "./alias.h"
+
+static int GenerateCounts(uint32_t counts[MAX_SYMBOLS], int max_symbol,
+                          int log_tab_size, FSCRandom* rg) {
+  int s;
+  for (s = 0; s < max_symbol; ++s) {
+    counts[s] = 1 + FSCRandomBits(rg, 1 + (s % 12));
+  }
+  return (FSCNormalizeCounts(counts, max_symbol, log_tab_size) == max_symbol);
+}
+
+static int CheckTables(const uint32_t counts[], int max_symbol,
+                       const uint16_t map[], const AliasEncTable* const et) {
+  int s, nb_errors = 0;
+  uint32_t start = 0;
+  for (s = 0; s < max_symbol; ++s) {
+    uint32_t rank;
+    for (rank = 0; rank < counts[s]; ++rank) {
+      const uint32_t r0 = map[start + rank];
+      const uint32_t r1 = AliasEncodeSlot(et, s, rank);
+      if (r0 != r1) {
+        if (nb_errors < 10) {
+          printf("Error! symbol %d rank %u: %u != %u\n", s, rank, r0, r1);
+        }
+        ++nb_errors;
+      }
+    }
+    start += counts[s];
+  }
+  return nb_errors;
+}
+
+// Mimics the encoding loop: each residual depends on the previous one.
+#define BENCH_LOOP(SLOT) do {                                               \
+  uint32_t x = 0;                                                           \
+  int n;                                                                    \
+  for (n = 0; n < N; ++n) {                                                 \
+    const int s = syms[n];                                                  \
+    const uint32_t rank = (x ^ n) % counts[s];                              \
+    x = (SLOT);                                                             \
+  }                                                                         \
+  checksum += x;                                                            \
+} while (0)
+
+//------------------------------------------------------------------------------
+
+void Help() {
+  printf("usage: ./alias_test [options] [size]\n");
+  printf("-s <int>           : number of symbols (default: all sizes)\n");
+  printf("-l <int>           : table size bits (default: all sizes)\n");
+  printf("-h                 : this help\n");
+  exit(0);
+}
+
+int main(int argc, const char* argv[]) {
+  int N = 1000000;
+  int smin = 2, smax = MAX_SYMBOLS;
+  int lmin = MIN_LOG_TAB_SIZE_W, lmax = MAX_LOG_TAB_SIZE;
+  int nb_errors = 0;
+  uint32_t checksum = 0;
+  int c, max_symbol, log_tab_size;
+  FSCRandom r;
+  uint16_t* map = NULL;
+  uint8_t* syms = NULL;
+
+  for (c = 1; c < argc; ++c) {
+    if (!strcmp(argv[c], "-h")) {
+      Help();
+    } else if (!strcmp(argv[c], "-s") && c + 1 < argc) {
+      smin = smax = atoi(argv[++c]);
+      if (smin < 2) smin = smax = 2;
+      if (smin > MAX_SYMBOLS) smin = smax = MAX_SYMBOLS;
+    } else if (!strcmp(argv[c], "-l") && c + 1 < argc) {
+      lmin = lmax = atoi(argv[++c]);
+      if (lmin < MIN_LOG_TAB_SIZE_W) lmin = lmax = MIN_LOG_TAB_SIZE_W;
+      if (lmin > MAX_LOG_TAB_SIZE) lmin = lmax = MAX_LOG_TAB_SIZE;
+    } else {
+      N = atoi(argv[c]);
+      if (N < 1) N = 1;
+    }
+  }
+  const double MS = 1.e-6 * N;
+
+  map = (uint16_t*)malloc(MAX_TAB_SIZE * sizeof(*map));
+  syms = (uint8_t*)malloc(N * sizeof(*syms));
+  if (map == NULL || syms == NULL) goto end;
+  FSCInitRandom(&r);
+
+  for (max_symbol = smin; max_symbol <= smax; max_symbol *= 2) {
+    for (log_tab_size = lmin; log_tab_size <= lmax; log_tab_size += 2) {
+      const int log2_size = AliasLog2Size(max_symbol);
+      uint32_t counts[MAX_SYMBOLS];
+      AliasTable t;
+      AliasEncTable et;
+      MyClock start, tmp;
+      double t_map, t_enc;
+      int n;
+
+      if (!GenerateCounts(counts, max_symbol, log_tab_size, &r)) continue;
+      if (!AliasBuildEncMap(counts, max_symbol, log_tab_size, log2_size, map) ||
+          !AliasInit(&t, counts, max_symbol, log_tab_size, log2_size) ||
+          !AliasBuildEncTable(&t, counts, max_symbol, &et)) {
+        printf("Table init error! (%d symbols, %d bits)\n",
+               max_symbol, log_tab_size);
+        ++nb_errors;
+        goto end;
+      }
+      nb_errors += CheckTables(counts, max_symbol, map, &et);
+      if (nb_errors) goto end;
+
+      for (n = 0; n < N; ++n) {
+        do {
+          syms[n] = FSCRandomBits(&r, 8) % max_symbol;
+        } while (counts[syms[n]] == 0);
+      }
+      {
+        uint32_t starts[MAX_SYMBOLS], total = 0;
+        int s;
+        for (s = 0; s < max_symbol; ++s) {
+          starts[s] = total;
+          total += counts[s];
+        }
+        GetElapsed(&start, NULL);
+        BENCH_LOOP(map[starts[s] + rank]);
+        t_map = MS / GetElapsed(&tmp, &start);
+      }
+      GetElapsed(&start, NULL);
+      BENCH_LOOP(AliasEncodeSlot(&et, s, rank));
+      t_enc = MS / GetElapsed(&tmp, &start);
+
+      printf("%3d symbols, %2d bits:  map %6.1lf MS/s  map-free %6.1lf MS/s\n",
+             max_symbol, log_tab_size, t_map, t_enc);
+    }
+  }
+  printf("Done. (checksum=0x%.8x)\n", checksum);
+
+ end:
+  free(map);
+  free(syms);
+  return (nb_errors != 0);
+}
@@ -14,6 +14,7 @@
 //------------------------------------------------------------------------------
 //
 // Test proggy for comparing Arithmetic / binary ANS compression
+// (the binary ANS coder being FSCBinaryEncode() / FSCBinaryDecode())
 //
 
 #include "./fsc_utils.h"
@@ -29,144 +30,6 @@ typedef uint32_t ANSStateW;  // internal state
 #define BITS_LIMIT ((ANSStateW)1 << BITS)
 #define BITS_MASK (BITS_LIMIT - 1)
 
-#define RECIPROCAL_BITS (16)
-#include "./divide.h"
-
-// #define USE_TABLE
-
-#ifdef USE_TABLE
-static ANSProba kSpreadTab[PROBA_MASK + 1];
-void InitSpreadTable(ANSProba p0, ANSProba tab[], int inverse) {
-  int r;
-  FSCRandom rg;
-  FSCInitRandom(&rg);
-  if (inverse) {
-    ANSProba tmp[PROBA_MASK + 1];
-    InitSpreadTable(p0, tmp, 0);
-    for (r = 0; r <= PROBA_MASK; ++r) tab[tmp[r]] = r;
-    return;
-  }
-  for (r = 0; r <= PROBA_MASK; ++r) {
-    //tab[r] = (r < p0) ? (PROBA_MASK + 1 - p0 + r) : r - p0;
-    const int K = (PROBA_MAX>>2) + (PROBA_MAX>>3) + 1;
-    tab[(r * K) & PROBA_MASK] = r;
-  }
-}
-#endif
-
-static size_t bANSEncode(const uint8_t* in, size_t in_size,
-                         uint8_t* const buf_start, uint8_t* const buf_end,
-                         ANSProba p0) {
-  ANSStateW x;
-  const ANSProba q0 = PROBA_MAX - p0;
-  const ANSStateW threshold0 = BITS_LIMIT * p0;
-  const ANSStateW threshold1 = BITS_LIMIT * q0;
-#if (RECIPROCAL_BITS >= 0)
-  inv_t inv_p0, inv_q0;
-  FSCInitDivide(p0, &inv_p0);
-  FSCInitDivide(q0, &inv_q0);
-#endif
-#ifdef USE_TABLE
-  InitSpreadTable(p0, kSpreadTab, 0);
-#endif
-  ANSBaseW* buf = (ANSBaseW*)buf_end;
-  assert(sizeof(ANSBaseW) * 8 == BITS);
-
-  int i = in_size - 1;
-  if (in_size <= BITS/8) {   // special corner case for too-small input
-    if (buf_end - in_size < buf_start) return 0;  // error
-    memcpy(buf_end - in_size, in, in_size);
-    return in_size;
-  }
-  // We encode the first few bytes into initial state.
-  x = 1ull;
-  while (x < BITS_LIMIT) {
-    x = (x << 8) | in[i];
-    --i;
-  }
-  // encode the rest... (in reverse)
-  for (; i >= 0; --i) {
-    if (x >= (in[i] ? threshold1 : threshold0)) {
-      if (buf <= (ANSBaseW*)buf_start) return 0;  // error
-      *--buf = x & BITS_MASK;
-      x >>= BITS;
-    }
-#if (RECIPROCAL_BITS >= 0)
-// x is decomposed as: x = k.p0 + r
-// x' = k.L + r , where k = x/p0 = (x * inv_p0) >> FIX
-// x' = k.L + x - k.p0 = k.(L-p0) + x = k.q0 + x
-// and similarly: x' = x + (x / q0) * p0 + p0 for the other symbol
-    if (in[i]) {
-      const ANSStateW q = FSCDivide(x, inv_q0);
-      x += q * p0 + p0;
-    } else {
-      const ANSStateW q = FSCDivide(x, inv_p0);
-      x += q * q0 + 0;
-    }
-#else
-#ifndef USE_TABLE
-    if (in[i]) {
-      // here, gcc-x86 is faster because x/q0 and x%q0 are a single instruction
-      x = ((x / q0) << PROBA_BITS) + (x % q0) + p0;
-    } else {
-      x = ((x / p0) << PROBA_BITS) + (x % p0);
-    }
-#else
-    if (in[i]) {
-      x = ((x / q0) << PROBA_BITS) + kSpreadTab[(x % q0) + p0];
-    } else {
-      x = ((x / p0) << PROBA_BITS) + kSpreadTab[(x % p0) + 0];
-    }
-#endif
-#endif
-  }
-  if (buf - 2 < (ANSBaseW*)buf_start) {
-    printf("BUFFER ERROR!\n");
-    return 0;
-  }
-  *--buf = (x >>    0) & BITS_MASK;
-  *--buf = (x >> BITS) & BITS_MASK;
-
-  return buf_end - (uint8_t*)buf;
-}
-
-static int bANSDecode(const ANSBaseW* ptr,
-                      uint8_t* out, size_t in_size, ANSProba p0) {
-  ANSStateW x = ((ANSStateW)ptr[0] << BITS) | (ANSStateW)ptr[1];
-  ptr += 2;
-  const ANSProba q0 = PROBA_MAX - p0;
-  int i;
-#ifdef USE_TABLE
-  InitSpreadTable(p0, kSpreadTab, 1);
-#endif
-  if (in_size <= 4) {
-    memcpy(out, ptr, in_size);
-    return 1;
-  }
-  in_size -= BITS / 8;  // few last bytes are encoded in the final state
-  for (i = 0; i < in_size; ++i) {
-    if (x < PROBA_MAX) {
-      x = (x << BITS) | *ptr++;   // decode forward
-    }
-#ifndef USE_TABLE
-    const ANSProba xfrac = x & PROBA_MASK;
-#else
-    const ANSProba xfrac = kSpreadTab[x & PROBA_MASK];
-#endif
-    out[i] = (xfrac >= p0);
-    if (xfrac < p0) {
-      x = p0 * (x >> PROBA_BITS) + xfrac;
-    } else {
-      x = q0 * (x >> PROBA_BITS) + xfrac - p0;
-    }
-  }
-  while (x != 1ull) {
-    out[i++] = x & 0xff;
-    x >>= 8;
-  }
-  return 1;
-}
-
 //------------------------------------------------------------------------------
 
 static size_t bArithEncode(const uint8_t* in, size_t in_size,
@@ -258,6 +121,22 @@ static int CheckErrors(size_t N, const uint8_t out[], const uint8_t base[],
   return nb_errors;
 }
 
+// Decodes truncated copies of the stream, from buffers of their exact size so
+// that the memory checkers can catch any read beyond the input.
+static void DecodeTruncated(const uint8_t* bits, size_t size) {
+  size_t len;
+  for (len = size - 1; len > 0; len /= 2) {
+    uint8_t* const cut = (uint8_t*)malloc(len);
+    uint8_t* out = NULL;
+    size_t out_size = 0;
+    if (cut == NULL) return;
+    memcpy(cut, bits, len);
+    FSCBinaryDecode(cut, len, &out, &out_size);   // may or may not fail
+    free(out);
+    free(cut);
+  }
+}
+
 static void Generate(uint8_t* in, size_t size, ANSProba p0, FSCRandom* rg) {
   int i;
   for (i = 0; i < size; ++i) {
@@ -277,6 +156,8 @@ static void Generate(uint8_t* in, size_t size, ANSProba p0, FSCRandom* rg) {
 
 void Help() {
   printf("usage: ./bit_cmp [options] [size]\n");
+  printf("-p <int>           : probability of '0', in 1/256 units\n");
+  printf("-a <int>           : adaptive ANS probability, with given shift\n");
   printf("-h                 : this help\n");
   exit(0);
 }
@@ -286,6 +167,7 @@ int main(int argc, const char* argv[]) {
   int L = 16;
   int nb_errors = 0;
   int pmin = 1, pmax = 255;
+  int adapt_shift = 0;
   int c;
 
   for (c = 1; c < argc; ++c) {
@@ -295,6 +177,12 @@ int main(int argc, const char* argv[]) {
       L = atoi(argv[++c]);
     } else if (!strcmp(argv[c], "-p") && c + 1 < argc) {
       pmin = pmax = atoi(argv[++c]);
+      if (pmin < 1) pmin = pmax = 1;
+      if (pmin > 255) pmin = pmax = 255;
+    } else if (!strcmp(argv[c], "-a") && c + 1 < argc) {
+      adapt_shift = atoi(argv[++c]);
+      if (adapt_shift < 0) adapt_shift = 0;
+      if (adapt_shift > FSC_BIN_MAX_SHIFT) adapt_shift = FSC_BIN_MAX_SHIFT;
     } else {
       N = atoi(argv[c]);
       if (N <= 2) N = 2;
@@ -328,20 +216,29 @@ int main(int argc, const char* argv[]) {
     const double S1 = 8. * GetEntropy(base, N);
 
     {
+      uint8_t* ans_bits = NULL;
+      uint8_t* ans_out = NULL;
+      size_t ans_size = 0, out_size = 0;
       GetElapsed(&start, NULL);
-      bits_size = bANSEncode(base, N, bits, bits_end, p0);
-      if (bits_size == 0) {
+      if (!FSCBinaryEncode(base, N, p0, adapt_shift, &ans_bits, &ans_size)) {
         printf("ANS Encoding error!\n");
         goto End;
       }
-      S_ANS = 8.0 * bits_size / N;
+      S_ANS = 8.0 * ans_size / N;
       t_ANS_enc = MS / GetElapsed(&tmp, &start);
 
       GetElapsed(&start, NULL);
-
-      nb_errors = !bANSDecode((ANSBaseW*)(bits_end - bits_size), out, N, p0);
+      nb_errors = !FSCBinaryDecode(ans_bits, ans_size, &ans_out, &out_size);
       t_ANS_dec = MS / GetElapsed(&tmp, &start);
-      nb_errors += CheckErrors(N, out, base, "ANS");
+      if (!nb_errors && out_size == (size_t)N) {
+        nb_errors += CheckErrors(N, ans_out, base, "ANS");
+        DecodeTruncated(ans_bits, ans_size);
+      } else {
+        printf("ANS Decoding error!\n");
+        nb_errors = 1;
+      }
+      free(ans_bits);
+      free(ans_out);
     }
 
     {
@@ -356,7 +253,7 @@ int main(int argc, const char* argv[]) {
 
       GetElapsed(&start, NULL);
 
-      nb_errors = !bArithDecode((ANSBaseW*)bits, out, N, p0);
+      nb_errors += !bArithDecode((ANSBaseW*)bits, out, N, p0);
       t_AC_dec = MS / GetElapsed(&tmp, &start);
       nb_errors += CheckErrors(N, out, base, "AC");
     }
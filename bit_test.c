@@ -75,6 +75,7 @@ void Help() {
   printf("-p <int>           : try only one proba value\n");
   printf("-fsc               : skip FSC\n");
   printf("-fsc8              : skip FSC8\n");
+  printf("-pack-out          : FSC8 decodes to packed bits (default: unpack)\n");
   FSCPrintCodingOptions();
   printf("-h                 : this help\n");
   exit(0);
@@ -89,6 +90,7 @@ int main(int argc, const char* argv[]) {
   FSCCodingMethod method = CODING_METHOD_DEFAULT;
   int skip_FSC = 0;
   int skip_FSC8 = 0;
+  int pack_out = 0;
   int c;
 
   for (c = 1; c < argc; ++c) {
@@ -102,6 +104,8 @@ int main(int argc, const char* argv[]) {
       skip_FSC = 1;
     } else if (!strcmp(argv[c], "-fsc8")) {
       skip_FSC8 = 1;
+    } else if (!strcmp(argv[c], "-pack-out")) {
+      pack_out = 1;
     } else if (!strcmp(argv[c], "-l") && c + 1 < argc) {
       log_tab_size = atoi(argv[++c]);
     } else if (!strcmp(argv[c], "-p") && c + 1 < argc) {
@@ -163,8 +167,8 @@ int main(int argc, const char* argv[]) {
 
     if (!skip_FSC8) {
       GetElapsed(&start, NULL);
-      nb_errors =
-          !FSCEncode(base8, N8, &bits, &bits_size, log_tab_size_8, method);
+      nb_errors = !FSCEncodePacked(base8, N, 1, &bits, &bits_size,
+                                   log_tab_size_8, method);
       if (nb_errors) {
         printf("FSC8 Encoding error!\n");
         goto end;
@@ -173,10 +177,18 @@ int main(int argc, const char* argv[]) {
       t_FSC8_enc = MS / GetElapsed(&tmp, &start);
 
       GetElapsed(&start, NULL);
-      nb_errors = !FSCDecode(bits, bits_size, &out8, &out8_size);
+      free(out8);
+      out8 = NULL;
+      nb_errors = !FSCDecodePacked(bits, bits_size, !pack_out,
+                                   &out8, &out8_size, NULL, NULL);
       t_FSC8_dec = MS / GetElapsed(&tmp, &start);
-      nb_errors += (out8_size != N8);
-      nb_errors += CheckErrors(N8, out8, base8, "FSC8");
+      if (pack_out) {
+        nb_errors += (out8_size != (size_t)N8);
+        nb_errors += CheckErrors(N8, out8, base8, "FSC8");
+      } else {
+        nb_errors += (out8_size != (size_t)N);
+        nb_errors += CheckErrors(N, out8, base, "FSC8");
+      }
       free(bits);
     }
 
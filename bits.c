@@ -18,23 +18,12 @@
 // Author: Skal (pascal.massimino@gmail.com)
 
 #include "./bits.h"
+#include "./fsc.h"    // for FSCMalloc()
 #include <string.h>   // for memcpy()
 
-#define MAX_BITS 16   // max number of bit we have to read or write
-
 //------------------------------------------------------------------------------
 // endian-ness
 
-#if defined(__APPLE__)
-#include <libkern/OSByteOrder.h>
-#define htole32 OSSwapHostToLittleInt32
-#define htole16 OSSwapHostToLittleInt16
-#define le16toh OSSwapLittleToHostInt16
-#define le32toh OSSwapLittleToHostInt32
-#else
-#include <endian.h>
-#endif
-
 #if (RBYTES == 4)
 #define RSWAP le32toh
 #else
@@ -54,12 +43,23 @@ void FSCInitBitReader(FSCBitReader* const br,
 
   br->buf_ = start;
   br->end_ = start + length;
+  br->fast_end_ = (length > sizeof(br->bits_)) ? br->end_ - sizeof(br->bits_)
+                                               : start;
   br->bits_ = 0;
   br->bit_pos_ = 0;
   br->eof_ = 0;
   for (i = 0; i < sizeof(br->bits_) && i < length; ++i) {
     br->bits_ |= ((fsc_val_t)(*br->buf_++)) << (8 * i);
   }
+  // For short inputs, the window is completed with zero bytes. Account for
+  // them so that FSCBitAlign() returns the right position.
+  br->buf_ = start + sizeof(br->bits_);
+}
+
+void FSCSetBitReaderPadding(FSCBitReader* const br, size_t padding) {
+  if (padding >= sizeof(br->bits_)) {
+    br->fast_end_ = br->end_ + padding - sizeof(br->bits_);
+  }
 }
 
 void FSCSetReadBufferPos(FSCBitReader* const br, const uint8_t* buf) {
@@ -75,6 +75,11 @@ const uint8_t* FSCGetBytePos(FSCBitReader* const br) {
 const uint8_t* FSCGetByteEnd(FSCBitReader* const br) {
   return br->end_;
 }
+int FSCReadPastEnd(const FSCBitReader* const br) {
+  // the LBITS - bit_pos_ unread bits end at buf_ (zero-padded if beyond end_)
+  return (br->bit_pos_ - (int)LBITS) > 8 * (br->end_ - br->buf_);
+}
+
 const uint8_t* FSCBitAlign(FSCBitReader* const br) {
   br->buf_ -= (LBITS - br->bit_pos_) >> 3;
   br->bit_pos_ = 0;
@@ -84,7 +89,7 @@ const uint8_t* FSCBitAlign(FSCBitReader* const br) {
 }
 
 void FSCDoFillBitWindow(FSCBitReader* const br) {
-  if (br->buf_ + sizeof(br->bits_) < br->end_) {
+  if (br->buf_ < br->fast_end_) {
     // read several bytes at a time without bswap
     br->bits_ >>= RBITS;
     br->bit_pos_ -= RBITS;
@@ -92,12 +97,21 @@ void FSCDoFillBitWindow(FSCBitReader* const br) {
     br->buf_ += RBYTES;
     return;
   } else {  // finish with bytes
+    // (with padding, buf_ can already be past end_)
     while (br->bit_pos_ >= 8 && br->buf_ < br->end_) {
       br->bit_pos_ -= 8;
       br->bits_ >>= 8;
       br->bits_ |= ((fsc_val_t)(*br->buf_++)) << (LBITS - 8);
     }
-    br->eof_ = (br->buf_ == br->end_) && (br->bit_pos_ >= LBITS);
+    // Past the end, zero bytes are shifted in (buf_ moving past end_ as if
+    // they were read), so that bit_pos_ never reaches LBITS.
+    while (br->bit_pos_ >= 8) {
+      br->bit_pos_ -= 8;
+      br->bits_ >>= 8;
+      ++br->buf_;
+    }
+    // all the bits of the input were read
+    br->eof_ = (br->bit_pos_ - (int)LBITS >= 8 * (br->end_ - br->buf_));
   }
 }
 
@@ -115,94 +129,97 @@ uint32_t FSCReadBits(FSCBitReader* const br, int nb) {
 
 static int SetSize(FSCBitWriter* const bw, size_t new_size) {
   if (new_size < 4096) new_size = 4096;
-  uint8_t* const new_buf = (uint8_t*)malloc(new_size * sizeof(*new_buf));
+  if (!bw->owned_) {   // caller's buffer can't be resized
+    bw->error_ = 1;
+    return 0;
+  }
+  uint8_t* const new_buf = (uint8_t*)FSCMalloc(new_size * sizeof(*new_buf));
   if (new_buf == NULL) {
     bw->error_ = 1;
     return 0;
   }
   const size_t cur_size = bw->cur_ - bw->buf_;
   if (cur_size > 0) memcpy(new_buf, bw->buf_, cur_size * sizeof(*new_buf));
-  free(bw->buf_);
+  FSCFree(bw->buf_);
   bw->buf_ = new_buf;
   bw->cur_ = new_buf + cur_size;
   bw->end_ = bw->buf_ + new_size;
   return 1;
 }
 
-static int GrowSize(FSCBitWriter* const bw) {
-  size_t new_size = (3 * (bw->end_ - bw->buf_)) >> 1;
-  return SetSize(bw, new_size + 16384u);
+int FSCBitWriterInit(FSCBitWriter* const bw, size_t expected_size) {
+  memset(bw, 0, sizeof(*bw));
+  bw->owned_ = 1;
+  return SetSize(bw, expected_size / sizeof(*bw->buf_));
 }
 
-static void CheckRoom(FSCBitWriter* const bw, int nb) {
-  uint8_t* const cur = bw->cur_;
-  uint8_t* const end = bw->end_;
-  if (&cur[(nb + 7) >> 3] > end) GrowSize(bw);
+void FSCBitWriterInitBuffer(FSCBitWriter* const bw,
+                            uint8_t* const buf, size_t size) {
+  memset(bw, 0, sizeof(*bw));
+  bw->buf_ = bw->cur_ = buf;
+  bw->end_ = buf + size;
 }
 
-int FSCBitWriterInit(FSCBitWriter* const bw, size_t expected_size) {
-  memset(bw, 0, sizeof(*bw));
-  return SetSize(bw, expected_size / sizeof(*bw->buf_));
+int FSCBitWriterDoReserve(FSCBitWriter* const bw, size_t size) {
+  const size_t min_size = (bw->cur_ - bw->buf_) + size + sizeof(fsc_val_t);
+  size_t new_size = (3 * (bw->end_ - bw->buf_)) >> 1;
+  if (bw->error_) return 0;
+  if (new_size < min_size) new_size = min_size;
+  return SetSize(bw, new_size + 16384u);
 }
 
 void FSCBitWriterFlush(FSCBitWriter* const bw) {
-  CheckRoom(bw, bw->used_);
-  while (bw->used_ > 0) {
-    *bw->cur_++ = bw->bits_;
-    bw->bits_ >>= 8;
-    bw->used_ -= 8;
-  }
+  if (!FSCBitWriterReserve(bw, 1)) return;
+  if (bw->used_ > 0) *bw->cur_++ = (uint8_t)bw->bits_;
   bw->used_ = 0;
   bw->bits_ = 0;
 }
 
 void FSCBitWriterDestroy(FSCBitWriter* const bw) {
   if (bw != NULL) {
-    free(bw->buf_);
+    if (bw->owned_) FSCFree(bw->buf_);
     memset(bw, 0, sizeof(*bw));
   }
 }
 
-#if (defined(__x86_64__) || defined(_M_X64))     // 64 bits
-typedef uint32_t fsc_wval_t;
-#define WBYTES 4
-#define WSWAP htole32
-#else                                            // 32 bits
-typedef uint16_t fsc_wval_t;
-#define WBYTES 2
-#define WSWAP htole16
-#endif
-#define WBITS (WBYTES * 8)
-
-void FSCWriteBits(FSCBitWriter* const bw, uint32_t bits, int nb) {
-  assert(nb <= MAX_BITS);
-  assert(bits < (1 << nb));
-  if (nb > 0) {
-    bw->bits_ |= ((fsc_val_t)bits) << bw->used_;
-    bw->used_ += nb;
-    if (bw->used_ >= WBITS) {
-      CheckRoom(bw, WBITS);
-      *(fsc_wval_t*)bw->cur_ = WSWAP(bw->bits_);
-      bw->cur_ += WBYTES;
-      bw->bits_ >>= WBITS;
-      bw->used_ -= WBITS;
-    }
-  }
+uint8_t* FSCBitWriterGetBuffer(FSCBitWriter* const bw, size_t size) {
+  FSCBitWriterFlush(bw);
+  return FSCBitWriterReserve(bw, size) ? bw->cur_ : NULL;
 }
 
 int FSCAppend(FSCBitWriter* const bw, const uint8_t* const buf, size_t len) {
   FSCBitWriterFlush(bw);
-  uint8_t* const new_end = bw->cur_ + len;
-  if (bw->cur_ + len > bw->end_) {
-    const size_t min_len = new_end - bw->buf_;
-    size_t request = (bw->end_  - bw->buf_) * 2;  // double buffer
-    if (request < min_len) request = min_len;
-    request = ((request >> 10) + 1) << 10;
-    if (!SetSize(bw, request)) return 0;
-  }
+  if (!FSCBitWriterReserve(bw, len)) return 0;
   memcpy(bw->cur_, buf, len);
   bw->cur_ += len;
   return 1;
 }
 
 //------------------------------------------------------------------------------
+// Sizes
+
+void FSCWriteSize(FSCBitWriter* const bw, size_t size) {
+  while (size) {
+    FSCWriteBits(bw, 1, 1);
+    FSCWriteBits(bw, size & 0xff, 8);
+    size >>= 8;
+  }
+  FSCWriteBits(bw, 0, 1);
+}
+
+size_t FSCReadSize(FSCBitReader* const br) {
+  size_t size = 0;
+  int i;
+  for (i = 0; i < (int)sizeof(size) && FSCReadBits(br, 1); ++i) {
+    size |= (size_t)FSCReadBits(br, 8) << (8 * i);
+  }
+  return size;
+}
+
+int FSCLog2Floor(uint32_t v) {
+  int b = 0;
+  while (v >>= 1) ++b;
+  return b;
+}
+
+//------------------------------------------------------------------------------
@@ -29,6 +29,21 @@
 
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>   // for memcpy()
+
+#if defined(__APPLE__)
+#include <libkern/OSByteOrder.h>
+#define htole64 OSSwapHostToLittleInt64
+#define htole32 OSSwapHostToLittleInt32
+#define htole16 OSSwapHostToLittleInt16
+#define le16toh OSSwapLittleToHostInt16
+#define le32toh OSSwapLittleToHostInt32
+#define le64toh OSSwapLittleToHostInt64
+#else
+#include <endian.h>
+#endif
+
+#define MAX_BITS 16   // max number of bit we have to read or write
 
 #ifdef __cplusplus
 extern "C" {
@@ -41,11 +56,13 @@ extern "C" {
 
 typedef uint64_t fsc_val_t;
 #define RBYTES 4
+#define WSWAP htole64
 
 #else                                            // 32 bits
 
 typedef uint32_t fsc_val_t;
 #define RBYTES 2
+#define WSWAP htole32
 
 #endif
 
@@ -58,6 +75,7 @@ typedef struct {
   fsc_val_t      bits_;       // bits accumulator
   const uint8_t* buf_;        // current position
   const uint8_t* end_;        // end of read position
+  const uint8_t* fast_end_;   // whole words can be loaded before this
   int            bit_pos_;    // unread bit position
   int            eof_;        // true if buf_ reached end_
 } FSCBitReader;
@@ -65,6 +83,9 @@ typedef struct {
 void FSCInitBitReader(FSCBitReader* const br,
                       const uint8_t* const start,
                       size_t length);
+// Declares that 'padding' readable bytes follow the input, so that refills
+// can load whole words up to the very end without checking.
+void FSCSetBitReaderPadding(FSCBitReader* const br, size_t padding);
 
 uint32_t FSCReadBits(FSCBitReader* const br, int nb);
 static FSC_INLINE uint32_t FSCSeeBits(FSCBitReader* const br) {
@@ -86,23 +107,54 @@ const uint8_t* FSCBitAlign(FSCBitReader* const br);
 extern const uint8_t* FSCGetBytePos(FSCBitReader* const br);
 extern const uint8_t* FSCGetByteEnd(FSCBitReader* const br);
 extern void FSCSetReadBufferPos(FSCBitReader* const br, const uint8_t* buf);
+// eof_ is raised as soon as the last bit is read, which is fine at the end
+// of a stream. This returns true only if bits were read beyond it.
+extern int FSCReadPastEnd(const FSCBitReader* const br);
 
 // -----------------------------------------------------------------------------
 // BitWriter
 
+// The writer stores a whole fsc_val_t at each FSCWriteBits() call without
+// checking for room: callers must first use FSCBitWriterReserve() for the
+// number of bytes they're about to write (e.g. once per block).
 typedef struct {
   fsc_val_t bits_;     // currently assembled bits
-  int used_;           // bit position (<= RBITS)
+  int used_;           // bit position (< 8 between calls)
   uint8_t* cur_;       // current write position
   uint8_t* buf_;       // start of writable buffer
   uint8_t* end_;       // non-writable pos
+  int owned_;          // true if buf_ was allocated (and can be grown)
   int error_;          // true if malloc failed (or other error)
 } FSCBitWriter;
 
 // Returns 0 in case of malloc error
 int FSCBitWriterInit(FSCBitWriter* const bw, size_t expected_size);
+// Writes into the caller's buffer, which is never resized.
+void FSCBitWriterInitBuffer(FSCBitWriter* const bw,
+                            uint8_t* const buf, size_t size);
+
+// Makes room for 'size' more bytes. Returns false (and sets error_) if the
+// buffer couldn't be grown.
+extern int FSCBitWriterDoReserve(FSCBitWriter* const bw, size_t size);
+static FSC_INLINE int FSCBitWriterReserve(FSCBitWriter* const bw,
+                                          size_t size) {
+  if ((size_t)(bw->end_ - bw->cur_) < size + sizeof(fsc_val_t)) {
+    return FSCBitWriterDoReserve(bw, size);
+  }
+  return !bw->error_;
+}
 
 void FSCBitWriterFlush(FSCBitWriter* const bw);
+
+// Flushes, then returns a pointer to 'size' writable bytes at the current
+// position (or NULL upon error). FSCBitWriterAdvance() commits the bytes
+// actually written there.
+uint8_t* FSCBitWriterGetBuffer(FSCBitWriter* const bw, size_t size);
+static FSC_INLINE void FSCBitWriterAdvance(FSCBitWriter* const bw,
+                                           size_t len) {
+  assert(bw->cur_ + len <= bw->end_);
+  bw->cur_ += len;
+}
 static FSC_INLINE size_t FSCBitWriterNumBytes(FSCBitWriter* const bw) {
   return (uint8_t*)bw->cur_ - (uint8_t*)bw->buf_;
 }
@@ -110,10 +162,39 @@ static FSC_INLINE uint8_t* FSCBitWriterFinish(FSCBitWriter* const bw) {
   return (uint8_t*)bw->buf_;
 }
 void FSCBitWriterDestroy(FSCBitWriter* const bw);
-void FSCWriteBits(FSCBitWriter* const bw, uint32_t bits, int nb);
+
+// Appends the nb (<= MAX_BITS) lowest bits of 'bits'. A full fsc_val_t is
+// stored at the current position, unchecked: the room must have been made
+// beforehand with FSCBitWriterReserve().
+static FSC_INLINE void FSCWriteBits(FSCBitWriter* const bw,
+                                    uint32_t bits, int nb) {
+  fsc_val_t v;
+  assert(nb <= MAX_BITS);
+  assert(bits < (1u << nb));
+  assert(bw->cur_ + sizeof(fsc_val_t) <= bw->end_);
+  bw->bits_ |= (fsc_val_t)bits << bw->used_;
+  bw->used_ += nb;
+  v = WSWAP(bw->bits_);
+  memcpy(bw->cur_, &v, sizeof(v));   // branchless: always store a full word
+  bw->cur_ += bw->used_ >> 3;
+  bw->bits_ >>= bw->used_ & ~7;
+  bw->used_ &= 7;
+}
 
 int FSCAppend(FSCBitWriter* const bw, const uint8_t* const buf, size_t len);
 
+// -----------------------------------------------------------------------------
+// Sizes
+
+// A size is coded as its bytes, lowest first, each preceded by a 1 bit, then
+// a 0 bit. FSCWriteSize() writes at most FSC_MAX_SIZE_BYTES, to be reserved.
+#define FSC_MAX_SIZE_BYTES 10
+void FSCWriteSize(FSCBitWriter* const bw, size_t size);
+size_t FSCReadSize(FSCBitReader* const br);
+
+// Index of the highest bit set, 0 for v == 0. Not a critical function.
+int FSCLog2Floor(uint32_t v);
+
 #ifdef __cplusplus
 }    // extern "C"
 #endif
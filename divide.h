@@ -48,7 +48,8 @@
 // Note that the last 'b+x' addition must take care of potential overflow by
 // one bit. Beware!
 
-#include "./fsc_utils.h"
+#include <assert.h>
+#include "./fsc.h"
 
 #ifndef HAVE_CEIL_LOG2
 #define HAVE_CEIL_LOG2
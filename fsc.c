@@ -42,6 +42,7 @@ static void Help() {
   printf("-d           : decompression mode\n");
   printf("-s           : don't emit output, just print stats\n");
   printf("-l           : change log-table-size (in [2..14], default 12)\n");
+  printf("               (in [8..16] for word-based coding)\n");
   FSCPrintCodingOptions();
   printf("-h           : this help\n");
   exit(0);
@@ -58,7 +59,7 @@ int main(int argc, const char* argv[]) {
   for (c = 1; c < argc; ++c) {
     if (!strcmp(argv[c], "-l") && c + 1 < argc) {
       log_tab_size = atoi(argv[++c]);
-      if (log_tab_size > LOG_TAB_SIZE) log_tab_size = LOG_TAB_SIZE;
+      if (log_tab_size > MAX_LOG_TAB_SIZE) log_tab_size = MAX_LOG_TAB_SIZE;
       else if (log_tab_size < 2) log_tab_size = 2;
     } else if (FSCParseCodingMethodOpt(argv[c], &method)) {
       continue;
@@ -75,6 +76,10 @@ int main(int argc, const char* argv[]) {
     }
   }
 
+  if (method < CODING_METHOD_16B && log_tab_size > LOG_TAB_SIZE) {
+    log_tab_size = LOG_TAB_SIZE;
+  }
+
   uint8_t* out = NULL;
   size_t out_size = 0;
   uint8_t* in = NULL;
@@ -31,6 +31,7 @@
 #define MAX_SYMBOLS 256    // byte-based
 #define LOG_TAB_SIZE      14    // max internal precision (must be <= 14)
 #define MAX_LOG_TAB_SIZE  16    // max precision for word-based coding
+#define MIN_LOG_TAB_SIZE_W 8    // min precision for word-based coding
 #define CRYPTO_KEY  0
 // disabled for now (so we investigate core algo):
 // #define CRYPTO_KEY 0x3fdc
@@ -48,12 +49,14 @@ typedef enum {
   CODING_METHOD_16B_ALIAS_2X,
 
   CODING_METHOD_16B_4X,   // default
+  CODING_METHOD_16B_ALIAS_4X,
 
   CODING_METHOD_UNIQUE,   // internal, do not use directly
 
   CODING_METHOD_LAST,
   CODING_METHOD_DEFAULT = CODING_METHOD_16B_4X
 } FSCCodingMethod;
+#define FSC_FILTERED_CODE 15   // method field of the filtered streams
 
 typedef uint32_t FSCStateW;
 typedef uint16_t FSCType;  // storage type
@@ -69,6 +72,7 @@ typedef uint16_t FSCType;  // storage type
 // Header parameter
 #define TAB_HDR_BITS 6
 #define HDR_SYMBOL_LIMIT 20
+#define MAX_HDR_SIZE 1024   // max bytes for the size, method and params
 
 //------------------------------------------------------------------------------
 // Decoding
@@ -77,9 +81,17 @@ typedef uint16_t FSCType;  // storage type
 // Result is in *out, must deallocated using free()
 int FSCDecode(const uint8_t* in, size_t in_size, uint8_t** out, size_t* out_size);
 
+// Same as FSCDecode(), but the caller guarantees that FSC_INPUT_PADDING
+// readable bytes (of any value) follow in[in_size - 1]. The bit reader can
+// then skip its end-of-input checks.
+#define FSC_INPUT_PADDING 16
+int FSCDecodePadded(const uint8_t* in, size_t in_size,
+                    uint8_t** out, size_t* out_size);
+
 // non-canned API:
 typedef struct FSCDecoder FSCDecoder;
 FSCDecoder* FSCInit(const uint8_t* input, size_t len);
+FSCDecoder* FSCInitPadded(const uint8_t* input, size_t len);   // see above
 int FSCIsOk(FSCDecoder* dec);
 int FSCDecompress(FSCDecoder* dec, uint8_t** out, size_t* size);
 void FSCDelete(FSCDecoder* dec);
@@ -93,11 +105,333 @@ int FSCEncode(const uint8_t* in, size_t in_size,
               uint8_t** out, size_t* out_size,
               int log_tab_size, FSCCodingMethod method);
 
+// Returns the maximum compressed size for in_size bytes encoded with
+// 'method' (whatever the log_tab_size).
+size_t FSCCompressBound(size_t in_size, FSCCodingMethod method);
+
+// Encodes into the caller's buffer 'out' of out_capacity bytes, which should
+// be at least FSCCompressBound(in_size, method): room is checked per block
+// against the worst case, so smaller buffers may be rejected even if the
+// result would fit. Returns 0 upon error. The output is never reallocated.
+int FSCEncodeToBuffer(const uint8_t* in, size_t in_size,
+                      uint8_t* out, size_t out_capacity, size_t* out_size,
+                      int log_tab_size, FSCCodingMethod method);
+
+//------------------------------------------------------------------------------
+// Size estimation
+
+// Returns an estimate of the size FSCEncode() would produce, without coding
+// anything: the header's size is exact, the payload is costed from the
+// normalized counts. Much faster than encoding. Returns 0 upon error.
+size_t FSCEstimateSize(const uint8_t* in, size_t in_size,
+                       FSCCodingMethod method, int log_tab_size);
+// Same, from the symbols' counts (as given by FSCCountSymbols()) of an input
+// of in_size bytes.
+size_t FSCEstimateSizeFromCounts(const uint32_t counts[MAX_SYMBOLS],
+                                 size_t in_size, FSCCodingMethod method,
+                                 int log_tab_size);
+
+// Fills cost_q8[] with the average cost of each symbol, in 1/256th of bit,
+// when coded with 'method' and the normalized 'counts' (which must sum to
+// the table size, see FSCNormalizeCounts()). For the tANS methods, the cost
+// accounts for the spread table. Symbols with a zero count get 0xffff. A
+// unique symbol (counts summing to 1) costs 0, whatever the method.
+// Returns 0 upon error.
+int FSCGetSymbolCosts(const uint32_t counts[MAX_SYMBOLS],
+                      FSCCodingMethod method, uint16_t cost_q8[MAX_SYMBOLS]);
+
+//------------------------------------------------------------------------------
+// Reusable contexts
+
+// A context keeps the coding tables from one message to the next. Only the
+// tables needed by the method are allocated, sized for the precision, and
+// they are neither re-allocated nor cleared between messages. Along with
+// caller-provided output buffers, this removes all allocations from the
+// coding of many small messages. A context must not be shared by threads.
+
+typedef struct FSCEncoder FSCEncoderCtx;
+// Returns NULL upon error.
+FSCEncoderCtx* FSCEncoderCtxNew(int log_tab_size, FSCCodingMethod method);
+// Changes the parameters used by the next messages. Returns 0 upon error.
+int FSCEncoderCtxReset(FSCEncoderCtx* ctx,
+                       int log_tab_size, FSCCodingMethod method);
+void FSCEncoderCtxDelete(FSCEncoderCtx* ctx);
+// Same as FSCEncode() and FSCEncodeToBuffer(), with the context's parameters.
+int FSCEncodeWithCtx(FSCEncoderCtx* ctx, const uint8_t* in, size_t in_size,
+                     uint8_t** out, size_t* out_size);
+int FSCEncodeToBufferWithCtx(FSCEncoderCtx* ctx,
+                             const uint8_t* in, size_t in_size,
+                             uint8_t* out, size_t out_capacity,
+                             size_t* out_size);
+
+// A decoding context is an FSCDecoder that can be reset to a new message,
+// the non-canned API functions can be used on it.
+typedef struct FSCDecoder FSCDecoderCtx;
+FSCDecoderCtx* FSCDecoderCtxNew(void);   // Returns NULL upon error.
+// Reads the header of the message in 'input' and builds its tables.
+// Returns 0 upon error.
+int FSCDecoderCtxReset(FSCDecoderCtx* ctx, const uint8_t* input, size_t len);
+void FSCDecoderCtxDelete(FSCDecoderCtx* ctx);
+// Same as FSCDecode(). If *out is not NULL, the result is stored there
+// instead if its *out_size bytes are enough, and *out_size is updated.
+// Filtered streams are decoded too, but without reusing the context.
+int FSCDecodeWithCtx(FSCDecoderCtx* ctx, const uint8_t* in, size_t in_size,
+                     uint8_t** out, size_t* out_size);
+
+//------------------------------------------------------------------------------
+// Workspace and allocator
+
+// Number of bytes needed to encode with 'method' and 'log_tab_size', or to
+// decode what was encoded with them, without any allocation. Returns 0 for
+// invalid parameters. FSCWorkspaceSize() is the max of the two others.
+size_t FSCWorkspaceSize(FSCCodingMethod method, int log_tab_size);
+size_t FSCEncoderWorkspaceSize(FSCCodingMethod method, int log_tab_size);
+size_t FSCDecoderWorkspaceSize(FSCCodingMethod method, int log_tab_size);
+
+// Same as FSCEncodeToBuffer(), using the caller's workspace of at least
+// FSCEncoderWorkspaceSize(method, log_tab_size) bytes. Nothing is allocated.
+int FSCEncodeWithWorkspace(const uint8_t* in, size_t in_size,
+                           uint8_t* out, size_t out_capacity,
+                           size_t* out_size,
+                           int log_tab_size, FSCCodingMethod method,
+                           void* workspace, size_t workspace_size);
+// Decodes into 'out' (out_capacity bytes), using the caller's workspace.
+// Fails if the workspace is too small for the message's method and
+// precision. Nothing is allocated. Returns 0 upon error, and for the
+// filtered streams (see FSCEncodeFiltered()), which need a decoder per plane.
+int FSCDecodeWithWorkspace(const uint8_t* in, size_t in_size,
+                           uint8_t* out, size_t out_capacity,
+                           size_t* out_size,
+                           void* workspace, size_t workspace_size);
+
+// All the allocations of the library go through FSCMalloc() / FSCFree(),
+// which call malloc() / free() unless FSCSetAllocator() was given other
+// functions ('opaque' being passed to them). Passing NULL functions
+// restores the default. It is not thread-safe, and must be called before
+// anything is allocated. Results said to be deallocated using free() must
+// then be deallocated using FSCFree().
+typedef void* (*FSCAllocFunc)(void* opaque, size_t size);
+typedef void (*FSCFreeFunc)(void* opaque, void* ptr);
+void FSCSetAllocator(FSCAllocFunc alloc_func, FSCFreeFunc free_func,
+                     void* opaque);
+void* FSCMalloc(size_t size);
+void FSCFree(void* ptr);
+
+//------------------------------------------------------------------------------
+// Batch of records
+
+// Codes the 'nb_records' records together: one header and one set of tables
+// (for the histogram of all the records), followed by an index of the
+// records' offsets and sizes, and by each record coded on its own. Any record
+// can then be decoded without touching the other ones. Records may be empty.
+// Returns 0 upon error. Result is in *out, must deallocated using free().
+int FSCEncodeBatch(const uint8_t* const records[], const size_t sizes[],
+                   size_t nb_records, uint8_t** out, size_t* out_size,
+                   int log_tab_size, FSCCodingMethod method);
+
+// Decodes all the records, concatenated in *out (*out_size bytes). *sizes
+// receives the nb_records sizes. *out and *sizes must be deallocated using
+// free(). Returns 0 upon error.
+int FSCDecodeBatch(const uint8_t* in, size_t in_size,
+                   uint8_t** out, size_t* out_size,
+                   size_t** sizes, size_t* nb_records);
+
+// Random access: FSCBatchInit() reads the header and builds the tables once,
+// then records are decoded by index. 'in' must stay valid. Returns NULL upon
+// error.
+typedef struct FSCBatch FSCBatch;
+FSCBatch* FSCBatchInit(const uint8_t* in, size_t in_size);
+size_t FSCBatchNumRecords(const FSCBatch* batch);
+size_t FSCBatchRecordSize(const FSCBatch* batch, size_t index);
+// Same output convention as FSCDecodeWithCtx(). Returns 0 upon error.
+int FSCBatchDecodeRecord(FSCBatch* batch, size_t index,
+                         uint8_t** out, size_t* out_size);
+void FSCBatchDelete(FSCBatch* batch);
+
+//------------------------------------------------------------------------------
+// Clustered tables
+
+// Cuts the input into blocks of BLOCK_SIZE symbols and clusters their
+// histograms into at most max_tables (in [1, FSC_MAX_TABLES]) tables, each
+// stored once. Each block is coded with the table of its cluster, referenced
+// by a small ID. Most of the gain of per-block tables, for a few headers.
+// Return 0 upon error. Result is in *out, must deallocated using free().
+#define FSC_MAX_TABLES 16
+int FSCEncodeClustered(const uint8_t* in, size_t in_size,
+                       uint8_t** out, size_t* out_size,
+                       int log_tab_size, FSCCodingMethod method,
+                       int max_tables);
+int FSCDecodeClustered(const uint8_t* in, size_t in_size,
+                       uint8_t** out, size_t* out_size);
+
+//------------------------------------------------------------------------------
+// Order-1 and positional contexts
+
+// Codes each symbol with a table selected by the previous byte. Blocks are
+// coded as 4 independent lanes, whose first symbols use the byte preceding
+// the block (0 for the first block) instead. Contexts too rare to pay for a
+// table of their own share one, and at most max_tables (in
+// [1, FSC_O1_MAX_TABLES]) are used, which bounds the memory. log_tab_size is
+// clamped to [MIN_LOG_TAB_SIZE_W, FSC_O1_MAX_LOG_TAB_SIZE]: the reduced
+// precision keeps the tables in cache.
+// Return 0 upon error. Result is in *out, must deallocated using free().
+#define FSC_O1_MAX_TABLES 256
+#define FSC_O1_MAX_LOG_TAB_SIZE 12
+int FSCEncodeO1(const uint8_t* in, size_t in_size,
+                uint8_t** out, size_t* out_size,
+                int log_tab_size, int max_tables);
+int FSCDecodeO1(const uint8_t* in, size_t in_size,
+                uint8_t** out, size_t* out_size);
+
+// Codes byte k with table k % stride (up to FSC_MAX_STRIDE), for arrays of
+// fixed-size records whose bytes each have their own statistics. Same
+// precision as above.
+#define FSC_MAX_STRIDE 256
+int FSCEncodeStride(const uint8_t* in, size_t in_size,
+                    uint8_t** out, size_t* out_size,
+                    int log_tab_size, int stride);
+int FSCDecodeStride(const uint8_t* in, size_t in_size,
+                    uint8_t** out, size_t* out_size);
+
+//------------------------------------------------------------------------------
+// Segmentation
+
+// Finds where the statistics of the input change, and cuts it into segments
+// worth coding with tables of their own. FSC_SPLIT_FULL considers the whole
+// input at once, FSC_SPLIT_BOUNDED only a window of a fixed size, which
+// bounds the time and memory per input byte (for streaming).
+typedef enum {
+  FSC_SPLIT_FULL = 0,
+  FSC_SPLIT_BOUNDED
+} FSCSplitMode;
+
+// Stores the end of each segment in *ends (to be deallocated using free()).
+// Returns 0 upon error.
+int FSCSplit(const uint8_t* in, size_t in_size,
+             int log_tab_size, FSCCodingMethod method, FSCSplitMode mode,
+             size_t** ends, size_t* nb_segments);
+
+// Codes each segment found by FSCSplit() as a message of its own.
+// Return 0 upon error. Result is in *out, must deallocated using free().
+int FSCEncodeSplit(const uint8_t* in, size_t in_size,
+                   uint8_t** out, size_t* out_size,
+                   int log_tab_size, FSCCodingMethod method,
+                   FSCSplitMode mode);
+int FSCDecodeSplit(const uint8_t* in, size_t in_size,
+                   uint8_t** out, size_t* out_size);
+
+//------------------------------------------------------------------------------
+// Filters
+
+// Reversible transforms applied before coding. FSC_FILTER_SHUFFLE transposes
+// the elements of 'width' bytes (up to FSC_MAX_FILTER_WIDTH) into 'width'
+// byte planes, each coded with its own tables: for arrays of integers or
+// floats, the near-constant high bytes are then no longer mixed with the
+// noisy low ones. FSC_FILTER_DELTA and FSC_FILTER_XOR first replace each
+// element, read as a little-endian integer, by its difference (modulo
+// 2^(8*width)) or its XOR with the previous one, then transpose the result as
+// FSC_FILTER_SHUFFLE does: delta suits counters and sensor integers, XOR
+// suits floats. The trailing in_size % width bytes are stored raw.
+typedef enum {
+  FSC_FILTER_NONE = 0,
+  FSC_FILTER_SHUFFLE,
+  FSC_FILTER_DELTA,
+  FSC_FILTER_XOR,
+  FSC_FILTER_LAST
+} FSCFilter;
+#define FSC_MAX_FILTER_WIDTH 8
+
+// Return 0 upon error. Result is in *out, must deallocated using free().
+// FSCDecode(), FSCDecodePadded() and FSCDecodeWithCtx() also decode the
+// filtered streams. The non-canned API and FSCDecodeWithWorkspace() don't.
+int FSCEncodeFiltered(const uint8_t* in, size_t in_size,
+                      uint8_t** out, size_t* out_size,
+                      int log_tab_size, FSCCodingMethod method,
+                      FSCFilter filter, int width);
+int FSCDecodeFiltered(const uint8_t* in, size_t in_size,
+                      uint8_t** out, size_t* out_size);
+
+//------------------------------------------------------------------------------
+// Packed symbols
+
+// Codes 'nb_symbols' symbols of bits_per_symbol bits (1, 2, 4 or 8) packed
+// into bytes, first symbol in the lowest bits. Each byte is coded as one
+// symbol, so bitmaps and nibble streams don't need to be expanded first.
+// The unused bits of the last byte are ignored.
+int FSCEncodePacked(const uint8_t* in, size_t nb_symbols, int bits_per_symbol,
+                    uint8_t** out, size_t* out_size,
+                    int log_tab_size, FSCCodingMethod method);
+
+// Decodes the packed bytes into *out (*out_size bytes, unused bits being 0),
+// or one symbol per byte if 'unpack' is true (*out_size being the number of
+// symbols then). nb_symbols and bits_per_symbol can be NULL.
+// Return 0 upon error. Result is in *out, must deallocated using free().
+int FSCDecodePacked(const uint8_t* in, size_t in_size, int unpack,
+                    uint8_t** out, size_t* out_size,
+                    size_t* nb_symbols, int* bits_per_symbol);
+
+//------------------------------------------------------------------------------
+// Wide alphabets
+
+// Same as FSCEncode() / FSCDecode(), but for 16-bit symbols with values below
+// FSC16_MAX_SYMBOLS. Symbols are coded with the 4x interleaved word coder.
+// log_tab_size is clamped to [MIN_LOG_TAB_SIZE_W, MAX_LOG_TAB_SIZE], and
+// raised if needed to give each used symbol at least one slot.
+// For FSCDecode16(), *out_size is a number of symbols.
+// Return 0 upon error. Result is in *out, must deallocated using free().
+#define FSC16_MAX_SYMBOLS 4096
+int FSCEncode16(const uint16_t* in, size_t in_size,
+                uint8_t** out, size_t* out_size, int log_tab_size);
+int FSCDecode16(const uint8_t* in, size_t in_size,
+                uint16_t** out, size_t* out_size);
+
+//------------------------------------------------------------------------------
+// Integer coding
+
+// Codes unsigned integers as a bucket (the bit-length of the value) coded
+// with FSCEncode() using log_tab_size and method, followed by the bits below
+// the leading one, written raw. Good for sizes, offsets, latencies...
+// For decoding, *out_size is a number of values. FSCDecodeU32() won't decode
+// the output of FSCEncodeU64(), and vice versa.
+// Return 0 upon error. Result is in *out, must deallocated using free().
+int FSCEncodeU32(const uint32_t* in, size_t in_size,
+                 uint8_t** out, size_t* out_size,
+                 int log_tab_size, FSCCodingMethod method);
+int FSCEncodeU64(const uint64_t* in, size_t in_size,
+                 uint8_t** out, size_t* out_size,
+                 int log_tab_size, FSCCodingMethod method);
+int FSCDecodeU32(const uint8_t* in, size_t in_size,
+                 uint32_t** out, size_t* out_size);
+int FSCDecodeU64(const uint8_t* in, size_t in_size,
+                 uint64_t** out, size_t* out_size);
+
+//------------------------------------------------------------------------------
+// Binary coding
+
+// Codes a sequence of bits (one per byte, any non-zero value being a '1')
+// with a binary rANS coder using 64-bit states and 32-bit I/O words.
+// 'p0' is the probability of a '0', in 1 / FSC_BIN_PROBA_MAX units and in
+// [1, FSC_BIN_PROBA_MAX - 1]. If adapt_shift is 0, it is used for all bits.
+// Otherwise it is only the initial value, updated after each bit as:
+//   p0 += (FSC_BIN_PROBA_MAX - p0) >> adapt_shift   for a '0'
+//   p0 -= p0 >> adapt_shift                         for a '1'
+// with adapt_shift in [1, FSC_BIN_MAX_SHIFT]. Both are stored in the output.
+// Return 0 upon error. Result is in *out, must deallocated using free().
+#define FSC_BIN_PROBA_BITS 16
+#define FSC_BIN_PROBA_MAX  (1u << FSC_BIN_PROBA_BITS)
+#define FSC_BIN_MAX_SHIFT  15
+int FSCBinaryEncode(const uint8_t* in, size_t in_size, int p0, int adapt_shift,
+                    uint8_t** out, size_t* out_size);
+int FSCBinaryDecode(const uint8_t* in, size_t in_size,
+                    uint8_t** out, size_t* out_size);
+
 // utils
 void FSCCountSymbols(const uint8_t* in, size_t in_size,
                      uint32_t counts[MAX_SYMBOLS]);
 int FSCNormalizeCounts(uint32_t counts[MAX_SYMBOLS], int max_symbol,
                        int log_tab_size);
+int FSCNormalizeCounts16(uint32_t counts[FSC16_MAX_SYMBOLS], int max_symbol,
+                         int log_tab_size);
 
 //
 //------------------------------------------------------------------------------
@@ -0,0 +1,379 @@
+//Copyright 2014 The FSC Authors. All Rights Reserved.
+//
+//Licensed under the Apache License, Version 2.0 (the "License");
+//you may not use this file except in compliance with the License.
+//You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+//    Unless required by applicable law or agreed to in writing, software
+//    distributed under the License is distributed on an "AS IS" BASIS,
+//    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//    See the License for the specific language governing permissions and
+//    limitations under the License.
+//------------------------------------------------------------------------------
+//
+// Coding of 16-bit symbols (wide alphabets)
+//
+// Same 4x interleaved word coder as CODING_METHOD_16B_4X, with tables sized
+// for up to FSC16_MAX_SYMBOLS symbols. The decoder keeps a full slot -> symbol
+// map of 16-bit entries.
+//
+// Author: Skal (pascal.massimino@gmail.com)
+
+#include "./fsc.h"
+#include <stdlib.h>
+#include <string.h>
+
+#include "./bits.h"
+
+#define PROBA_BITS MAX_LOG_TAB_SIZE
+typedef uint32_t ANSProba;
+typedef FSCStateW ANSStateW;
+#define RECIPROCAL_BITS 16
+#include "./divide.h"
+
+#define BINS_RAW_LIMIT 64      // below this alphabet size, bins are sent raw
+#define BINS_LOG_TAB_SIZE 10   // precision for the sub-coded bins
+#define BLOCK_SLACK16 16       // in words: 8 for the final states, + margin
+
+//------------------------------------------------------------------------------
+// Header
+//
+// After the size, log_tab_size and max_symbol, each count but the last is
+// sent as a bin b = log2(count + 1) followed by b bits of residue. Bins are
+// sub-coded with FSCEncode() for large alphabets.
+
+static int WriteHeader16(FSCBitWriter* const bw, size_t size, int log_tab_size,
+                         const uint32_t counts[], int max_symbol) {
+  const int nb_bins = max_symbol - 1;
+  uint8_t bins[FSC16_MAX_SYMBOLS];
+  int i;
+  if (!FSCBitWriterReserve(bw, MAX_HDR_SIZE)) return 0;
+  FSCWriteSize(bw, size);
+  FSCWriteBits(bw, MAX_LOG_TAB_SIZE - log_tab_size, 4);
+  FSCWriteBits(bw, max_symbol - 1, 12);
+  for (i = 0; i < nb_bins; ++i) bins[i] = FSCLog2Floor(counts[i] + 1);
+  if (nb_bins < BINS_RAW_LIMIT) {
+    for (i = 0; i < nb_bins; ++i) FSCWriteBits(bw, bins[i], 5);
+  } else {
+    uint8_t* tmp = NULL;
+    size_t tmp_size = 0;
+    int ok;
+    if (!FSCEncode(bins, nb_bins, &tmp, &tmp_size,
+                   BINS_LOG_TAB_SIZE, CODING_METHOD_16B_4X)) {
+      return 0;
+    }
+    FSCWriteSize(bw, tmp_size);
+    ok = FSCAppend(bw, tmp, tmp_size);
+    FSCFree(tmp);
+    if (!ok) return 0;
+  }
+  if (!FSCBitWriterReserve(bw, 2 * nb_bins + 8)) return 0;
+  for (i = 0; i < nb_bins; ++i) {
+    if (bins[i] > 0) {
+      FSCWriteBits(bw, counts[i] + 1 - (1u << bins[i]), bins[i]);
+    }
+  }
+  return !bw->error_;
+}
+
+static int ReadCounts16(FSCBitReader* const br, uint32_t counts[],
+                        int max_symbol, int log_tab_size) {
+  const int nb_bins = max_symbol - 1;
+  uint8_t bins[FSC16_MAX_SYMBOLS];
+  uint32_t total = 1u << log_tab_size;
+  int i;
+  if (nb_bins < BINS_RAW_LIMIT) {
+    for (i = 0; i < nb_bins; ++i) bins[i] = FSCReadBits(br, 5);
+  } else {
+    const size_t len = FSCReadSize(br);
+    const uint8_t* const buf = FSCBitAlign(br);
+    uint8_t* tmp = NULL;
+    size_t tmp_size = 0;
+    if (buf > FSCGetByteEnd(br) ||
+        len > (size_t)(FSCGetByteEnd(br) - buf)) {
+      return 0;
+    }
+    if (!FSCDecode(buf, len, &tmp, &tmp_size) || tmp_size != (size_t)nb_bins) {
+      FSCFree(tmp);
+      return 0;
+    }
+    memcpy(bins, tmp, nb_bins);
+    FSCFree(tmp);
+    FSCSetReadBufferPos(br, buf + len);
+  }
+  for (i = 0; i < nb_bins; ++i) {
+    const int b = bins[i];
+    if (b > MAX_LOG_TAB_SIZE) return 0;
+    counts[i] = ((1u << b) | ((b > 0) ? FSCReadBits(br, b) : 0)) - 1;
+    if (counts[i] > total) return 0;
+    total -= counts[i];
+  }
+  counts[max_symbol - 1] = total;   // remaining part
+  return !br->eof_;
+}
+
+//------------------------------------------------------------------------------
+// Encoding
+
+typedef struct {
+  inv_t inv_;          // to divide by freq_
+  uint16_t start_;
+  uint16_t freq_;
+} EncSymbol16;
+
+typedef struct {
+  int log_tab_size_;
+  EncSymbol16 symbols_[FSC16_MAX_SYMBOLS];   // 48k
+} Encoder16;
+
+// x' = (x / freq) << log_tab_size + (x % freq) + start
+//    = x + (x / freq) * (tab_size - freq) + start
+#define PUT_SYMBOL(state, symbol) do {                                     \
+  const EncSymbol16* const s = &enc->symbols_[(symbol)];                   \
+  if ((state) >= ((FSCStateW)s->freq_ << (32 - log_tab_size))) {          \
+    output[--pos] = (FSCType)((state) & FSC_BITS_MASK);                    \
+    (state) >>= FSC_BITS;                                                  \
+  }                                                                        \
+  (state) += FSCDivide((state), s->inv_) * (tab_size - s->freq_)          \
+           + s->start_;                                                    \
+} while (0)
+
+// Writes the words backward, ending at output[pos]. Returns the new start.
+static int DoPutBlock16(const Encoder16* const enc, const uint16_t* in,
+                        int size, FSCType output[], int pos) {
+  FSCStateW states[4] = { FSC_MAX, FSC_MAX, FSC_MAX, FSC_MAX };
+  const int log_tab_size = enc->log_tab_size_;
+  const uint32_t tab_size = 1u << log_tab_size;
+  int k = size, r;
+  while (k & 3) {
+    --k;
+    PUT_SYMBOL(states[k & 3], in[k]);
+  }
+  while (k > 0) {
+    k -= 4;
+    PUT_SYMBOL(states[3], in[k + 3]);
+    PUT_SYMBOL(states[2], in[k + 2]);
+    PUT_SYMBOL(states[1], in[k + 1]);
+    PUT_SYMBOL(states[0], in[k + 0]);
+  }
+  for (r = 3; r >= 0; --r) {
+    output[--pos] = (FSCType)(states[r] & FSC_BITS_MASK);
+    output[--pos] = (FSCType)(states[r] >> FSC_BITS);
+  }
+  return pos;
+}
+#undef PUT_SYMBOL
+
+static int PutBlock16(const Encoder16* const enc, const uint16_t* in, int size,
+                      FSCBitWriter* const bw) {
+  const int end = size + BLOCK_SLACK16;
+  FSCType* const output =
+      (FSCType*)FSCBitWriterGetBuffer(bw, end * sizeof(FSCType));
+  if (output == NULL) return 0;
+  const int pos = DoPutBlock16(enc, in, size, output, end);
+  const size_t len = (end - pos) * sizeof(FSCType);
+  if (pos > 0) memmove(output, &output[pos], len);
+  FSCBitWriterAdvance(bw, len);
+  return 1;
+}
+
+int FSCEncode16(const uint16_t* in, size_t in_size,
+                uint8_t** out, size_t* out_size, int log_tab_size) {
+  uint32_t counts[FSC16_MAX_SYMBOLS] = { 0 };
+  Encoder16* enc = NULL;
+  FSCBitWriter bw;
+  int max_symbol = 1, nb_symbols = 0, unique = 0;
+  size_t n;
+  int s;
+  if (out == NULL || out_size == NULL) return 0;
+  if (in == NULL && in_size > 0) return 0;
+  for (n = 0; n < in_size; ++n) {
+    if (in[n] >= FSC16_MAX_SYMBOLS) return 0;
+    ++counts[in[n]];
+  }
+  if (in_size == 0) counts[0] = 1;
+  for (s = 0; s < FSC16_MAX_SYMBOLS; ++s) {
+    if (counts[s] > 0) {
+      max_symbol = s + 1;
+      ++nb_symbols;
+    }
+  }
+  if (log_tab_size < MIN_LOG_TAB_SIZE_W) log_tab_size = MIN_LOG_TAB_SIZE_W;
+  if (log_tab_size > MAX_LOG_TAB_SIZE) log_tab_size = MAX_LOG_TAB_SIZE;
+  while ((1 << log_tab_size) < nb_symbols) ++log_tab_size;
+  max_symbol = FSCNormalizeCounts16(counts, max_symbol, log_tab_size);
+  if (max_symbol < 1) return 0;
+
+  enc = (Encoder16*)FSCMalloc(sizeof(*enc));
+  if (enc == NULL) return 0;
+  enc->log_tab_size_ = log_tab_size;
+  {
+    uint32_t start = 0;
+    for (s = 0; s < max_symbol; ++s) {
+      EncSymbol16* const sym = &enc->symbols_[s];
+      if (counts[s] == (1u << log_tab_size)) unique = 1;  // freq_ won't fit
+      sym->start_ = (uint16_t)start;
+      sym->freq_ = (uint16_t)counts[s];
+      FSCInitDivide(counts[s], &sym->inv_);
+      start += counts[s];
+    }
+  }
+  if (!FSCBitWriterInit(&bw, 2 * in_size + MAX_HDR_SIZE)) goto Error;
+  if (!WriteHeader16(&bw, in_size, log_tab_size, counts, max_symbol)) {
+    FSCBitWriterDestroy(&bw);
+    goto Error;
+  }
+  while (!unique && in_size > 0) {   // nothing to code for a unique symbol
+    const int next = (in_size > BLOCK_SIZE) ? BLOCK_SIZE : (int)in_size;
+    if (!PutBlock16(enc, in, next, &bw)) break;
+    in += next;
+    in_size -= next;
+  }
+  FSCBitWriterFlush(&bw);
+  if (bw.error_) {
+    FSCBitWriterDestroy(&bw);
+    goto Error;
+  }
+  FSCFree(enc);
+  *out = FSCBitWriterFinish(&bw);
+  *out_size = FSCBitWriterNumBytes(&bw);
+  return 1;
+
+ Error:
+  FSCFree(enc);
+  return 0;
+}
+
+//------------------------------------------------------------------------------
+// Decoding
+
+typedef struct {
+  uint16_t start_;
+  uint16_t freq_;
+} DecSymbol16;
+
+typedef struct {
+  int log_tab_size_;
+  DecSymbol16 symbols_[FSC16_MAX_SYMBOLS];   // 16k
+  uint16_t map_[MAX_TAB_SIZE];               // slot -> symbol, 128k
+} Decoder16;
+
+static void BuildTables16(Decoder16* const dec, const uint32_t counts[],
+                          int max_symbol) {
+  uint32_t start = 0;
+  int s;
+  for (s = 0; s < max_symbol; ++s) {
+    uint32_t i;
+    dec->symbols_[s].start_ = (uint16_t)start;
+    dec->symbols_[s].freq_ = (uint16_t)counts[s];
+    for (i = 0; i < counts[s]; ++i) dec->map_[start + i] = s;
+    start += counts[s];
+  }
+}
+
+static FSC_INLINE uint16_t NextSymbol16(const Decoder16* const dec,
+                                        int log_tab_size,
+                                        FSCStateW* const state) {
+  const uint32_t r = (*state) & ((1u << log_tab_size) - 1);
+  const uint16_t s = dec->map_[r];
+  const DecSymbol16* const sym = &dec->symbols_[s];
+  *state = sym->freq_ * ((*state) >> log_tab_size) + (r - sym->start_);
+  return s;
+}
+
+#define RENORMALIZE_STATE_FAST(state) do {                    \
+  if ((state) < FSC_MAX) (state) = ((state) << FSC_BITS) | (*buf++); \
+} while (0)
+
+static int GetBlock16(const Decoder16* const dec, uint16_t* out, int size,
+                      FSCBitReader* const br) {
+  const uint8_t* const start = FSCBitAlign(br);
+  const uint8_t* const end = FSCGetByteEnd(br);
+  const FSCType* buf = (const FSCType*)start;
+  // whole words only: a truncated input can end mid-word, or before 'start'
+  const FSCType* const buf_end =
+      buf + ((end > start) ? (end - start) / (int)sizeof(FSCType) : 0);
+  const int log_tab_size = dec->log_tab_size_;
+  FSCStateW states[4];
+  int n, r, fast_limit;
+  if (buf_end - buf < 8) return 0;
+  for (r = 0; r < 4; ++r) {
+    states[r] = ((FSCStateW)buf[0] << FSC_BITS) | buf[1];
+    buf += 2;
+  }
+  // each state reads at most one word per symbol
+  fast_limit = ((buf_end - buf < size) ? (int)(buf_end - buf) : size) & ~3;
+  for (n = 0; n < fast_limit; n += 4) {
+    out[n + 0] = NextSymbol16(dec, log_tab_size, &states[0]);
+    RENORMALIZE_STATE_FAST(states[0]);
+    out[n + 1] = NextSymbol16(dec, log_tab_size, &states[1]);
+    RENORMALIZE_STATE_FAST(states[1]);
+    out[n + 2] = NextSymbol16(dec, log_tab_size, &states[2]);
+    RENORMALIZE_STATE_FAST(states[2]);
+    out[n + 3] = NextSymbol16(dec, log_tab_size, &states[3]);
+    RENORMALIZE_STATE_FAST(states[3]);
+  }
+  for (; n < size; ++n) {
+    FSCStateW* const state = &states[n & 3];
+    out[n] = NextSymbol16(dec, log_tab_size, state);
+    if (*state < FSC_MAX) {
+      if (buf >= buf_end) return 0;
+      *state = (*state << FSC_BITS) | (*buf++);
+    }
+  }
+  FSCSetReadBufferPos(br, (const uint8_t*)buf);
+  // all states should be back to their initial value
+  return (states[0] == FSC_MAX) && (states[1] == FSC_MAX) &&
+         (states[2] == FSC_MAX) && (states[3] == FSC_MAX);
+}
+
+int FSCDecode16(const uint8_t* in, size_t in_size,
+                uint16_t** out, size_t* out_size) {
+  uint32_t counts[FSC16_MAX_SYMBOLS];
+  FSCBitReader br;
+  Decoder16* dec = NULL;
+  uint16_t* dst = NULL;
+  size_t size, n;
+  int log_tab_size, max_symbol, s, unique = -1;
+  if (in == NULL || out == NULL || out_size == NULL) return 0;
+
+  FSCInitBitReader(&br, in, in_size);
+  size = FSCReadSize(&br);
+  log_tab_size = MAX_LOG_TAB_SIZE - FSCReadBits(&br, 4);
+  if (log_tab_size < MIN_LOG_TAB_SIZE_W) return 0;
+  max_symbol = 1 + FSCReadBits(&br, 12);
+  if (!ReadCounts16(&br, counts, max_symbol, log_tab_size)) return 0;
+  if (FSCReadPastEnd(&br)) return 0;   // truncated header
+  if (size > ((size_t)-1) / sizeof(*dst) - 1) return 0;
+  for (s = 0; s < max_symbol; ++s) {
+    if (counts[s] == (1u << log_tab_size)) unique = s;
+  }
+
+  dst = (uint16_t*)FSCMalloc((size + 1) * sizeof(*dst));
+  if (dst == NULL) return 0;
+  if (unique >= 0) {
+    for (n = 0; n < size; ++n) dst[n] = unique;
+  } else {
+    dec = (Decoder16*)FSCMalloc(sizeof(*dec));
+    if (dec == NULL) goto Error;
+    dec->log_tab_size_ = log_tab_size;
+    BuildTables16(dec, counts, max_symbol);
+    for (n = 0; n < size; n += BLOCK_SIZE) {
+      const int next = (size - n > BLOCK_SIZE) ? BLOCK_SIZE : (int)(size - n);
+      if (!GetBlock16(dec, dst + n, next, &br)) goto Error;
+    }
+    FSCFree(dec);
+  }
+  *out = dst;
+  *out_size = size;
+  return 1;
+
+ Error:
+  FSCFree(dec);
+  FSCFree(dst);
+  return 0;
+}
+
+//------------------------------------------------------------------------------
@@ -0,0 +1,223 @@
+//Copyright 2014 The FSC Authors. All Rights Reserved.
+//
+//Licensed under the Apache License, Version 2.0 (the "License");
+//you may not use this file except in compliance with the License.
+//You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+//    Unless required by applicable law or agreed to in writing, software
+//    distributed under the License is distributed on an "AS IS" BASIS,
+//    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//    See the License for the specific language governing permissions and
+//    limitations under the License.
+//------------------------------------------------------------------------------
+//
+// Binary rANS coder, with static or adaptive probabilities
+//
+// The state x is kept in [L, L << 32) with L = 2^32, and renormalized by
+// 32-bit words. Probabilities use FSC_BIN_PROBA_BITS bits.
+//
+// Author: Skal (pascal.massimino@gmail.com)
+
+#include "./fsc.h"
+#include <stdlib.h>
+#include <string.h>
+
+#include "./bits.h"
+
+#define PROBA_BITS FSC_BIN_PROBA_BITS
+typedef uint32_t ANSProba;
+typedef uint64_t ANSStateW;
+typedef uint32_t ANSBaseW;      // I/O words
+
+#define BITS 32
+#define BITS_LIMIT ((ANSStateW)1 << BITS)     // that's L
+#define PROBA_MASK (FSC_BIN_PROBA_MAX - 1)
+
+#if defined(__SIZEOF_INT128__)
+#define RECIPROCAL_BITS 32
+#else
+#define RECIPROCAL_BITS 0
+#endif
+#include "./divide.h"
+
+// max bytes needed for the header: size, p0 and adapt_shift
+#define BIN_HDR_SIZE 32
+
+//------------------------------------------------------------------------------
+// Encoding
+
+static ANSBaseW* PutBitsStatic(const uint8_t* in, size_t size,
+                               ANSProba p0, ANSBaseW* buf) {
+  const ANSProba freq[2]  = { p0, FSC_BIN_PROBA_MAX - p0 };
+  const ANSStateW start[2] = { 0, p0 };
+  const ANSStateW limit[2] = {
+    (ANSStateW)freq[0] << (2 * BITS - PROBA_BITS),
+    (ANSStateW)freq[1] << (2 * BITS - PROBA_BITS)
+  };
+  inv_t inv[2];
+  ANSStateW x = BITS_LIMIT;
+  size_t i;
+  FSCInitDivide(freq[0], &inv[0]);
+  FSCInitDivide(freq[1], &inv[1]);
+  for (i = size; i-- > 0;) {
+    const int bit = (in[i] != 0);
+    if (x >= limit[bit]) {
+      *--buf = (ANSBaseW)x;
+      x >>= BITS;
+    }
+    // x' = (x / f) << PROBA_BITS + (x % f) + start = x + (x / f) * (M - f) + start
+    x += FSCDivide(x, inv[bit]) * freq[bit ^ 1] + start[bit];
+  }
+  *--buf = (ANSBaseW)x;
+  *--buf = (ANSBaseW)(x >> BITS);
+  return buf;
+}
+
+static ANSProba UpdateProba(ANSProba p0, int bit, int shift) {
+  return bit ? p0 - (p0 >> shift) : p0 + ((FSC_BIN_PROBA_MAX - p0) >> shift);
+}
+
+// The probabilities evolve forward, so they are recorded first and then
+// used in reverse order by the encoding.
+static ANSBaseW* PutBitsAdaptive(const uint8_t* in, size_t size,
+                                 ANSProba p0, int shift, ANSBaseW* buf) {
+  uint16_t* const probas = (uint16_t*)FSCMalloc(size * sizeof(*probas) + 1);
+  ANSStateW x = BITS_LIMIT;
+  size_t i;
+  if (probas == NULL) return NULL;
+  for (i = 0; i < size; ++i) {
+    probas[i] = p0;
+    p0 = UpdateProba(p0, in[i] != 0, shift);
+  }
+  for (i = size; i-- > 0;) {
+    const ANSProba p = probas[i];
+    const int bit = (in[i] != 0);
+    const ANSProba freq = bit ? FSC_BIN_PROBA_MAX - p : p;
+    if (x >= ((ANSStateW)freq << (2 * BITS - PROBA_BITS))) {
+      *--buf = (ANSBaseW)x;
+      x >>= BITS;
+    }
+    x += (x / freq) * (FSC_BIN_PROBA_MAX - freq) + (bit ? p : 0);
+  }
+  FSCFree(probas);
+  *--buf = (ANSBaseW)x;
+  *--buf = (ANSBaseW)(x >> BITS);
+  return buf;
+}
+
+int FSCBinaryEncode(const uint8_t* in, size_t in_size, int p0, int adapt_shift,
+                    uint8_t** out, size_t* out_size) {
+  FSCBitWriter bw;
+  uint8_t* buf;
+  ANSBaseW* words_end;
+  ANSBaseW* words;
+  size_t nb_words;
+  if (out == NULL || out_size == NULL) return 0;
+  if (p0 <= 0 || p0 >= (int)FSC_BIN_PROBA_MAX) return 0;
+  if (adapt_shift < 0 || adapt_shift > FSC_BIN_MAX_SHIFT) return 0;
+
+  // at most one word per bit, plus the final state
+  const size_t max_words = in_size + 2;
+  buf = (uint8_t*)FSCMalloc(BIN_HDR_SIZE + max_words * sizeof(*words));
+  if (buf == NULL) return 0;
+
+  FSCBitWriterInitBuffer(&bw, buf, BIN_HDR_SIZE);
+  FSCWriteSize(&bw, in_size);
+  FSCWriteBits(&bw, p0, PROBA_BITS);
+  FSCWriteBits(&bw, adapt_shift, 4);
+  FSCBitWriterFlush(&bw);
+  if (bw.error_) goto Error;
+
+  words_end = (ANSBaseW*)(buf + BIN_HDR_SIZE) + max_words;
+  words = (adapt_shift == 0) ? PutBitsStatic(in, in_size, p0, words_end)
+        : PutBitsAdaptive(in, in_size, p0, adapt_shift, words_end);
+  if (words == NULL) goto Error;
+  nb_words = words_end - words;
+  memmove(bw.cur_, words, nb_words * sizeof(*words));
+  *out = buf;
+  *out_size = FSCBitWriterNumBytes(&bw) + nb_words * sizeof(*words);
+  return 1;
+
+ Error:
+  FSCFree(buf);
+  return 0;
+}
+
+//------------------------------------------------------------------------------
+// Decoding
+
+#define RENORMALIZE_STATE(x) do {                  \
+  if ((x) < BITS_LIMIT) {                          \
+    ANSBaseW w;                                    \
+    if (buf + sizeof(w) > buf_end) goto Error;     \
+    memcpy(&w, buf, sizeof(w));                    \
+    buf += sizeof(w);                              \
+    (x) = ((x) << BITS) | w;                       \
+  }                                                \
+} while (0)
+
+int FSCBinaryDecode(const uint8_t* in, size_t in_size,
+                    uint8_t** out, size_t* out_size) {
+  FSCBitReader br;
+  const uint8_t* buf;
+  const uint8_t* buf_end;
+  uint8_t* dst = NULL;
+  size_t size, n;
+  ANSProba p0;
+  ANSStateW x;
+  int shift;
+  ANSBaseW w[2];
+  if (in == NULL || out == NULL || out_size == NULL) return 0;
+
+  FSCInitBitReader(&br, in, in_size);
+  size = FSCReadSize(&br);
+  p0 = FSCReadBits(&br, PROBA_BITS);
+  shift = FSCReadBits(&br, 4);
+  if (br.eof_ || p0 == 0 || shift > FSC_BIN_MAX_SHIFT) return 0;
+  buf = FSCBitAlign(&br);
+  buf_end = FSCGetByteEnd(&br);
+  if (buf > buf_end || (size_t)(buf_end - buf) < sizeof(w)) return 0;
+  if (size > ((size_t)-1) - 1) return 0;
+  memcpy(w, buf, sizeof(w));
+  buf += sizeof(w);
+  x = ((ANSStateW)w[0] << BITS) | w[1];
+
+  dst = (uint8_t*)FSCMalloc(size + 1);
+  if (dst == NULL) return 0;
+  if (shift == 0) {
+    const ANSStateW freq[2]  = { p0, FSC_BIN_PROBA_MAX - p0 };
+    const ANSStateW start[2] = { 0, p0 };
+    for (n = 0; n < size; ++n) {
+      const ANSProba xfrac = (ANSProba)x & PROBA_MASK;
+      const int bit = (xfrac >= p0);
+      x = freq[bit] * (x >> PROBA_BITS) + xfrac - start[bit];
+      dst[n] = bit;
+      RENORMALIZE_STATE(x);
+    }
+  } else {
+    for (n = 0; n < size; ++n) {
+      const ANSProba xfrac = (ANSProba)x & PROBA_MASK;
+      const int bit = (xfrac >= p0);
+      if (bit) {
+        x = (FSC_BIN_PROBA_MAX - p0) * (x >> PROBA_BITS) + xfrac - p0;
+      } else {
+        x = p0 * (x >> PROBA_BITS) + xfrac;
+      }
+      dst[n] = bit;
+      p0 = UpdateProba(p0, bit, shift);
+      RENORMALIZE_STATE(x);
+    }
+  }
+  if (x != BITS_LIMIT) goto Error;   // should be back to the initial state
+  *out = dst;
+  *out_size = size;
+  return 1;
+
+ Error:
+  FSCFree(dst);
+  return 0;
+}
+
+//------------------------------------------------------------------------------
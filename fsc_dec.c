@@ -21,11 +21,16 @@
 
 #include "./fsc.h"
 #include <stdio.h>
+#include <stddef.h>
 #include <assert.h>
 
 #include "./bits.h"
 #include "./alias.h"
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 //------------------------------------------------------------------------------
 // Decoding
 
@@ -65,6 +70,21 @@ typedef struct {
   uint32_t freq_;
 } Symbol;
 
+// For short streams over at most TINY_MAX_SYMBOLS symbols, the 4x decoder
+// finds the symbols of its four states at once by comparing the slots
+// against every symbol's start, instead of looking them up in map_[].
+// Each compare also selects the start and frequency deltas to accumulate,
+// so no memory look-up depends on the slot.
+#define TINY_MAX_SYMBOLS 16
+typedef struct {
+  int nb_symbols_;     // up to the last symbol with non-zero frequency
+#if defined(__SSE2__)
+  __m128i limits_[TINY_MAX_SYMBOLS];     // start - 1, broadcast
+  __m128i dstarts_[TINY_MAX_SYMBOLS];    // start delta with previous symbol
+  __m128i dfreqs_[TINY_MAX_SYMBOLS];     // frequency delta
+#endif
+} TinyTable;
+
 struct FSCDecoder {
   FSCCodingMethod method_;
   DecMethods methods_;
@@ -76,13 +96,103 @@ struct FSCDecoder {
   int unique_symbol_;
   uint32_t out_size_;
 
-  FSCState tab_[TAB_SIZE];   // ~16k for LOG_TAB_SIZE=12
-
   Symbol symbols_[MAX_SYMBOLS];
-  uint8_t map_[MAX_TAB_SIZE];
-  AliasTable alias_;
+  int alias_log2_size_;      // log2 of number of alias buckets, from header
+
+  int dense_;                // true if the symbols are coded as dense indices
+  int remap_output_;         // true if get_block() outputs dense indices
+  uint8_t remap_[MAX_SYMBOLS];   // dense index -> symbol
+
+  // Tables used by the message's method only, pointing into mem_.
+  FSCState* tab_;            // 1 << log_tab_size states
+  uint8_t* spread_;          // 1 << log_tab_size, to build tab_
+  TinyTable* tiny_;          // replaces map_[] for short tiny-alphabet streams
+  uint8_t* map_;             // 1 << log_tab_size slots
+  AliasTable* alias_;
+  AliasEntry* alias_entries_;   // for 4x alias decoding
+  uint8_t* mem_;
+  size_t mem_size_;
+  int own_mem_;              // false for a caller's workspace
 };
 
+//------------------------------------------------------------------------------
+// Tables memory
+//
+// The tables are carved from a single buffer, kept by the decoder and only
+// re-allocated when a message needs more room (never for a caller's
+// workspace). They are fully rebuilt for each message, so the buffer is
+// never cleared.
+
+#define ALIGN_SIZE(size) (((size) + 15) & ~(size_t)15)
+
+// Returns the position of a table of 'size' bytes in 'mem' (NULL if 'mem'
+// is NULL), and moves *pos past it, keeping 16b alignment for TinyTable.
+static void* TablePtr(uint8_t* const mem, size_t* const pos, size_t size) {
+  void* const ptr = (mem != NULL) ? mem + *pos : NULL;
+  *pos += ALIGN_SIZE(size);
+  return ptr;
+}
+
+// Points the tables needed by dec->method_ into 'mem' and returns their
+// total size.
+static size_t SetTables(FSCDecoder* const dec, uint8_t* const mem) {
+  const size_t tab_size = (size_t)1 << dec->log_tab_size_;
+  size_t pos = 0;
+  dec->tab_ = NULL;
+  dec->spread_ = NULL;
+  dec->tiny_ = NULL;
+  dec->map_ = NULL;
+  dec->alias_ = NULL;
+  dec->alias_entries_ = NULL;
+  switch (dec->method_) {
+    case CODING_METHOD_BUCKET:
+    case CODING_METHOD_REVERSE:
+    case CODING_METHOD_MODULO:
+    case CODING_METHOD_PACK:
+      dec->tab_ = (FSCState*)TablePtr(mem, &pos, tab_size * sizeof(FSCState));
+      dec->spread_ = (uint8_t*)TablePtr(mem, &pos, tab_size);
+      break;
+    case CODING_METHOD_16B_4X:
+      dec->tiny_ = (TinyTable*)TablePtr(mem, &pos, sizeof(TinyTable));
+      // fall through
+    case CODING_METHOD_16B:
+    case CODING_METHOD_16B_2X:
+      dec->map_ = (uint8_t*)TablePtr(mem, &pos, tab_size);
+      break;
+    case CODING_METHOD_16B_ALIAS_4X:
+      dec->alias_entries_ = (AliasEntry*)TablePtr(
+          mem, &pos, ALIAS_MAX_SYMBOLS * sizeof(AliasEntry));
+      // fall through
+    case CODING_METHOD_16B_ALIAS:
+    case CODING_METHOD_16B_ALIAS_2X:
+      dec->alias_ = (AliasTable*)TablePtr(mem, &pos, sizeof(AliasTable));
+      break;
+    default:   // CODING_METHOD_UNIQUE
+      break;
+  }
+  return pos;
+}
+
+// 'mem' is NULL for allocated tables.
+static void InitMem(FSCDecoder* const dec, uint8_t* mem, size_t mem_size) {
+  dec->mem_ = mem;
+  dec->mem_size_ = (mem != NULL) ? mem_size : 0;
+  dec->own_mem_ = (mem == NULL);
+}
+
+static int AllocTables(FSCDecoder* const dec) {
+  const size_t size = SetTables(dec, NULL);
+  if (size > dec->mem_size_) {
+    if (!dec->own_mem_) return 0;
+    FSCFree(dec->mem_);
+    dec->mem_ = (uint8_t*)FSCMalloc(size);
+    dec->mem_size_ = (dec->mem_ != NULL) ? size : 0;
+    if (dec->mem_ == NULL) return 0;
+  }
+  SetTables(dec, dec->mem_);
+  return 1;
+}
+
 //------------------------------------------------------------------------------
 // State table building
 
@@ -102,6 +212,8 @@ static int SymbolsInit(FSCDecoder* dec,
 
 //------------------------------------------------------------------------------
 
+// With dense indices, map_[] holds the symbols themselves and symbols_[] is
+// moved to match, so that NextSymbol() outputs them directly.
 static int BuildSymbolMap(FSCDecoder* dec,
                           const uint32_t counts[], int max_symbol) {
   if (!SymbolsInit(dec, counts, max_symbol)) return 0;
@@ -109,8 +221,15 @@ static int BuildSymbolMap(FSCDecoder* dec,
   int s;
   for (s = 0; s < max_symbol; ++s) {
     const uint32_t freq = counts[s];
+    const uint8_t symbol = dec->dense_ ? dec->remap_[s] : s;
     int i;
-    for (i = 0; i < freq; ++i) dec->map_[start++] = s;
+    for (i = 0; i < freq; ++i) dec->map_[start++] = symbol;
+  }
+  if (dec->dense_) {
+    // remap_[s] >= s, so going backward doesn't overwrite unmoved entries
+    for (s = max_symbol - 1; s >= 0; --s) {
+      dec->symbols_[dec->remap_[s]] = dec->symbols_[s];
+    }
   }
   return 1;
 }
@@ -119,32 +238,198 @@ static int BuildStateTableW(FSCDecoder* dec, const uint32_t counts[]) {
   return BuildSymbolMap(dec, counts, dec->max_symbol_);
 }
 
-static uint8_t NextSymbol(const FSCDecoder* const dec, FSCStateW* const state) {
+static int GetBlockTinyW4(FSCDecoder* dec, uint8_t* out, int size,
+                          FSCBitReader* br);
+
+// The tiny decoding costs about nb_symbols operations per decoded symbol,
+// but doesn't need the (1 << log_tab_size)-entry map. It's only selected
+// when filling the map would be the dominating cost.
+static int BuildStateTableW4(FSCDecoder* dec, const uint32_t counts[]) {
+  TinyTable* const tiny = dec->tiny_;
+  int s, nb_symbols = 0;
+  if (dec->max_symbol_ > TINY_MAX_SYMBOLS) {
+    return BuildStateTableW(dec, counts);
+  }
+  for (s = 0; s < dec->max_symbol_; ++s) {
+    // trailing zero-frequency symbols would start past the last slot
+    if (counts[s] > 0) nb_symbols = s + 1;
+  }
+  if ((uint64_t)dec->out_size_ * nb_symbols >= (2u << dec->log_tab_size_)) {
+    return BuildStateTableW(dec, counts);
+  }
+  if (!SymbolsInit(dec, counts, dec->max_symbol_)) return 0;
+  tiny->nb_symbols_ = nb_symbols;
+  dec->remap_output_ = dec->dense_;
+#if defined(__SSE2__)
+  for (s = 1; s < nb_symbols; ++s) {
+    const Symbol* const cur = &dec->symbols_[s];
+    const Symbol* const prev = &dec->symbols_[s - 1];
+    tiny->limits_[s] = _mm_set1_epi32((int)cur->start_ - 1);
+    tiny->dstarts_[s] = _mm_set1_epi32((int)(cur->start_ - prev->start_));
+    tiny->dfreqs_[s] = _mm_set1_epi32((int)(cur->freq_ - prev->freq_));
+  }
+#endif
+  dec->methods_.get_block = GetBlockTinyW4;
+  return 1;
+}
+
+// Scalar version, used for the last symbols of a block.
+static uint8_t NextSymbolTiny(const FSCDecoder* const dec, int log_tab_size,
+                              FSCStateW* const state) {
+  const uint32_t r = (*state) & ((1u << log_tab_size) - 1);
+  int s = 0;
+  while (s + 1 < dec->tiny_->nb_symbols_ && dec->symbols_[s + 1].start_ <= r) {
+    ++s;
+  }
+  const uint32_t rank = r - dec->symbols_[s].start_;
+  *state = dec->symbols_[s].freq_ * ((*state) >> log_tab_size) + rank;
+  return s;
+}
+
+#if defined(__SSE2__)
+static void NextSymbolsTiny4(const FSCDecoder* const dec, int log_tab_size,
+                             FSCStateW states[4], uint8_t out[4]) {
+  const TinyTable* const tiny = dec->tiny_;
+  const __m128i mask = _mm_set1_epi32((1 << log_tab_size) - 1);
+  const __m128i st = _mm_loadu_si128((const __m128i*)states);
+  const __m128i r = _mm_and_si128(st, mask);
+  const __m128i hi = _mm_srl_epi32(st, _mm_cvtsi32_si128(log_tab_size));
+  __m128i sym = _mm_setzero_si128();
+  __m128i start = _mm_setzero_si128();
+  __m128i freq = _mm_set1_epi32((int)dec->symbols_[0].freq_);
+  int s;
+  for (s = 1; s < tiny->nb_symbols_; ++s) {
+    const __m128i m = _mm_cmpgt_epi32(r, tiny->limits_[s]);  // start <= r
+    sym = _mm_sub_epi32(sym, m);
+    start = _mm_add_epi32(start, _mm_and_si128(m, tiny->dstarts_[s]));
+    freq = _mm_add_epi32(freq, _mm_and_si128(m, tiny->dfreqs_[s]));
+  }
+  {
+    const __m128i rank = _mm_sub_epi32(r, start);
+    // freq * hi, in 32 bits
+    const __m128i p02 = _mm_mul_epu32(freq, hi);
+    const __m128i p13 = _mm_mul_epu32(_mm_srli_epi64(freq, 32),
+                                      _mm_srli_epi64(hi, 32));
+    const __m128i prod =
+        _mm_unpacklo_epi32(_mm_shuffle_epi32(p02, _MM_SHUFFLE(0, 0, 2, 0)),
+                           _mm_shuffle_epi32(p13, _MM_SHUFFLE(0, 0, 2, 0)));
+    const __m128i sym16 = _mm_packs_epi32(sym, sym);
+    const uint32_t syms =
+        (uint32_t)_mm_cvtsi128_si32(_mm_packus_epi16(sym16, sym16));
+    _mm_storeu_si128((__m128i*)states, _mm_add_epi32(prod, rank));
+    memcpy(out, &syms, 4);
+  }
+}
+#else
+static void NextSymbolsTiny4(const FSCDecoder* const dec, int log_tab_size,
+                             FSCStateW states[4], uint8_t out[4]) {
+  out[0] = NextSymbolTiny(dec, log_tab_size, &states[0]);
+  out[1] = NextSymbolTiny(dec, log_tab_size, &states[1]);
+  out[2] = NextSymbolTiny(dec, log_tab_size, &states[2]);
+  out[3] = NextSymbolTiny(dec, log_tab_size, &states[3]);
+}
+#endif   // __SSE2__
+
+static uint8_t NextSymbol(const FSCDecoder* const dec, int log_tab_size,
+                          FSCStateW* const state) {
   uint32_t rank;
-  const uint32_t r = (*state) & (MAX_TAB_SIZE - 1);
+  const uint32_t r = (*state) & ((1u << log_tab_size) - 1);
   const uint8_t s = dec->map_[r];
   rank = r - dec->symbols_[s].start_;
   const int freq = dec->symbols_[s].freq_;
-  *state = freq * ((*state) >> MAX_LOG_TAB_SIZE) + rank;
+  *state = freq * ((*state) >> log_tab_size) + rank;
   return s;
 }
 
 //------------------------------------------------------------------------------
 
 static int BuildStateTableAliasW(FSCDecoder* dec, const uint32_t counts[]) {
+  dec->remap_output_ = dec->dense_;
   return SymbolsInit(dec, counts, dec->max_symbol_) &&
-         AliasInit(dec->alias_, counts, dec->max_symbol_);
+         AliasInit(dec->alias_, counts, dec->max_symbol_,
+                   dec->log_tab_size_, dec->alias_log2_size_);
 }
 
-static uint8_t NextSymbolAlias(const FSCDecoder* const dec, FSCStateW* const state) {
+static uint8_t NextSymbolAlias(const FSCDecoder* const dec, int log_tab_size,
+                               FSCStateW* const state) {
   uint32_t rank;
-  const uint32_t r = (*state) & (MAX_TAB_SIZE - 1);
+  const uint32_t r = (*state) & ((1u << log_tab_size) - 1);
   const uint8_t s = AliasSearchSymbol(dec->alias_, r, &rank);
   const int freq = dec->symbols_[s].freq_;
-  *state = freq * ((*state) >> MAX_LOG_TAB_SIZE) + rank;
+  *state = freq * ((*state) >> log_tab_size) + rank;
   return s;
 }
 
+static int BuildStateTableAliasW4(FSCDecoder* dec, const uint32_t counts[]) {
+  return BuildStateTableAliasW(dec, counts) &&
+         AliasBuildDecTable(dec->alias_, counts, dec->max_symbol_,
+                            dec->alias_entries_);
+}
+
+// Decodes four symbols at once from four independent states. Same result
+// as calling NextSymbolAlias() on each state, but without branches.
+#if defined(__SSE2__)
+static void NextSymbolsAlias4(const FSCDecoder* const dec, int log_tab_size,
+                              FSCStateW states[4], uint8_t out[4]) {
+  const AliasEntry* const entries = dec->alias_entries_;
+  const __m128i mask = _mm_set1_epi32((1 << log_tab_size) - 1);
+  const __m128i mask8 = _mm_set1_epi32(0xff);
+  const __m128i mask16 = _mm_set1_epi32(0xffff);
+  const __m128i st = _mm_loadu_si128((const __m128i*)states);
+  const __m128i r = _mm_and_si128(st, mask);
+  const __m128i hi = _mm_srl_epi32(st, _mm_cvtsi32_si128(log_tab_size));
+  const __m128i bucket =
+      _mm_srl_epi32(r, _mm_cvtsi32_si128(dec->alias_->shift_));
+  uint32_t b[4];
+  uint32_t syms;
+  _mm_storeu_si128((__m128i*)b, bucket);
+  {
+    // fetch the four entries, and transpose them
+    const __m128i e0 = _mm_loadu_si128((const __m128i*)&entries[b[0]]);
+    const __m128i e1 = _mm_loadu_si128((const __m128i*)&entries[b[1]]);
+    const __m128i e2 = _mm_loadu_si128((const __m128i*)&entries[b[2]]);
+    const __m128i e3 = _mm_loadu_si128((const __m128i*)&entries[b[3]]);
+    const __m128i t0 = _mm_unpacklo_epi32(e0, e1);
+    const __m128i t1 = _mm_unpacklo_epi32(e2, e3);
+    const __m128i t2 = _mm_unpackhi_epi32(e0, e1);
+    const __m128i t3 = _mm_unpackhi_epi32(e2, e3);
+    const __m128i cut = _mm_unpacklo_epi64(t0, t1);
+    const __m128i start = _mm_unpackhi_epi64(t0, t1);
+    const __m128i other_start = _mm_unpacklo_epi64(t2, t3);
+    const __m128i symbols = _mm_unpackhi_epi64(t2, t3);
+    // select the bucket's symbol if r < cut, the 'other' one otherwise
+    const __m128i own = _mm_cmplt_epi32(r, cut);
+    const __m128i sel = _mm_or_si128(_mm_and_si128(own, start),
+                                     _mm_andnot_si128(own, other_start));
+    const __m128i sym = _mm_and_si128(
+        _mm_or_si128(_mm_and_si128(own, symbols),
+                     _mm_andnot_si128(own, _mm_srli_epi32(symbols, 8))),
+        mask8);
+    const __m128i rank = _mm_sub_epi32(r, _mm_and_si128(sel, mask16));
+    const __m128i freq = _mm_srli_epi32(sel, 16);
+    // freq * hi, in 32 bits
+    const __m128i p02 = _mm_mul_epu32(freq, hi);
+    const __m128i p13 = _mm_mul_epu32(_mm_srli_epi64(freq, 32),
+                                      _mm_srli_epi64(hi, 32));
+    const __m128i prod =
+        _mm_unpacklo_epi32(_mm_shuffle_epi32(p02, _MM_SHUFFLE(0, 0, 2, 0)),
+                           _mm_shuffle_epi32(p13, _MM_SHUFFLE(0, 0, 2, 0)));
+    const __m128i sym16 = _mm_packs_epi32(sym, sym);
+    _mm_storeu_si128((__m128i*)states, _mm_add_epi32(prod, rank));
+    syms = (uint32_t)_mm_cvtsi128_si32(_mm_packus_epi16(sym16, sym16));
+  }
+  memcpy(out, &syms, 4);
+}
+#else
+static void NextSymbolsAlias4(const FSCDecoder* const dec, int log_tab_size,
+                              FSCStateW states[4], uint8_t out[4]) {
+  out[0] = NextSymbolAlias(dec, log_tab_size, &states[0]);
+  out[1] = NextSymbolAlias(dec, log_tab_size, &states[1]);
+  out[2] = NextSymbolAlias(dec, log_tab_size, &states[2]);
+  out[3] = NextSymbolAlias(dec, log_tab_size, &states[3]);
+}
+#endif   // __SSE2__
+
 //------------------------------------------------------------------------------
 
 static int Log2(uint32_t v) {
@@ -153,21 +438,18 @@ static int Log2(uint32_t v) {
   return s;
 }
 
-static int BuildStateTable(FSCDecoder* dec, const uint32_t counts[]) {
-  int s, i, pos;
+// 'symbols' is a scratch buffer of (1 << log_tab_size) entries. If not NULL,
+// remap[] gives the symbol to store for each (dense) index.
+static int BuildStates(const uint32_t counts[], int max_symbol,
+                       int log_tab_size, FSCBuildSpreadTableFunc spread,
+                       const uint8_t* remap, FSCState tab[],
+                       uint8_t symbols[]) {
+  int s, pos;
   uint16_t state[MAX_SYMBOLS];   // next state of symbol 's'
-  FSCState* const tab = dec->tab_;
-  const int log_tab_size = dec->log_tab_size_;
   const int tab_size = 1 << log_tab_size;
-  const int max_symbol = dec->max_symbol_;
 
   assert(max_symbol <= MAX_SYMBOLS && max_symbol > 0);
-  uint8_t* const symbols = (uint8_t*)malloc(tab_size * sizeof(*symbols));
-  if (symbols == NULL) return 0;
-  if (!dec->methods_.spread(max_symbol, counts, log_tab_size, symbols)) {
-    free(symbols);
-    return 0;
-  }
+  if (!spread(max_symbol, counts, log_tab_size, symbols)) return 0;
 
   uint8_t nb_bits[MAX_SYMBOLS];
   uint16_t wrap[MAX_SYMBOLS];
@@ -180,25 +462,29 @@ static int BuildStateTable(FSCDecoder* dec, const uint32_t counts[]) {
 
   for (pos = 0; pos < tab_size; ++pos) {
     s = symbols[pos];
-    tab[pos].symbol_ = s;
+    tab[pos].symbol_ = (remap != NULL) ? remap[s] : s;
     const int next_state = state[s]++;
     const int len = nb_bits[s] - (next_state >= wrap[s]);
     const int new_pos = (next_state << len) - tab_size;
     tab[pos].next_ = new_pos - pos;   // how to jump from Is to I
     tab[pos].len_  = len;
   }
-  free(symbols);
-  if (pos != tab_size) return 0;   // input not normalized!
+  return (pos == tab_size);   // input not normalized?
+}
 
-  return 1;
+static int BuildStateTable(FSCDecoder* dec, const uint32_t counts[]) {
+  return BuildStates(counts, dec->max_symbol_, dec->log_tab_size_,
+                     dec->methods_.spread, dec->dense_ ? dec->remap_ : NULL,
+                     dec->tab_, dec->spread_);
 }
 
 //------------------------------------------------------------------------------
 // Decoding loop
 
-static int GetBlock(FSCDecoder* dec, uint8_t* out, int size, FSCBitReader* br) {
-  const FSCState* state = dec->tab_;   // state_idx=0 at start
-  int next_nb_bits = dec->log_tab_size_;
+static int GetSymbols(const FSCState tab[], int log_tab_size,
+                      uint8_t* out, int size, FSCBitReader* br) {
+  const FSCState* state = tab;   // state_idx=0 at start
+  int next_nb_bits = log_tab_size;
   int n;
   for (n = 0; n < size; ++n) {
     FSCFillBitWindow(br);
@@ -211,6 +497,10 @@ static int GetBlock(FSCDecoder* dec, uint8_t* out, int size, FSCBitReader* br) {
   return !br->eof_;
 }
 
+static int GetBlock(FSCDecoder* dec, uint8_t* out, int size, FSCBitReader* br) {
+  return GetSymbols(dec->tab_, dec->log_tab_size_, out, size, br);
+}
+
 //------------------------------------------------------------------------------
 
 #define RENORMALIZE_STATE(state) do {                         \
@@ -223,26 +513,64 @@ static int GetBlock(FSCDecoder* dec, uint8_t* out, int size, FSCBitReader* br) {
   }                                                           \
 } while (0)
 
+// Unchecked version, for when the input is known to be long enough.
+#define RENORMALIZE_STATE_FAST(state) do {                    \
+  if ((state) < FSC_MAX) (state) = ((state) << FSC_BITS) | (*buf++); \
+} while (0)
+
+// End of the whole words from 'buf' on. A truncated input can end in the
+// middle of a word, or before 'buf'.
+static FSC_INLINE const FSCType* WordEnd(const FSCType* const buf,
+                                         FSCBitReader* const br) {
+  const uint8_t* const end = FSCGetByteEnd(br);
+  const uint8_t* const start = (const uint8_t*)buf;
+  return (end > start) ? buf + (end - start) / sizeof(*buf) : buf;
+}
+
+// Moves the bit-reader after the words read, keeping the end-of-input flag
+// raised by RENORMALIZE_STATE() when words were missing.
+static FSC_INLINE void SetWordPos(FSCBitReader* const br,
+                                  const FSCType* const buf) {
+  const int eof = br->eof_;
+  FSCSetReadBufferPos(br, (const uint8_t*)buf);
+  br->eof_ |= eof;
+}
+
+// Each state reads at most one word per decoded symbol, so the first
+// NumSafeSymbols() symbols can be decoded without checking for the end of
+// input. Only the rest go through the careful loop.
+static FSC_INLINE int NumSafeSymbols(const FSCType* const buf,
+                                     const FSCType* const buf_end, int size) {
+  const ptrdiff_t avail = buf_end - buf;
+  return (avail < size) ? (int)avail : size;
+}
+
 static int GetBlockW1(FSCDecoder* dec, uint8_t* out, int size,
                       FSCBitReader* br) {
   FSCBitReader lbr = *br;  // it's faster to make a local copy
   const FSCType* buf = (const FSCType*)FSCBitAlign(&lbr);
-  const FSCType* const buf_end = (const FSCType*)FSCGetByteEnd(&lbr);
-  const Symbol* const syms = dec->symbols_;
+  const FSCType* const buf_end = WordEnd(buf, &lbr);
+  const int log_tab_size = dec->log_tab_size_;
 
-  lbr.eof_ = (buf == buf_end);
+  lbr.eof_ = (buf >= buf_end);
   if (lbr.eof_) goto End;
   const FSCType* buf0 = buf;
   FSCStateW state = *buf++;
 
   int n;
-  for (n = 0; n < size - FSC_BITS / 8; ++n) {
+  const int size_limit = size - FSC_BITS / 8;
+  const int fast_limit = NumSafeSymbols(buf, buf_end, size_limit);
+  for (n = 0; n < fast_limit; ++n) {
+    RENORMALIZE_STATE_FAST(state);
+    out[n] = NextSymbol(dec, log_tab_size, &state);
+  }
+  for (; n < size_limit; ++n) {
     RENORMALIZE_STATE(state);
     if (lbr.eof_) break;
-    out[n] = NextSymbol(dec, &state);
+    out[n] = NextSymbol(dec, log_tab_size, &state);
   }
   RENORMALIZE_STATE(state);
-  FSCSetReadBufferPos(&lbr, (const uint8_t*)buf);
+  SetWordPos(&lbr, buf);
   // The trailing bytes are encoded in the final state's lower bytes.
   while (state != 1 && n < size) {
     out[n++] = state & 0xff;
@@ -257,30 +585,42 @@ static int GetBlockW2(FSCDecoder* dec, uint8_t* out, int size,
                       FSCBitReader* br) {
   FSCBitReader lbr = *br;  // it's faster to make a local copy
   const FSCType* buf = (const FSCType*)FSCBitAlign(&lbr);
-  const FSCType* const buf_end = (const FSCType*)FSCGetByteEnd(&lbr);
-  const Symbol* const syms = dec->symbols_;
-  lbr.eof_ = (buf == buf_end);
+  const FSCType* const buf_end = WordEnd(buf, &lbr);
+  const int log_tab_size = dec->log_tab_size_;
+  lbr.eof_ = (buf_end - buf < 2);   // both states are always flushed
   if (lbr.eof_) goto End;
   FSCStateW state1 = *buf++;
-  FSCStateW state0 = (size > 1) ? (*buf++) : 0;
+  FSCStateW state0 = *buf++;
 
   int n;
-  const int size_limit = (size - 2 * (FSC_BITS / 8)) & ~1;
-  for (n = 0; n < size_limit; n += 2) {
+  // The first 2 * (FSC_BITS / 8) bytes are stored in the initial states.
+  const int nb_coded = (size > 2 * (FSC_BITS / 8)) ? size - 2 * (FSC_BITS / 8)
+                                                   : 0;
+  const int size_limit = nb_coded & ~1;
+  const int fast_limit = NumSafeSymbols(buf, buf_end, size_limit) & ~1;
+  for (n = 0; n < fast_limit; n += 2) {
+    RENORMALIZE_STATE_FAST(state1);
+    RENORMALIZE_STATE_FAST(state0);
+    out[n + 0] = NextSymbol(dec, log_tab_size, &state1);
+    out[n + 1] = NextSymbol(dec, log_tab_size, &state0);
+  }
+  for (; n < size_limit; n += 2) {
     RENORMALIZE_STATE(state1);
     RENORMALIZE_STATE(state0);
     if (lbr.eof_) break;
-    out[n + 0] = NextSymbol(dec, &state1);
-    out[n + 1] = NextSymbol(dec, &state0);
+    out[n + 0] = NextSymbol(dec, log_tab_size, &state1);
+    out[n + 1] = NextSymbol(dec, log_tab_size, &state0);
   }
-  RENORMALIZE_STATE(state1);
-  RENORMALIZE_STATE(state0);
-  if (size & 1) {
+  if (size > 1) {   // the states were flushed twice
+    RENORMALIZE_STATE(state1);
+    RENORMALIZE_STATE(state0);
+  }
+  if (nb_coded & 1) {
     RENORMALIZE_STATE(state1);
-    if (!lbr.eof_) out[n++] = NextSymbol(dec, &state1);
+    if (!lbr.eof_) out[n++] = NextSymbol(dec, log_tab_size, &state1);
   }
 
-  FSCSetReadBufferPos(&lbr, (const uint8_t*)buf);
+  SetWordPos(&lbr, buf);
   // The trailing bytes are encoded in the final state's lower bytes.
   while (state1 != 1 && n < size) {
     out[n++] = state1 & 0xff;
@@ -300,10 +640,10 @@ static int GetBlockW4(FSCDecoder* dec, uint8_t* out, int size,
                       FSCBitReader* br) {
   FSCBitReader lbr = *br;  // it's faster to make a local copy
   const FSCType* buf = (const FSCType*)FSCBitAlign(&lbr);
-  const FSCType* const buf_end = (const FSCType*)FSCGetByteEnd(&lbr);
-  const Symbol* const syms = dec->symbols_;
+  const FSCType* const buf_end = WordEnd(buf, &lbr);
+  const int log_tab_size = dec->log_tab_size_;
   FSCStateW states[4];
-  lbr.eof_ = (buf == buf_end);
+  lbr.eof_ = (buf_end - buf < ((size > 0) ? 4 : 1));
   if (lbr.eof_) goto End;
   int r;
   for (r = 0; r < 4; ++r) {
@@ -311,16 +651,27 @@ static int GetBlockW4(FSCDecoder* dec, uint8_t* out, int size,
   }
 
   int n;
-  for (n = 0; n < (size & ~3); n += 4) {
+  const int fast_limit = NumSafeSymbols(buf, buf_end, size) & ~3;
+  for (n = 0; n < fast_limit; n += 4) {
+    RENORMALIZE_STATE_FAST(states[0]);
+    RENORMALIZE_STATE_FAST(states[1]);
+    RENORMALIZE_STATE_FAST(states[2]);
+    RENORMALIZE_STATE_FAST(states[3]);
+    out[n + 0] = NextSymbol(dec, log_tab_size, &states[0]);
+    out[n + 1] = NextSymbol(dec, log_tab_size, &states[1]);
+    out[n + 2] = NextSymbol(dec, log_tab_size, &states[2]);
+    out[n + 3] = NextSymbol(dec, log_tab_size, &states[3]);
+  }
+  for (; n < (size & ~3); n += 4) {
     RENORMALIZE_STATE(states[0]);
     RENORMALIZE_STATE(states[1]);
     RENORMALIZE_STATE(states[2]);
     RENORMALIZE_STATE(states[3]);
     if (lbr.eof_) break;
-    out[n + 0] = NextSymbol(dec, &states[0]);
-    out[n + 1] = NextSymbol(dec, &states[1]);
-    out[n + 2] = NextSymbol(dec, &states[2]);
-    out[n + 3] = NextSymbol(dec, &states[3]);
+    out[n + 0] = NextSymbol(dec, log_tab_size, &states[0]);
+    out[n + 1] = NextSymbol(dec, log_tab_size, &states[1]);
+    out[n + 2] = NextSymbol(dec, log_tab_size, &states[2]);
+    out[n + 3] = NextSymbol(dec, log_tab_size, &states[3]);
   }
   RENORMALIZE_STATE(states[0]);
   RENORMALIZE_STATE(states[1]);
@@ -328,10 +679,10 @@ static int GetBlockW4(FSCDecoder* dec, uint8_t* out, int size,
   RENORMALIZE_STATE(states[3]);
   for (; n < size; ++n) {
     RENORMALIZE_STATE(states[n & 3]);
-    if (!lbr.eof_) out[n] = NextSymbol(dec, &states[n & 3]);
+    if (!lbr.eof_) out[n] = NextSymbol(dec, log_tab_size, &states[n & 3]);
     RENORMALIZE_STATE(states[n & 3]);
   }
-  FSCSetReadBufferPos(&lbr, (const uint8_t*)buf);
+  SetWordPos(&lbr, buf);
  End:
   *br = lbr;
   return !br->eof_;
@@ -341,20 +692,25 @@ static int GetBlockAliasW1(FSCDecoder* dec, uint8_t* out, int size,
                            FSCBitReader* br) {
   FSCBitReader lbr = *br;  // it's faster to make a local copy
   const FSCType* buf = (const FSCType*)FSCBitAlign(&lbr);
-  const FSCType* const buf_end = (const FSCType*)FSCGetByteEnd(&lbr);
-  const Symbol* const syms = dec->symbols_;
-  lbr.eof_ = (buf == buf_end);
+  const FSCType* const buf_end = WordEnd(buf, &lbr);
+  const int log_tab_size = dec->log_tab_size_;
+  lbr.eof_ = (buf >= buf_end);
   if (lbr.eof_) goto End;
   FSCStateW state = *buf++;
 
   int n;
-  for (n = 0; n < size; ++n) {
+  const int fast_limit = NumSafeSymbols(buf, buf_end, size);
+  for (n = 0; n < fast_limit; ++n) {
+    RENORMALIZE_STATE_FAST(state);
+    out[n] = NextSymbolAlias(dec, log_tab_size, &state);
+  }
+  for (; n < size; ++n) {
     RENORMALIZE_STATE(state);
     if (lbr.eof_) break;
-    out[n] = NextSymbolAlias(dec, &state);
+    out[n] = NextSymbolAlias(dec, log_tab_size, &state);
   }
   RENORMALIZE_STATE(state);
-  FSCSetReadBufferPos(&lbr, (const uint8_t*)buf);
+  SetWordPos(&lbr, buf);
  End:
   *br = lbr;
   return !br->eof_;
@@ -364,28 +720,131 @@ static int GetBlockAliasW2(FSCDecoder* dec, uint8_t* out, int size,
                            FSCBitReader* br) {
   FSCBitReader lbr = *br;  // it's faster to make a local copy
   const FSCType* buf = (const FSCType*)FSCBitAlign(&lbr);
-  const FSCType* const buf_end = (const FSCType*)FSCGetByteEnd(&lbr);
-  const Symbol* const syms = dec->symbols_;
-  lbr.eof_ = (buf == buf_end);
+  const FSCType* const buf_end = WordEnd(buf, &lbr);
+  const int log_tab_size = dec->log_tab_size_;
+  lbr.eof_ = (buf_end - buf < ((size > 1) ? 2 : 1));
   if (lbr.eof_) goto End;
   FSCStateW state1 = (*buf++);
-  FSCStateW state0 = (size > 1) ? (*buf++) : 0;
+  FSCStateW state0 = (size > 1) ? *buf++ : 0;
 
   int n;
-  for (n = 0; n + 1 < size; n += 2) {
+  const int fast_limit = NumSafeSymbols(buf, buf_end, size) & ~1;
+  for (n = 0; n < fast_limit; n += 2) {
+    RENORMALIZE_STATE_FAST(state1);
+    RENORMALIZE_STATE_FAST(state0);
+    out[n + 0] = NextSymbolAlias(dec, log_tab_size, &state1);
+    out[n + 1] = NextSymbolAlias(dec, log_tab_size, &state0);
+  }
+  for (; n + 1 < size; n += 2) {
     RENORMALIZE_STATE(state1);
     RENORMALIZE_STATE(state0);
     if (lbr.eof_) break;
-    out[n + 0] = NextSymbolAlias(dec, &state1);
-    out[n + 1] = NextSymbolAlias(dec, &state0);
+    out[n + 0] = NextSymbolAlias(dec, log_tab_size, &state1);
+    out[n + 1] = NextSymbolAlias(dec, log_tab_size, &state0);
   }
   RENORMALIZE_STATE(state0);
   if (size & 1) {
     RENORMALIZE_STATE(state1);
-    if (!lbr.eof_) out[n++] = NextSymbolAlias(dec, &state1);
+    if (!lbr.eof_) out[n++] = NextSymbolAlias(dec, log_tab_size, &state1);
     RENORMALIZE_STATE(state0);
   }
-  FSCSetReadBufferPos(&lbr, (const uint8_t*)buf);
+  SetWordPos(&lbr, buf);
+ End:
+  *br = lbr;
+  return !br->eof_;
+}
+
+static int GetBlockAliasW4(FSCDecoder* dec, uint8_t* out, int size,
+                           FSCBitReader* br) {
+  FSCBitReader lbr = *br;  // it's faster to make a local copy
+  const FSCType* buf = (const FSCType*)FSCBitAlign(&lbr);
+  const FSCType* const buf_end = WordEnd(buf, &lbr);
+  const int log_tab_size = dec->log_tab_size_;
+  FSCStateW states[4];
+  lbr.eof_ = (buf_end - buf < ((size > 0) ? 4 : 1));
+  if (lbr.eof_) goto End;
+  int r;
+  for (r = 0; r < 4; ++r) {
+    states[r] = (size > 0) ? *buf++ : 0;
+  }
+
+  int n;
+  const int fast_limit = NumSafeSymbols(buf, buf_end, size) & ~3;
+  for (n = 0; n < fast_limit; n += 4) {
+    RENORMALIZE_STATE_FAST(states[0]);
+    RENORMALIZE_STATE_FAST(states[1]);
+    RENORMALIZE_STATE_FAST(states[2]);
+    RENORMALIZE_STATE_FAST(states[3]);
+    NextSymbolsAlias4(dec, log_tab_size, states, out + n);
+  }
+  for (; n < (size & ~3); n += 4) {
+    RENORMALIZE_STATE(states[0]);
+    RENORMALIZE_STATE(states[1]);
+    RENORMALIZE_STATE(states[2]);
+    RENORMALIZE_STATE(states[3]);
+    if (lbr.eof_) break;
+    NextSymbolsAlias4(dec, log_tab_size, states, out + n);
+  }
+  RENORMALIZE_STATE(states[0]);
+  RENORMALIZE_STATE(states[1]);
+  RENORMALIZE_STATE(states[2]);
+  RENORMALIZE_STATE(states[3]);
+  for (; n < size; ++n) {
+    RENORMALIZE_STATE(states[n & 3]);
+    if (!lbr.eof_) {
+      out[n] = NextSymbolAlias(dec, log_tab_size, &states[n & 3]);
+    }
+    RENORMALIZE_STATE(states[n & 3]);
+  }
+  SetWordPos(&lbr, buf);
+ End:
+  *br = lbr;
+  return !br->eof_;
+}
+
+static int GetBlockTinyW4(FSCDecoder* dec, uint8_t* out, int size,
+                          FSCBitReader* br) {
+  FSCBitReader lbr = *br;  // it's faster to make a local copy
+  const FSCType* buf = (const FSCType*)FSCBitAlign(&lbr);
+  const FSCType* const buf_end = WordEnd(buf, &lbr);
+  const int log_tab_size = dec->log_tab_size_;
+  FSCStateW states[4];
+  lbr.eof_ = (buf_end - buf < ((size > 0) ? 4 : 1));
+  if (lbr.eof_) goto End;
+  int r;
+  for (r = 0; r < 4; ++r) {
+    states[r] = (size > 0) ? *buf++ : 0;
+  }
+
+  int n;
+  const int fast_limit = NumSafeSymbols(buf, buf_end, size) & ~3;
+  for (n = 0; n < fast_limit; n += 4) {
+    RENORMALIZE_STATE_FAST(states[0]);
+    RENORMALIZE_STATE_FAST(states[1]);
+    RENORMALIZE_STATE_FAST(states[2]);
+    RENORMALIZE_STATE_FAST(states[3]);
+    NextSymbolsTiny4(dec, log_tab_size, states, out + n);
+  }
+  for (; n < (size & ~3); n += 4) {
+    RENORMALIZE_STATE(states[0]);
+    RENORMALIZE_STATE(states[1]);
+    RENORMALIZE_STATE(states[2]);
+    RENORMALIZE_STATE(states[3]);
+    if (lbr.eof_) break;
+    NextSymbolsTiny4(dec, log_tab_size, states, out + n);
+  }
+  RENORMALIZE_STATE(states[0]);
+  RENORMALIZE_STATE(states[1]);
+  RENORMALIZE_STATE(states[2]);
+  RENORMALIZE_STATE(states[3]);
+  for (; n < size; ++n) {
+    RENORMALIZE_STATE(states[n & 3]);
+    if (!lbr.eof_) {
+      out[n] = NextSymbolTiny(dec, log_tab_size, &states[n & 3]);
+    }
+    RENORMALIZE_STATE(states[n & 3]);
+  }
+  SetWordPos(&lbr, buf);
  End:
   *br = lbr;
   return !br->eof_;
@@ -419,12 +878,36 @@ static int ReadSequence(uint32_t seq[], int len, int sparse, int nb_bits,
   return 1;
 }
 
+// Reads the list of the 'nb' used symbols, which must be increasing.
+static int ReadSymbolSet(FSCDecoder* dec, int nb, FSCBitReader* br) {
+  int i, s;
+  if (FSCReadBits(br, 1)) {   // bitmap
+    const int last = FSCReadBits(br, 8);
+    for (s = 0, i = 0; s < last; ++s) {
+      if (FSCReadBits(br, 1)) {
+        if (i == nb - 1) return 0;
+        dec->remap_[i++] = s;
+      }
+    }
+    if (i != nb - 1) return 0;
+    dec->remap_[i] = last;
+  } else {
+    for (i = 0; i < nb; ++i) {
+      dec->remap_[i] = FSCReadBits(br, 8);
+      if (i > 0 && dec->remap_[i] <= dec->remap_[i - 1]) return 0;
+    }
+  }
+  return !br->eof_;
+}
+
 static int ReadHeader(FSCDecoder* dec, FSCBitReader* br, uint32_t counts[TAB_SIZE]) {
   const int log_tab_size = dec->log_tab_size_;
   const uint32_t tab_size = 1 << log_tab_size;
+  dec->dense_ = FSCReadBits(br, 1);
   const int max_symbol = 1 + FSCReadBits(br, 8);
   dec->max_symbol_ = max_symbol;
   dec->unique_symbol_ = -1;
+  if (dec->dense_ && !ReadSymbolSet(dec, max_symbol, br)) return 0;
 
   if (max_symbol < HDR_SYMBOL_LIMIT) {  // Use method #1 for small alphabet
     if (!ReadSequence(counts, max_symbol, 2, log_tab_size, br)) {
@@ -432,29 +915,26 @@ static int ReadHeader(FSCDecoder* dec, FSCBitReader* br, uint32_t counts[TAB_SIZ
     }
   } else {  // Use more complex method #2 for large alphabet
     const int hlen = 1 + FSCReadBits(br, 5);
-    uint32_t bHisto[LOG_TAB_SIZE + 1];
+    uint32_t bHisto[MAX_LOG_TAB_SIZE + 1];
     uint8_t bins[MAX_SYMBOLS] = { 0 };
     if (hlen == 32) {   // sparse case
       int i;
       for (i = 0; i < max_symbol - 1; ++i) counts[i] = 0;
       counts[max_symbol - 1] = tab_size;
     } else {
+      if (hlen > log_tab_size + 1) return 0;   // bins are in [0, log_tab_size]
       if (!ReadSequence(bHisto, hlen, 2, TAB_HDR_BITS, br)) {
         return 0;
       }
-      {
-        FSCDecoder dec2;
-        memset(&dec2, 0, sizeof(dec2));
-        dec2.log_tab_size_ = TAB_HDR_BITS;
-        dec2.max_symbol_ = hlen;
-        dec2.method_ = CODING_METHOD_BUCKET;
-        dec2.methods_ = kDecMethods[dec2.method_];
-        if (hlen > log_tab_size) return 0;
-        if (!dec2.methods_.build_tables(&dec2, bHisto)) {
-          fprintf(stderr, "Sub-Decoder initialization failed!\n");
+      {   // bins are coded with small bucket-spread tables
+        FSCState tab[1 << TAB_HDR_BITS];
+        uint8_t symbols[1 << TAB_HDR_BITS];
+        if (!BuildStates(bHisto, hlen, TAB_HDR_BITS, BuildSpreadTableBucket,
+                         NULL, tab, symbols)) {
+          fprintf(stderr, "Header tables initialization failed!\n");
           return 0;
         }
-        dec2.methods_.get_block(&dec2, bins, max_symbol - 1, br);
+        GetSymbols(tab, TAB_HDR_BITS, bins, max_symbol - 1, br);
       }
       {
         int i;
@@ -477,15 +957,24 @@ static int ReadHeader(FSCDecoder* dec, FSCBitReader* br, uint32_t counts[TAB_SIZ
 static int ReadParams(FSCDecoder* dec, FSCBitReader* br,
                       uint32_t counts[MAX_SYMBOLS]) {
   dec->log_tab_size_ = LOG_TAB_SIZE - FSCReadBits(br, 4);
+  if (dec->log_tab_size_ < 1) return 0;
   return ReadHeader(dec, br, counts);
 }
 
 static int ReadParamsW(FSCDecoder* dec, FSCBitReader* br,
                        uint32_t counts[MAX_SYMBOLS]) {
-  dec->log_tab_size_ = MAX_LOG_TAB_SIZE;
+  dec->log_tab_size_ = MAX_LOG_TAB_SIZE - FSCReadBits(br, 4);
+  if (dec->log_tab_size_ < MIN_LOG_TAB_SIZE_W) return 0;
   return ReadHeader(dec, br, counts);
 }
 
+static int ReadParamsAliasW(FSCDecoder* dec, FSCBitReader* br,
+                            uint32_t counts[MAX_SYMBOLS]) {
+  if (!ReadParamsW(dec, br, counts)) return 0;
+  dec->alias_log2_size_ = FSCReadBits(br, 4);
+  return !br->eof_;
+}
+
 //------------------------------------------------------------------------------
 // corner case of only-one-symbol
 
@@ -520,49 +1009,88 @@ static const DecMethods kDecMethods[CODING_METHOD_LAST] = {
 
   { ReadParamsW, GetBlockW1, BuildStateTableW, NULL },
   { ReadParamsW, GetBlockW2, BuildStateTableW, NULL },
-  { ReadParamsW, GetBlockAliasW1, BuildStateTableAliasW, NULL },
-  { ReadParamsW, GetBlockAliasW2, BuildStateTableAliasW, NULL },
+  { ReadParamsAliasW, GetBlockAliasW1, BuildStateTableAliasW, NULL },
+  { ReadParamsAliasW, GetBlockAliasW2, BuildStateTableAliasW, NULL },
 
-  { ReadParamsW, GetBlockW4, BuildStateTableW, NULL },
+  { ReadParamsW, GetBlockW4, BuildStateTableW4, NULL },
+  { ReadParamsAliasW, GetBlockAliasW4, BuildStateTableAliasW4, NULL },
 
   { ReadParamsUnique, GetBlockUnique, BuildTableUnique, NULL },
 };
 
 //------------------------------------------------------------------------------
 
-FSCDecoder* FSCInit(const uint8_t* input, size_t len) {
-  FSCDecoder* dec = (FSCDecoder*)calloc(1, sizeof(*dec));
-  if (dec == NULL) return NULL;
-
-  FSCInitBitReader(&dec->br_, input, len);
+// Reads the size, method and params of a message from 'br', and builds its
+// tables. Only the scalar fields are reset, the tables' memory is kept.
+static int ReadStreamHeader(FSCDecoder* const dec, FSCBitReader* const br) {
+  uint32_t counts[MAX_SYMBOLS];
   dec->unique_symbol_ = -1;
-  dec->out_size_ = 0;
-  int i;
-  for (i = 0; i < 8 && FSCReadBits(&dec->br_, 1); ++i) {
-    dec->out_size_ |= FSCReadBits(&dec->br_, 8) << (8 * i);
-  }
-
-  dec->method_ = (FSCCodingMethod)FSCReadBits(&dec->br_, 4);
-  if (dec->method_ >= CODING_METHOD_LAST) goto Error;
+  dec->alias_log2_size_ = 0;
+  dec->dense_ = 0;
+  dec->remap_output_ = 0;
+  dec->status_ = FSC_ERROR;
+  dec->out_size_ = FSCReadSize(br);
+
+  dec->method_ = (FSCCodingMethod)FSCReadBits(br, 4);
+  if (dec->method_ >= CODING_METHOD_LAST) return 0;
   dec->methods_ = kDecMethods[dec->method_];
 
-  uint32_t counts[MAX_SYMBOLS];
-  if (!dec->methods_.read_params(dec, &dec->br_, counts) ||
+  if (!dec->methods_.read_params(dec, br, counts) ||
+      !AllocTables(dec) ||
       !dec->methods_.build_tables(dec, counts)) {
- Error:
-    dec->status_ = FSC_ERROR;
-  } else {
-    dec->status_ = FSC_OK;
+    return 0;
   }
+  dec->status_ = FSC_OK;
+  return 1;
+}
+
+// Parses the header of a new message and builds its tables.
+static int DecoderReset(FSCDecoder* const dec, const uint8_t* input,
+                        size_t len, size_t padding) {
+  FSCInitBitReader(&dec->br_, input, len);
+  FSCSetBitReaderPadding(&dec->br_, padding);
+  return ReadStreamHeader(dec, &dec->br_);
+}
+
+FSCDecoderCtx* FSCDecoderCtxNew(void) {
+  FSCDecoder* const dec = (FSCDecoder*)FSCMalloc(sizeof(*dec));
+  if (dec == NULL) return NULL;
+  dec->status_ = FSC_ERROR;
+  InitMem(dec, NULL, 0);
   return dec;
 }
 
+int FSCDecoderCtxReset(FSCDecoderCtx* ctx, const uint8_t* input, size_t len) {
+  if (ctx == NULL) return 0;
+  return DecoderReset(ctx, input, len, 0);
+}
+
+void FSCDecoderCtxDelete(FSCDecoderCtx* ctx) {
+  if (ctx != NULL && ctx->own_mem_) FSCFree(ctx->mem_);
+  FSCFree(ctx);
+}
+
+static FSCDecoder* DecoderInit(const uint8_t* input, size_t len,
+                               size_t padding) {
+  FSCDecoder* const dec = FSCDecoderCtxNew();
+  if (dec != NULL) DecoderReset(dec, input, len, padding);
+  return dec;
+}
+
+FSCDecoder* FSCInit(const uint8_t* input, size_t len) {
+  return DecoderInit(input, len, 0);
+}
+
+FSCDecoder* FSCInitPadded(const uint8_t* input, size_t len) {
+  return DecoderInit(input, len, FSC_INPUT_PADDING);
+}
+
 int FSCIsOk(FSCDecoder* dec) {
   return (dec != NULL) && (dec->status_ != FSC_ERROR);
 }
 
 void FSCDelete(FSCDecoder* dec) {
-  free(dec);
+  FSCDecoderCtxDelete(dec);
 }
 
 int FSCDecompress(FSCDecoder* dec, uint8_t** out, size_t* out_size) {
@@ -570,11 +1098,12 @@ int FSCDecompress(FSCDecoder* dec, uint8_t** out, size_t* out_size) {
   size_t size = dec->out_size_;
   int need_allocate = (*out == NULL);
   if (need_allocate) {
-    *out = (uint8_t*)malloc(size * sizeof(*out));
+    *out = (uint8_t*)FSCMalloc(size * sizeof(*out));
     if (*out == NULL) return 0;
     *out_size = size;
   } else {
     if (*out_size < size) return 0;  // not enough room
+    *out_size = size;
   }
 
   uint8_t* ptr = *out;
@@ -585,12 +1114,16 @@ int FSCDecompress(FSCDecoder* dec, uint8_t** out, size_t* out_size) {
       dec->status_ = FSC_EOF;
       break;
     }
+    if (dec->remap_output_) {
+      int i;
+      for (i = 0; i < next_size; ++i) ptr[i] = dec->remap_[ptr[i]];
+    }
     ptr += next_size;
     size -= next_size;
   }
   if (dec->status_ == FSC_ERROR) {
     if (need_allocate) {
-      free(*out);
+      FSCFree(*out);
       *out = 0;
       *out_size = 0;
     }
@@ -601,12 +1134,554 @@ int FSCDecompress(FSCDecoder* dec, uint8_t** out, size_t* out_size) {
 
 //------------------------------------------------------------------------------
 
-int FSCDecode(const uint8_t* in, size_t in_size, uint8_t** out, size_t* size) {
-  FSCDecoder* const dec = FSCInit(in, in_size);
-  if (dec == NULL || out == NULL || size == NULL) return 0;
+static int Decode(FSCDecoder* const dec, uint8_t** out, size_t* size) {
+  if (dec == NULL || out == NULL || size == NULL) {
+    FSCDelete(dec);
+    return 0;
+  }
   const int ok = FSCDecompress(dec, out, size) && FSCIsOk(dec);
   FSCDelete(dec);
   return ok;
 }
 
+static int IsFiltered(const uint8_t* in, size_t in_size);
+static int DecodeFiltered(const uint8_t* in, size_t in_size,
+                          uint8_t** out, size_t* out_size);
+
+int FSCDecode(const uint8_t* in, size_t in_size, uint8_t** out, size_t* size) {
+  if (IsFiltered(in, in_size)) return DecodeFiltered(in, in_size, out, size);
+  return Decode(FSCInit(in, in_size), out, size);
+}
+
+int FSCDecodePadded(const uint8_t* in, size_t in_size,
+                    uint8_t** out, size_t* size) {
+  if (IsFiltered(in, in_size)) return DecodeFiltered(in, in_size, out, size);
+  return Decode(FSCInitPadded(in, in_size), out, size);
+}
+
+int FSCDecodeWithCtx(FSCDecoderCtx* ctx, const uint8_t* in, size_t in_size,
+                     uint8_t** out, size_t* size) {
+  if (out == NULL || size == NULL) return 0;
+  if (IsFiltered(in, in_size)) {   // one decoder per plane: ctx is not used
+    return (ctx != NULL) && DecodeFiltered(in, in_size, out, size);
+  }
+  return FSCDecoderCtxReset(ctx, in, in_size) &&
+         FSCDecompress(ctx, out, size) && FSCIsOk(ctx);
+}
+
+//------------------------------------------------------------------------------
+// Workspace: the decoder and its tables, 16b-aligned.
+
+size_t FSCDecoderWorkspaceSize(FSCCodingMethod method, int log_tab_size) {
+  FSCDecoder dec;
+  if (method >= CODING_METHOD_LAST || log_tab_size < 1) return 0;
+  if (method >= CODING_METHOD_16B) {   // same clamping as the encoder
+    if (log_tab_size < MIN_LOG_TAB_SIZE_W) log_tab_size = MIN_LOG_TAB_SIZE_W;
+    if (log_tab_size > MAX_LOG_TAB_SIZE) log_tab_size = MAX_LOG_TAB_SIZE;
+  } else if (log_tab_size > LOG_TAB_SIZE) {
+    return 0;
+  }
+  dec.method_ = method;
+  dec.log_tab_size_ = log_tab_size;
+  return 15 + ALIGN_SIZE(sizeof(dec)) + SetTables(&dec, NULL);
+}
+
+int FSCDecodeWithWorkspace(const uint8_t* in, size_t in_size,
+                           uint8_t* out, size_t out_capacity,
+                           size_t* out_size,
+                           void* workspace, size_t workspace_size) {
+  uint8_t* const start =
+      (uint8_t*)(((uintptr_t)workspace + 15) & ~(uintptr_t)15);
+  const size_t used = (start - (uint8_t*)workspace) +
+                      ALIGN_SIZE(sizeof(FSCDecoder));
+  FSCDecoder* const dec = (FSCDecoder*)start;
+  if (workspace == NULL || workspace_size < used) return 0;
+  if (out == NULL || out_size == NULL) return 0;
+  if (IsFiltered(in, in_size)) return 0;   // would need a decoder per plane
+  InitMem(dec, start + ALIGN_SIZE(sizeof(*dec)), workspace_size - used);
+  *out_size = out_capacity;
+  return DecoderReset(dec, in, in_size, 0) &&
+         FSCDecompress(dec, &out, out_size) && FSCIsOk(dec);
+}
+
+//------------------------------------------------------------------------------
+// Batch of records (see fsc_enc.c for the layout)
+
+struct FSCBatch {
+  FSCDecoder dec_;             // tables shared by all the records
+  size_t nb_records_;
+  int size_bits_, off_bits_;   // bit-widths of the index fields
+  const uint8_t* index_;
+  const uint8_t* payload_;
+  const uint8_t* end_;
+};
+
+// Reads nb <= 57 bits at bit position 'pos' of [buf, end).
+static uint64_t ReadBitsAt(const uint8_t* buf, const uint8_t* end,
+                           uint64_t pos, int nb) {
+  const uint8_t* const p = buf + (pos >> 3);
+  uint64_t v = 0;
+  if (nb == 0) return 0;
+  memcpy(&v, p, (end - p >= 8) ? 8 : (size_t)(end - p));
+  return (le64toh(v) >> (pos & 7)) & ((~0ull) >> (64 - nb));
+}
+
+static void ReadIndex(const FSCBatch* const batch, size_t i,
+                      size_t* const offset, size_t* const size) {
+  const int entry_bits = batch->off_bits_ + batch->size_bits_;
+  const uint64_t pos = (uint64_t)i * entry_bits;
+  *offset = (size_t)ReadBitsAt(batch->index_, batch->payload_,
+                               pos, batch->off_bits_);
+  *size = (size_t)ReadBitsAt(batch->index_, batch->payload_,
+                             pos + batch->off_bits_, batch->size_bits_);
+}
+
+FSCBatch* FSCBatchInit(const uint8_t* in, size_t in_size) {
+  FSCBatch* const batch = (FSCBatch*)FSCMalloc(sizeof(*batch));
+  FSCDecoder* const dec = &batch->dec_;
+  FSCBitReader* const br = &dec->br_;
+  uint64_t index_size;
+  int entry_bits;
+  if (batch == NULL) return NULL;
+  InitMem(dec, NULL, 0);
+  if (in == NULL || !DecoderReset(dec, in, in_size, 0)) goto Error;
+  batch->nb_records_ = FSCReadSize(br);
+  batch->size_bits_ = FSCReadBits(br, 6);
+  batch->off_bits_ = FSCReadBits(br, 6);
+  if (br->eof_ || batch->size_bits_ > 57 || batch->off_bits_ > 57) {
+    goto Error;
+  }
+  batch->index_ = FSCBitAlign(br);
+  batch->end_ = in + in_size;
+  entry_bits = batch->size_bits_ + batch->off_bits_;
+  if (batch->index_ > batch->end_ ||
+      (entry_bits > 0 && batch->nb_records_ > 8 * in_size / entry_bits)) {
+    goto Error;
+  }
+  index_size = ((uint64_t)batch->nb_records_ * entry_bits + 7) >> 3;
+  if (index_size > (uint64_t)(batch->end_ - batch->index_)) goto Error;
+  batch->payload_ = batch->index_ + index_size;
+  return batch;
+
+ Error:
+  FSCBatchDelete(batch);
+  return NULL;
+}
+
+size_t FSCBatchNumRecords(const FSCBatch* batch) {
+  return (batch != NULL) ? batch->nb_records_ : 0;
+}
+
+size_t FSCBatchRecordSize(const FSCBatch* batch, size_t index) {
+  size_t offset, size;
+  if (batch == NULL || index >= batch->nb_records_) return 0;
+  ReadIndex(batch, index, &offset, &size);
+  return size;
+}
+
+int FSCBatchDecodeRecord(FSCBatch* batch, size_t index,
+                         uint8_t** out, size_t* out_size) {
+  FSCDecoder* dec;
+  size_t offset, size, end;
+  if (batch == NULL || index >= batch->nb_records_) return 0;
+  if (out == NULL || out_size == NULL) return 0;
+  dec = &batch->dec_;
+  ReadIndex(batch, index, &offset, &size);
+  if (index + 1 < batch->nb_records_) {
+    size_t next_size;
+    ReadIndex(batch, index + 1, &end, &next_size);
+  } else {
+    end = (size_t)(batch->end_ - batch->payload_);
+  }
+  if (offset > end || end > (size_t)(batch->end_ - batch->payload_) ||
+      size > 0xffffffffu) {
+    return 0;
+  }
+  FSCInitBitReader(&dec->br_, batch->payload_ + offset, end - offset);
+  dec->out_size_ = (uint32_t)size;
+  dec->status_ = FSC_OK;
+  return FSCDecompress(dec, out, out_size) && FSCIsOk(dec);
+}
+
+void FSCBatchDelete(FSCBatch* batch) {
+  if (batch != NULL) FSCFree(batch->dec_.mem_);
+  FSCFree(batch);
+}
+
+int FSCDecodeBatch(const uint8_t* in, size_t in_size,
+                   uint8_t** out, size_t* out_size,
+                   size_t** sizes, size_t* nb_records) {
+  FSCBatch* const batch = FSCBatchInit(in, in_size);
+  uint8_t* dst = NULL;
+  size_t* dst_sizes = NULL;
+  size_t total = 0, pos = 0, n;
+  if (batch == NULL) return 0;
+  if (out == NULL || out_size == NULL || sizes == NULL) goto Error;
+  for (n = 0; n < batch->nb_records_; ++n) {
+    total += FSCBatchRecordSize(batch, n);
+  }
+  if (total != batch->dec_.out_size_) goto Error;
+  dst = (uint8_t*)FSCMalloc(total + 1);
+  dst_sizes =
+      (size_t*)FSCMalloc((batch->nb_records_ + 1) * sizeof(*dst_sizes));
+  if (dst == NULL || dst_sizes == NULL) goto Error;
+  for (n = 0; n < batch->nb_records_; ++n) {
+    uint8_t* ptr = dst + pos;
+    dst_sizes[n] = FSCBatchRecordSize(batch, n);
+    if (!FSCBatchDecodeRecord(batch, n, &ptr, &dst_sizes[n])) goto Error;
+    pos += dst_sizes[n];
+  }
+  *out = dst;
+  *out_size = total;
+  *sizes = dst_sizes;
+  if (nb_records != NULL) *nb_records = batch->nb_records_;
+  FSCBatchDelete(batch);
+  return 1;
+
+ Error:
+  FSCFree(dst_sizes);
+  FSCFree(dst);
+  FSCBatchDelete(batch);
+  return 0;
+}
+
+//------------------------------------------------------------------------------
+// Clustered tables (see fsc_enc.c for the layout)
+
+int FSCDecodeClustered(const uint8_t* in, size_t in_size,
+                       uint8_t** out, size_t* out_size) {
+  FSCBitReader br;
+  FSCDecoder* decs = NULL;
+  uint8_t* ids = NULL;
+  uint8_t* dst = NULL;
+  uint64_t sizes[FSC_MAX_TABLES] = { 0 };
+  size_t total, nb_blocks, b, pos;
+  int nb_tables, id_bits = 0, k;
+  if (in == NULL || out == NULL || out_size == NULL) return 0;
+  FSCInitBitReader(&br, in, in_size);
+  total = FSCReadSize(&br);
+  nb_tables = FSCReadBits(&br, 4) + 1;
+  if (br.eof_ || total > ((size_t)-1) - BLOCK_SIZE) return 0;
+  nb_blocks = (total + BLOCK_SIZE - 1) / BLOCK_SIZE;
+  while ((1 << id_bits) < nb_tables) ++id_bits;
+  if (id_bits > 0 && nb_blocks > 8 * (uint64_t)in_size / id_bits) return 0;
+
+  decs = (FSCDecoder*)FSCMalloc(nb_tables * sizeof(*decs));
+  ids = (uint8_t*)FSCMalloc(nb_blocks + 1);
+  if (decs != NULL) {
+    for (k = 0; k < nb_tables; ++k) InitMem(&decs[k], NULL, 0);
+  }
+  if (decs == NULL || ids == NULL) goto Error;
+  for (k = 0; k < nb_tables; ++k) {
+    if (!ReadStreamHeader(&decs[k], &br)) goto Error;
+  }
+  // the blocks of each table must add up to its size
+  for (b = 0; b < nb_blocks; ++b) {
+    ids[b] = (id_bits > 0) ? FSCReadBits(&br, id_bits) : 0;
+    if (ids[b] >= nb_tables) goto Error;
+    sizes[ids[b]] += (total - b * BLOCK_SIZE > BLOCK_SIZE)
+                   ? BLOCK_SIZE : total - b * BLOCK_SIZE;
+  }
+  if (br.eof_) goto Error;
+  for (k = 0; k < nb_tables; ++k) {
+    if (sizes[k] != decs[k].out_size_) goto Error;
+  }
+
+  dst = (uint8_t*)FSCMalloc(total + 1);
+  if (dst == NULL) goto Error;
+  for (b = 0, pos = 0; b < nb_blocks; ++b) {
+    FSCDecoder* const dec = &decs[ids[b]];
+    const int size = (int)((total - pos > BLOCK_SIZE) ? BLOCK_SIZE
+                                                      : total - pos);
+    uint8_t* const ptr = dst + pos;
+    if (!dec->methods_.get_block(dec, ptr, size, &br)) goto Error;
+    if (dec->remap_output_) {
+      int i;
+      for (i = 0; i < size; ++i) ptr[i] = dec->remap_[ptr[i]];
+    }
+    pos += size;
+  }
+  for (k = 0; k < nb_tables; ++k) FSCFree(decs[k].mem_);
+  FSCFree(decs);
+  FSCFree(ids);
+  *out = dst;
+  *out_size = total;
+  return 1;
+
+ Error:
+  if (decs != NULL) {
+    for (k = 0; k < nb_tables; ++k) FSCFree(decs[k].mem_);
+  }
+  FSCFree(decs);
+  FSCFree(ids);
+  FSCFree(dst);
+  return 0;
+}
+
+//------------------------------------------------------------------------------
+// Filters (see fsc_enc.c for the layout)
+
+// Element of 'width' bytes, as a little-endian integer.
+static FSC_INLINE uint64_t LoadElement(const uint8_t* const p, int width) {
+  uint64_t v = 0;
+  int i;
+  for (i = width - 1; i >= 0; --i) v = (v << 8) | p[i];
+  return v;
+}
+
+#if defined(__SSE2__)
+static FSC_INLINE __m128i Unpredict(__m128i x, __m128i y, int filter,
+                                    int width) {
+  if (filter == FSC_FILTER_XOR) return _mm_xor_si128(x, y);
+  switch (width) {
+    case 1: return _mm_add_epi8(x, y);
+    case 2: return _mm_add_epi16(x, y);
+    case 4: return _mm_add_epi32(x, y);
+    default: return _mm_add_epi64(x, y);
+  }
+}
+
+// Inclusive prefix sum (or XOR) of the elements of x, in log2(16 / width)
+// steps.
+static FSC_INLINE __m128i PrefixScan(__m128i x, int filter, int width) {
+  switch (width) {
+    case 1: x = Unpredict(x, _mm_slli_si128(x, 1), filter, width);
+      /* fall through */
+    case 2: x = Unpredict(x, _mm_slli_si128(x, 2), filter, width);
+      /* fall through */
+    case 4: x = Unpredict(x, _mm_slli_si128(x, 4), filter, width);
+      /* fall through */
+    default: x = Unpredict(x, _mm_slli_si128(x, 8), filter, width);
+  }
+  return x;
+}
+
+// The last element of x, in all the elements.
+static FSC_INLINE __m128i BroadcastLast(__m128i x, int width) {
+  switch (width) {
+    case 1: x = _mm_unpackhi_epi8(x, x);
+      /* fall through */
+    case 2: x = _mm_shufflehi_epi16(x, 0xff);
+      /* fall through */
+    case 4: return _mm_shuffle_epi32(x, 0xff);
+    default: return _mm_unpackhi_epi64(x, x);
+  }
+}
+
+// 16 elements at a time, undoing the rounds of ShuffleRowSSE2(). The
+// prediction is undone in registers, before the only store to 'out'.
+static int UnshuffleRowSSE2(const uint8_t* const planes, int size, int width,
+                            int filter, uint64_t* const prev, uint8_t* out) {
+  const int predict = (filter == FSC_FILTER_DELTA || filter == FSC_FILTER_XOR);
+  __m128i last = BroadcastLast(
+      _mm_set1_epi64x((int64_t)(*prev << (64 - 8 * width))), width);
+  int e, i, k;
+  for (e = 0; e + 16 <= size; e += 16) {
+    __m128i v[FSC_MAX_FILTER_WIDTH], tmp[FSC_MAX_FILTER_WIDTH];
+    for (i = 0; i < width; ++i) {
+      v[i] = _mm_loadu_si128((const __m128i*)(planes + i * BLOCK_SIZE + e));
+    }
+    for (k = 1; k < width; k <<= 1) {
+      for (i = 0; i < width; i += 2) {
+        tmp[i + 0] = _mm_unpacklo_epi8(v[i >> 1], v[(width + i) >> 1]);
+        tmp[i + 1] = _mm_unpackhi_epi8(v[i >> 1], v[(width + i) >> 1]);
+      }
+      memcpy(v, tmp, width * sizeof(v[0]));
+    }
+    if (predict) {
+      for (i = 0; i < width; ++i) {
+        v[i] = Unpredict(PrefixScan(v[i], filter, width), last, filter, width);
+        last = BroadcastLast(v[i], width);
+      }
+    }
+    for (i = 0; i < width; ++i) {
+      _mm_storeu_si128((__m128i*)(out + e * width + 16 * i), v[i]);
+    }
+  }
+  if (e > 0) *prev = LoadElement(out + (e - 1) * width, width);
+  return e;
+}
+#endif   // __SSE2__
+
+// Interleaves back 'size' elements from the 'width' planes, undoing the
+// prediction from the previous element (*prev, updated).
+static void UnshuffleRow(const uint8_t* const planes, int size, int width,
+                         int filter, uint64_t* const prev, uint8_t* out) {
+  const uint64_t mask = (width == 8) ? ~(uint64_t)0
+                                     : ((uint64_t)1 << (8 * width)) - 1;
+  int e = 0, i;
+#if defined(__SSE2__)
+  if (width == 1 || width == 2 || width == 4 || width == 8) {
+    e = UnshuffleRowSSE2(planes, size, width, filter, prev, out);
+  }
+#endif
+  for (; e < size; ++e) {
+    uint64_t x = 0;
+    for (i = width - 1; i >= 0; --i) x = (x << 8) | planes[i * BLOCK_SIZE + e];
+    if (filter == FSC_FILTER_DELTA) {
+      x = (x + *prev) & mask;
+    } else if (filter == FSC_FILTER_XOR) {
+      x ^= *prev;
+    }
+    for (i = 0; i < width; ++i) out[e * width + i] = (uint8_t)(x >> (8 * i));
+    *prev = x;
+  }
+}
+
+// Returns true if the header's method field is FSC_FILTERED_CODE.
+static int IsFiltered(const uint8_t* in, size_t in_size) {
+  FSCBitReader br;
+  if (in == NULL) return 0;
+  FSCInitBitReader(&br, in, in_size);
+  FSCReadSize(&br);
+  return (FSCReadBits(&br, 4) == FSC_FILTERED_CODE) && !br.eof_;
+}
+
+// Decodes into *out if it's not NULL (and *out_size is large enough), as
+// FSCDecompress() does.
+static int DecodeFiltered(const uint8_t* in, size_t in_size,
+                          uint8_t** out, size_t* out_size) {
+  FSCBitReader br;
+  FSCDecoder* decs = NULL;
+  uint8_t* planes = NULL;
+  uint8_t* dst = NULL;
+  size_t total, nb_elements, e, n;
+  uint64_t prev = 0;
+  int filter, width, k;
+  if (in == NULL || out == NULL || out_size == NULL) return 0;
+  FSCInitBitReader(&br, in, in_size);
+  total = FSCReadSize(&br);
+  if (FSCReadBits(&br, 4) != FSC_FILTERED_CODE) return 0;
+  filter = FSCReadBits(&br, 4);
+  width = FSCReadBits(&br, 3) + 1;
+  if (br.eof_ || filter >= FSC_FILTER_LAST) return 0;
+  if (filter == FSC_FILTER_NONE && width != 1) return 0;
+  if (total > ((size_t)-1) - BLOCK_SIZE) return 0;
+  if (*out != NULL && *out_size < total) return 0;   // not enough room
+  nb_elements = total / width;
+
+  decs = (FSCDecoder*)FSCMalloc(width * sizeof(*decs));
+  planes = (uint8_t*)FSCMalloc(width * BLOCK_SIZE);
+  if (decs != NULL) {
+    for (k = 0; k < width; ++k) InitMem(&decs[k], NULL, 0);
+  }
+  dst = (*out != NULL) ? *out : (uint8_t*)FSCMalloc(total + 1);
+  if (decs == NULL || planes == NULL || dst == NULL) goto Error;
+  for (n = nb_elements * width; n < total; ++n) dst[n] = FSCReadBits(&br, 8);
+  for (k = 0; k < width; ++k) {
+    if (!ReadStreamHeader(&decs[k], &br) ||
+        decs[k].out_size_ != nb_elements) {
+      goto Error;
+    }
+  }
+  if (FSCReadPastEnd(&br)) goto Error;
+  for (e = 0; e < nb_elements; e += BLOCK_SIZE) {
+    const int size = (int)((nb_elements - e > BLOCK_SIZE) ? BLOCK_SIZE
+                                                          : nb_elements - e);
+    for (k = 0; k < width; ++k) {
+      FSCDecoder* const dec = &decs[k];
+      uint8_t* const ptr = planes + k * BLOCK_SIZE;
+      // The bit-based methods raise eof_ when a plane ends with the input,
+      // and not always when reading past it: check the position instead.
+      const int ok = dec->methods_.get_block(dec, ptr, size, &br);
+      if (dec->method_ < CODING_METHOD_16B ? FSCReadPastEnd(&br) : !ok) {
+        goto Error;
+      }
+      if (dec->remap_output_) {
+        int i;
+        for (i = 0; i < size; ++i) ptr[i] = dec->remap_[ptr[i]];
+      }
+    }
+    UnshuffleRow(planes, size, width, filter, &prev, dst + e * width);
+  }
+  for (k = 0; k < width; ++k) FSCFree(decs[k].mem_);
+  FSCFree(decs);
+  FSCFree(planes);
+  *out = dst;
+  *out_size = total;
+  return 1;
+
+ Error:
+  if (decs != NULL) {
+    for (k = 0; k < width; ++k) FSCFree(decs[k].mem_);
+  }
+  FSCFree(decs);
+  FSCFree(planes);
+  if (dst != *out) FSCFree(dst);
+  return 0;
+}
+
+int FSCDecodeFiltered(const uint8_t* in, size_t in_size,
+                      uint8_t** out, size_t* out_size) {
+  if (out == NULL) return 0;
+  *out = NULL;
+  return DecodeFiltered(in, in_size, out, out_size);
+}
+
+//------------------------------------------------------------------------------
+// Packed symbols
+
+// Spreads each packed byte into 8 / bits_per_symbol bytes, stored as a
+// little-endian 64-bit word so that a single store unpacks a whole byte.
+static void InitUnpackTable(int bits_per_symbol, uint64_t table[256]) {
+  const int syms_per_byte = 8 / bits_per_symbol;
+  const int mask = (1 << bits_per_symbol) - 1;
+  int v, k;
+  for (v = 0; v < 256; ++v) {
+    uint64_t w = 0;
+    for (k = 0; k < syms_per_byte; ++k) {
+      w |= (uint64_t)((v >> (k * bits_per_symbol)) & mask) << (8 * k);
+    }
+    table[v] = w;
+  }
+}
+
+static uint8_t* Unpack(const uint8_t* in, size_t size, int bits_per_symbol) {
+  const int syms_per_byte = 8 / bits_per_symbol;
+  uint8_t* const out = (uint8_t*)FSCMalloc(size * syms_per_byte + 8);
+  uint64_t table[256];
+  size_t n;
+  if (out == NULL) return NULL;
+  InitUnpackTable(bits_per_symbol, table);
+  for (n = 0; n < size; ++n) {
+    const uint64_t w = WSWAP(table[in[n]]);
+    memcpy(out + n * syms_per_byte, &w, sizeof(w));
+  }
+  return out;
+}
+
+int FSCDecodePacked(const uint8_t* in, size_t in_size, int unpack,
+                    uint8_t** out, size_t* out_size,
+                    size_t* nb_symbols, int* bits_per_symbol) {
+  uint8_t* packed = NULL;
+  size_t size = 0;
+  if (in == NULL || in_size < 1 || out == NULL || out_size == NULL) return 0;
+  const int bits = 1 << (in[0] & 3);
+  const int syms_per_byte = 8 / bits;
+  const int pad = (in[0] >> 2) & 7;
+  if ((in[0] >> 5) != 0 || pad >= syms_per_byte) return 0;
+  if (!FSCDecode(in + 1, in_size - 1, &packed, &size)) return 0;
+  if (size == 0 && pad != 0) {
+    FSCFree(packed);
+    return 0;
+  }
+  const size_t nb = size * syms_per_byte - pad;
+  if (pad > 0) {   // clear the unused bits of the last byte
+    packed[size - 1] &= (1 << ((syms_per_byte - pad) * bits)) - 1;
+  }
+  if (unpack && bits < 8) {
+    uint8_t* const tmp = Unpack(packed, size, bits);
+    FSCFree(packed);
+    if (tmp == NULL) return 0;
+    *out = tmp;
+    *out_size = nb;
+  } else {
+    *out = packed;
+    *out_size = size;
+  }
+  if (nb_symbols != NULL) *nb_symbols = nb;
+  if (bits_per_symbol != NULL) *bits_per_symbol = bits;
+  return 1;
+}
+
 //------------------------------------------------------------------------------
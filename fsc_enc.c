@@ -28,7 +28,17 @@
 #include "./bits.h"
 #include "./alias.h"
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 #define USE_INV_DIV  // for speeding up encoder
+// The full slot map is faster than the map-free AliasEncTable as long as it
+// stays in cache (see alias_test). Build with -DFSC_NO_ALIAS_MAP to use the
+// map-free table instead (see the test_nomap target).
+#if !defined(FSC_NO_ALIAS_MAP)
+#define USE_ALIAS_MAP
+#endif
 
 typedef struct FSCEncoder FSCEncoder;
 
@@ -74,13 +84,31 @@ struct FSCEncoder {
   EncMethods methods_;
   int max_symbol_;
   int unique_symbol_;
-  uint16_t states_[TAB_SIZE];
   transf_t transforms_[MAX_SYMBOLS];
-  size_t in_size_;
   int log_tab_size_;
 
   Symbol symbols_[MAX_SYMBOLS];
-  uint16_t alias_map_[MAX_TAB_SIZE];
+  int alias_log2_size_;              // log2 of the number of alias buckets
+
+  int dense_;                        // true if coding over dense indices
+  uint8_t remap_[MAX_SYMBOLS];       // dense index -> symbol
+
+  // Parameters set by FSCEncoderCtxReset(). The method can still switch to
+  // CODING_METHOD_UNIQUE for a message.
+  int ctx_log_tab_size_;
+  FSCCodingMethod ctx_method_;
+
+  // Tables used by ctx_method_ only, pointing into mem_.
+  uint16_t* states_;                 // 1 << log_tab_size states
+  uint8_t* spread_;                  // 1 << log_tab_size, to build states_
+#if defined(USE_ALIAS_MAP)
+  uint16_t* alias_map_;              // 1 << log_tab_size slots
+#else
+  AliasEncTable* alias_;             // ~8k, vs 128k for a full slot map
+#endif
+  uint8_t* mem_;
+  size_t mem_size_;
+  int own_mem_;                      // false for a caller's workspace
 };
 
 
@@ -98,15 +126,14 @@ static int Log2Ceil(uint32_t v) {   // not a critical function
 
 // -----------------------------------------------------------------------------
 
-static int BuildTables(FSCEncoder* const enc, const uint32_t counts[]) {
+// 'symbols' is a scratch buffer of (1 << log_tab_size) entries.
+static int BuildStates(const uint32_t counts[], int max_symbol,
+                       int log_tab_size, FSCBuildSpreadTableFunc spread,
+                       uint16_t tab[], transf_t transforms[],
+                       uint8_t symbols[]) {
   int s, pos;
-  const int log_tab_size = enc->log_tab_size_;
   const int tab_size = 1 << log_tab_size;
   uint16_t state[MAX_SYMBOLS];
-  uint8_t* symbols;  // symbols, spread on the [0, tab_size) interval
-  const int max_symbol = enc->max_symbol_;
-  uint16_t* const tab = enc->states_;
-  transf_t* const transforms = enc->transforms_;
 
   if (max_symbol > MAX_SYMBOLS || max_symbol <= 0) return 0;
 
@@ -128,20 +155,20 @@ static int BuildTables(FSCEncoder* const enc, const uint32_t counts[]) {
   }
   if (pos != tab_size) return 0;   // input not normalized!
 
-  symbols = (uint8_t*)malloc(tab_size * sizeof(*symbols));
-  if (symbols == NULL) return 0;
-
   // Prepare map from symbol to state
-  if (!enc->methods_.spread(max_symbol, counts, log_tab_size, symbols)) {
-    free(symbols);
-    return 0;
-  }
+  if (!spread(max_symbol, counts, log_tab_size, symbols)) return 0;
   for (pos = 0; pos < tab_size; ++pos) {
     const uint8_t s = symbols[pos];
     tab[state[s]++] = pos + tab_size;
   }
-  free(symbols);
-  return max_symbol;
+  return 1;
+}
+
+static int BuildTables(FSCEncoder* const enc, const uint32_t counts[]) {
+  const int ok = BuildStates(counts, enc->max_symbol_, enc->log_tab_size_,
+                             enc->methods_.spread, enc->states_,
+                             enc->transforms_, enc->spread_);
+  return ok ? enc->max_symbol_ : 0;
 }
 
 #if defined(USE_INV_DIV)
@@ -149,17 +176,20 @@ static int BuildTables(FSCEncoder* const enc, const uint32_t counts[]) {
 // As mentioned by Ryg:
 //   Alverson 1991: "Integer Division Using Reciprocals"
 //   http://citeseerx.ist.psu.edu/viewdoc/summary?doi=10.1.1.33.1710
-#define MULT_SHIFT (8 * sizeof(FSCStateW) + FSC_BITS)
-#define DIV_BY_MULT(A, B) (((A) * (B)) >> MULT_SHIFT)
+// The shift depends on the precision: the encoder guarantees that the
+// state is below (freq << (32 - log_tab_size)) before division, which
+// keeps the 64b product from overflowing and the quotient exact.
+#define MULT_SHIFT(log_tab_size) (8 * sizeof(FSCStateW) + (log_tab_size))
+#define DIV_BY_MULT(A, B) (((A) * (B)) >> MULT_SHIFT(log_tab_size))
 
-void EncodeDividers(Symbol syms[], int max_symbol) {
+void EncodeDividers(Symbol syms[], int max_symbol, int log_tab_size) {
   int s;
   for (s = 0; s < max_symbol; ++s) {
     Symbol* const sym = &syms[s];
     const uint32_t freq = sym->freq_;
-    sym->imult_ = (1u << MAX_LOG_TAB_SIZE) - freq;
+    sym->imult_ = (1u << log_tab_size) - freq;
     if (freq > 0) {
-      sym->mult_ = ((1ull << MULT_SHIFT) + freq - 1) / freq;
+      sym->mult_ = ((1ull << MULT_SHIFT(log_tab_size)) + freq - 1) / freq;
     } else {
       sym->mult_ = 0;  // shouldn't be needed
     }
@@ -182,14 +212,23 @@ static int BuildTablesW(FSCEncoder* const enc, const uint32_t counts[]) {
   if (start != tab_size) return 0;   // not normalized?
 
 #if defined(USE_INV_DIV)
-  EncodeDividers(enc->symbols_, max_symbol);
+  EncodeDividers(enc->symbols_, max_symbol, log_tab_size);
 #endif
   return 1;
 }
 
 static int BuildTablesAliasW(FSCEncoder* const enc, const uint32_t counts[]) {
+#if defined(USE_ALIAS_MAP)
+  return BuildTablesW(enc, counts) &&
+         AliasBuildEncMap(counts, enc->max_symbol_, enc->log_tab_size_,
+                          enc->alias_log2_size_, enc->alias_map_);
+#else
+  AliasTable t;
   return BuildTablesW(enc, counts) &&
-         AliasBuildEncMap(counts, enc->max_symbol_, enc->alias_map_);
+         AliasInit(&t, counts, enc->max_symbol_, enc->log_tab_size_,
+                   enc->alias_log2_size_) &&
+         AliasBuildEncTable(&t, counts, enc->max_symbol_, enc->alias_);
+#endif
 }
 
 static int IsUniqueSymbol(int max_symbol, const uint32_t counts[]) {
@@ -209,38 +248,173 @@ static int IsUniqueSymbol(int max_symbol, const uint32_t counts[]) {
   return unique;
 }
 
-static int EncoderInit(FSCEncoder* const enc, uint32_t counts[],
-                       int max_symbol, int log_tab_size,
-                       FSCCodingMethod method) {
-  int ok = 0;
-  memset(enc, 0, sizeof(*enc));
-  if (max_symbol == 0) max_symbol = MAX_SYMBOLS;
-  if (log_tab_size < 1) return 0;
-  if (method >= CODING_METHOD_LAST) return 0;
+// -----------------------------------------------------------------------------
+// Tables memory
+//
+// Same as for the decoder: the tables needed by the context's method are
+// carved from a single buffer, only re-allocated when the parameters need
+// more room. A caller's workspace is never re-allocated.
 
-  if (method >= CODING_METHOD_16B) {
-    log_tab_size = MAX_LOG_TAB_SIZE;
-  } else if (log_tab_size > LOG_TAB_SIZE) {
-    fprintf(stderr, "!! log_tab_size: %d\n", log_tab_size);
-    return 0;
+#define ALIGN_SIZE(size) (((size) + 15) & ~(size_t)15)
+
+static void* TablePtr(uint8_t* const mem, size_t* const pos, size_t size) {
+  void* const ptr = (mem != NULL) ? mem + *pos : NULL;
+  *pos += ALIGN_SIZE(size);
+  return ptr;
+}
+
+// Points the tables needed by enc->ctx_method_ into 'mem' and returns their
+// total size.
+static size_t SetTables(FSCEncoder* const enc, uint8_t* const mem) {
+  const size_t tab_size = (size_t)1 << enc->ctx_log_tab_size_;
+  size_t pos = 0;
+  enc->states_ = NULL;
+  enc->spread_ = NULL;
+#if defined(USE_ALIAS_MAP)
+  enc->alias_map_ = NULL;
+#else
+  enc->alias_ = NULL;
+#endif
+  switch (enc->ctx_method_) {
+    case CODING_METHOD_BUCKET:
+    case CODING_METHOD_REVERSE:
+    case CODING_METHOD_MODULO:
+    case CODING_METHOD_PACK:
+      enc->states_ = (uint16_t*)TablePtr(mem, &pos,
+                                         tab_size * sizeof(uint16_t));
+      enc->spread_ = (uint8_t*)TablePtr(mem, &pos, tab_size);
+      break;
+    case CODING_METHOD_16B_ALIAS:
+    case CODING_METHOD_16B_ALIAS_2X:
+    case CODING_METHOD_16B_ALIAS_4X:
+#if defined(USE_ALIAS_MAP)
+      enc->alias_map_ = (uint16_t*)TablePtr(mem, &pos,
+                                            tab_size * sizeof(uint16_t));
+#else
+      enc->alias_ = (AliasEncTable*)TablePtr(mem, &pos, sizeof(AliasEncTable));
+#endif
+      break;
+    default:   // symbols_[] is enough
+      break;
+  }
+  return pos;
+}
+
+// 'mem' is NULL for allocated tables.
+static void InitMem(FSCEncoder* const enc, uint8_t* mem, size_t mem_size) {
+  enc->mem_ = mem;
+  enc->mem_size_ = (mem != NULL) ? mem_size : 0;
+  enc->own_mem_ = (mem == NULL);
+}
+
+static int AllocTables(FSCEncoder* const enc) {
+  const size_t size = SetTables(enc, NULL);
+  if (size > enc->mem_size_) {
+    if (!enc->own_mem_) return 0;
+    FSCFree(enc->mem_);
+    enc->mem_ = (uint8_t*)FSCMalloc(size);
+    enc->mem_size_ = (enc->mem_ != NULL) ? size : 0;
+    if (enc->mem_ == NULL) return 0;
   }
+  SetTables(enc, enc->mem_);
+  return 1;
+}
+
+// Only the scalar fields are reset, the tables are rebuilt in place. If
+// 'build' is false, the tables are left alone: only the header can be written.
+static int EncoderInit(FSCEncoder* const enc, uint32_t counts[],
+                       int max_symbol, int build) {
+  const int log_tab_size = enc->ctx_log_tab_size_;
+  FSCCodingMethod method = enc->ctx_method_;
+  if (max_symbol == 0) max_symbol = MAX_SYMBOLS;
   enc->log_tab_size_ = log_tab_size;
+  enc->dense_ = 0;
   enc->max_symbol_ = FSCNormalizeCounts(counts, max_symbol, log_tab_size);
   if (enc->max_symbol_ < 1) {
     fprintf(stderr, "!! enc->max_symbol_: %d\n", enc->max_symbol_);
     return 0;
   }
+  // the smallest alias table that fits the alphabet, for the alias methods
+  enc->alias_log2_size_ = AliasLog2Size(enc->max_symbol_);
 
   enc->unique_symbol_ = IsUniqueSymbol(max_symbol, counts);
   assert(enc->unique_symbol_ < max_symbol);
   if (enc->unique_symbol_ >= 0) {
-    method = CODING_METHOD_UNIQUE;
+    method = CODING_METHOD_UNIQUE;   // no table needed, whatever the symbol
+  } else if (enc->max_symbol_ > (1 << log_tab_size)) {
+    return 0;
   }
-  if (enc->max_symbol_ > (1 << log_tab_size)) return 0;
 
   enc->method_ = method;
   enc->methods_ = kEncMethods[method];
-  return enc->methods_.build_tables(enc, counts);
+  return !build || enc->methods_.build_tables(enc, counts);
+}
+
+// -----------------------------------------------------------------------------
+// Sparse alphabets
+//
+// When less than half of the symbols below max_symbol are used, the tables
+// are built over the dense indices of the used symbols only, and the list
+// of used symbols is sent in the header. The per-symbol tables are then
+// moved to the symbols' own position, so that the coding loops don't need
+// to remap their input.
+
+// Replaces counts[] by the counts of the used symbols, listed in remap[].
+// Returns the number of used symbols, or 0 if the alphabet is not sparse.
+static int CompactCounts(uint32_t counts[MAX_SYMBOLS],
+                         uint8_t remap[MAX_SYMBOLS]) {
+  int s, nb = 0, max_symbol = 0;
+  for (s = 0; s < MAX_SYMBOLS; ++s) {
+    if (counts[s] > 0) {
+      remap[nb++] = s;
+      max_symbol = s + 1;
+    }
+  }
+  if (nb < 2 || 2 * nb > max_symbol) return 0;
+  for (s = 0; s < nb; ++s) counts[s] = counts[remap[s]];
+  for (; s < MAX_SYMBOLS; ++s) counts[s] = 0;
+  return nb;
+}
+
+static void RemapTables(FSCEncoder* const enc) {
+  int i;
+  // remap_[i] >= i, so going backward doesn't overwrite unmoved entries
+  for (i = enc->max_symbol_ - 1; i >= 0; --i) {
+    const int s = enc->remap_[i];
+    if (s == i) break;   // and so are all the previous ones
+    if (enc->method_ < CODING_METHOD_16B) {
+      enc->transforms_[s] = enc->transforms_[i];
+    } else {
+      enc->symbols_[s] = enc->symbols_[i];
+    }
+#if !defined(USE_ALIAS_MAP)   // the map is indexed by start_, already moved
+    if (enc->alias_ != NULL) {
+      enc->alias_->first_[s] = enc->alias_->first_[i];
+      enc->alias_->pieces_start_[s] = enc->alias_->pieces_start_[i];
+    }
+#endif
+  }
+}
+
+// Either the list of symbols, or a bitmap up to the last one.
+static void WriteSymbolSet(const uint8_t remap[], int nb,
+                           FSCBitWriter* const bw) {
+  const int last = remap[nb - 1];
+  const int use_bitmap = (8 + last < 8 * nb);
+  int i;
+  FSCWriteBits(bw, use_bitmap, 1);
+  if (use_bitmap) {
+    int s = 0;
+    FSCWriteBits(bw, last, 8);
+    for (i = 0; i < nb - 1; ++i) {
+      for (; s < remap[i]; ++s) FSCWriteBits(bw, 0, 1);
+      FSCWriteBits(bw, 1, 1);
+      ++s;
+    }
+    for (; s < last; ++s) FSCWriteBits(bw, 0, 1);
+  } else {
+    for (i = 0; i < nb; ++i) FSCWriteBits(bw, remap[i], 8);
+  }
 }
 
 // -----------------------------------------------------------------------------
@@ -251,12 +425,10 @@ typedef struct {  // for delayed bitstream writing
   uint8_t  nb_bits_;
 } token_t;
 
-static void PutBlock(const FSCEncoder* enc, const uint8_t* in, int size,
-                     FSCBitWriter* bw) {
+static void PutSymbols(const uint16_t states[], const transf_t transforms[],
+                       int log_tab_size, const uint8_t* in, int size,
+                       FSCBitWriter* bw) {
   token_t tokens[BLOCK_SIZE];
-  const transf_t* const transforms = enc->transforms_;
-  const uint16_t* const states = enc->states_;
-  const int log_tab_size = enc->log_tab_size_;
   const int tab_size = 1 << log_tab_size;
   int state = tab_size;
   int k;
@@ -275,8 +447,22 @@ static void PutBlock(const FSCEncoder* enc, const uint8_t* in, int size,
   }
 }
 
+static void PutBlock(const FSCEncoder* enc, const uint8_t* in, int size,
+                     FSCBitWriter* bw) {
+  PutSymbols(enc->states_, enc->transforms_, enc->log_tab_size_,
+             in, size, bw);
+}
+
 // -----------------------------------------------------------------------------
 
+// Max bytes written by put_block() for 'size' symbols: at most one 16b word
+// (or LOG_TAB_SIZE bits) per symbol, plus the final states and alignment.
+#define BLOCK_SLACK 32
+static size_t BlockBound(size_t size, FSCCodingMethod method) {
+  const size_t bits = (method < CODING_METHOD_16B) ? LOG_TAB_SIZE : FSC_BITS;
+  return ((size * bits + 7) >> 3) + BLOCK_SLACK;
+}
+
 #define FLUSH_STATE(state, limit) do {                                     \
   if ((state) >= (limit)) {                                                \
     output[--pos] = (FSCType)((state) & FSC_BITS_MASK);                    \
@@ -287,7 +473,7 @@ static void PutBlock(const FSCEncoder* enc, const uint8_t* in, int size,
 #if defined(USE_INV_DIV)
 // Alternative version, which is a little slower than below:
 //   const FSCStateW R = state - q * freq;    // <- that's 'state % freq'
-//   state = (q << MAX_LOG_TAB_SIZE) + R + start;
+//   state = (q << log_tab_size) + R + start;
 #define RENORMALIZE_STATE(state, s) do {                                   \
   const uint32_t start = (s)->start_;                                      \
   const uint32_t q = DIV_BY_MULT(state, s->mult_);                         \
@@ -297,39 +483,44 @@ static void PutBlock(const FSCEncoder* enc, const uint8_t* in, int size,
 // reference calculation
 #define RENORMALIZE_STATE(state, s) do {                                   \
   const uint32_t freq = (s)->freq_, start = (s)->start_;                   \
-  state = ((state / freq) << MAX_LOG_TAB_SIZE) + (state % freq) + start;   \
+  state = ((state / freq) << log_tab_size) + (state % freq) + start;       \
 } while (0)
 // slower version:
-//    (state / freq) * ((1 << MAX_LOG_TAB_SIZE) - freq) + state + start;
+//    (state / freq) * ((1 << log_tab_size) - freq) + state + start;
 #endif  // USE_INV_DIV
 
-// with ALIAS:
+// with ALIAS: 'c' is the symbol, 's' its Symbol entry.
+#if defined(USE_ALIAS_MAP)
+#define ALIAS_SLOT(s, c, R) enc->alias_map_[(R) + (s)->start_]
+#else
+#define ALIAS_SLOT(s, c, R) AliasEncodeSlot(enc->alias_, (c), (R))
+#endif
+
 #if defined(USE_INV_DIV)
-#define RENORMALIZE_STATE_ALIAS(state, s) do {                             \
-  const uint32_t freq = (s)->freq_, start = (s)->start_;                   \
+#define RENORMALIZE_STATE_ALIAS(state, s, c) do {                          \
+  const uint32_t freq = (s)->freq_;                                        \
   const uint32_t q = DIV_BY_MULT(state, s->mult_);                         \
   const uint32_t R = state - q * freq;    /* <- that's 'state % freq' */   \
-  state = (q << MAX_LOG_TAB_SIZE) + enc->alias_map_[R + start];            \
+  state = (q << log_tab_size) + ALIAS_SLOT(s, c, R);                      \
 } while (0)
 #else
-#define RENORMALIZE_STATE_ALIAS(state, s) do {                             \
-  const uint32_t freq = (s)->freq_, start = (s)->start_;                   \
-  state = ((state / freq) << MAX_LOG_TAB_SIZE)                             \
-        + enc->alias_map_[(state % freq) + start];                         \
+#define RENORMALIZE_STATE_ALIAS(state, s, c) do {                          \
+  const uint32_t freq = (s)->freq_;                                        \
+  state = ((state / freq) << log_tab_size)                                 \
+        + ALIAS_SLOT(s, c, state % freq);                                 \
 } while (0)
 #endif   // USE_INV_DIV
 
 static int DoPutBlockW1(const FSCEncoder* enc, const uint8_t* in, int size,
-                        FSCType output[BLOCK_SIZE]) {
-  const FSCStateW norm = (FSC_MAX >> MAX_LOG_TAB_SIZE) << FSC_BITS;
-  int pos = BLOCK_SIZE;
+                        FSCType output[], int pos) {
+  const int log_tab_size = enc->log_tab_size_;
+  const FSCStateW norm = (FSC_MAX >> log_tab_size) << FSC_BITS;
   FSCStateW state = 1;
   int k = size;
   // We encode the first few bytes into initial state.
   while (state < FSC_MAX && k > 0) {
     state = (state << 8) | in[--k];
   }
-  assert(enc->log_tab_size_ == MAX_LOG_TAB_SIZE);
   while (k > 0) {
     const Symbol* const s = &enc->symbols_[in[--k]];
     FLUSH_STATE(state, norm * s->freq_);
@@ -341,12 +532,11 @@ static int DoPutBlockW1(const FSCEncoder* enc, const uint8_t* in, int size,
 }
 
 static int DoPutBlockW2(const FSCEncoder* enc, const uint8_t* in, int size,
-                        FSCType output[BLOCK_SIZE]) {
-  int pos = BLOCK_SIZE;
+                        FSCType output[], int pos) {
   FSCStateW state0 = 1, state1 = 1;
-  const FSCStateW norm = (FSC_MAX >> MAX_LOG_TAB_SIZE) << FSC_BITS;
+  const int log_tab_size = enc->log_tab_size_;
+  const FSCStateW norm = (FSC_MAX >> log_tab_size) << FSC_BITS;
   int k = size;
-  assert(enc->log_tab_size_ == MAX_LOG_TAB_SIZE);
   // We encode the first few bytes into initial states.
   while (state0 < FSC_MAX && k > 0) {
     state0 = (state0 << 8) | in[--k];
@@ -377,13 +567,12 @@ static int DoPutBlockW2(const FSCEncoder* enc, const uint8_t* in, int size,
 }
 
 static int DoPutBlockW4(const FSCEncoder* enc, const uint8_t* in, int size,
-                        FSCType output[BLOCK_SIZE]) {
-  int pos = BLOCK_SIZE;
+                        FSCType output[], int pos) {
   FSCStateW states[4] = { FSC_MAX, FSC_MAX, FSC_MAX, FSC_MAX };
-  const FSCStateW norm = (FSC_MAX >> MAX_LOG_TAB_SIZE) << FSC_BITS;
+  const int log_tab_size = enc->log_tab_size_;
+  const FSCStateW norm = (FSC_MAX >> log_tab_size) << FSC_BITS;
   int k = size;
   int r = size & 3;
-  assert(enc->log_tab_size_ == MAX_LOG_TAB_SIZE);
   while (r-- > 0) {
     const Symbol* const s = &enc->symbols_[in[--k]];
     FLUSH_STATE(states[3 - r], norm * s->freq_);
@@ -416,13 +605,12 @@ static int DoPutBlockW4(const FSCEncoder* enc, const uint8_t* in, int size,
 #if 0
 #define NB_STATES 8
 static int DoPutBlockWN(const FSCEncoder* enc, const uint8_t* in, int size,
-                        FSCType output[BLOCK_SIZE]) {
-  int pos = BLOCK_SIZE;
+                        FSCType output[], int pos) {
   FSCStateW states[NB_STATES];
-  const FSCStateW norm = (FSC_MAX >> MAX_LOG_TAB_SIZE) << FSC_BITS;
+  const int log_tab_size = enc->log_tab_size_;
+  const FSCStateW norm = (FSC_MAX >> log_tab_size) << FSC_BITS;
   int k = size;
   int r;
-  assert(enc->log_tab_size_ == MAX_LOG_TAB_SIZE);
   for (r = 0; r < NB_STATES; ++r) {
     states[r] = FSC_MAX;
   }
@@ -449,16 +637,16 @@ static int DoPutBlockWN(const FSCEncoder* enc, const uint8_t* in, int size,
 // -----------------------------------------------------------------------------
 
 static int DoPutBlockAliasW1(const FSCEncoder* enc, const uint8_t* in, int size,
-                             FSCType output[BLOCK_SIZE]) {
-  int pos = BLOCK_SIZE;
+                             FSCType output[], int pos) {
   FSCStateW state = FSC_MAX;
-  const FSCStateW norm = (FSC_MAX >> MAX_LOG_TAB_SIZE) << FSC_BITS;
+  const int log_tab_size = enc->log_tab_size_;
+  const FSCStateW norm = (FSC_MAX >> log_tab_size) << FSC_BITS;
   int k = size;
-  assert(enc->log_tab_size_ == MAX_LOG_TAB_SIZE);
   while (k > 0) {
-    const Symbol* const s = &enc->symbols_[in[--k]];
+    const int c = in[--k];
+    const Symbol* const s = &enc->symbols_[c];
     FLUSH_STATE(state, norm * s->freq_);
-    RENORMALIZE_STATE_ALIAS(state, s);
+    RENORMALIZE_STATE_ALIAS(state, s, c);
   }
   FLUSH_STATE(state, 0);
   FLUSH_STATE(state, 0);
@@ -466,24 +654,26 @@ static int DoPutBlockAliasW1(const FSCEncoder* enc, const uint8_t* in, int size,
 }
 
 static int DoPutBlockAliasW2(const FSCEncoder* enc, const uint8_t* in, int size,
-                             FSCType output[BLOCK_SIZE]) {
-  int pos = BLOCK_SIZE;
+                             FSCType output[], int pos) {
   FSCStateW state0 = FSC_MAX, state1 = FSC_MAX;
-  const FSCStateW norm = (FSC_MAX >> MAX_LOG_TAB_SIZE) << FSC_BITS;
+  const int log_tab_size = enc->log_tab_size_;
+  const FSCStateW norm = (FSC_MAX >> log_tab_size) << FSC_BITS;
   int k = size;
-  assert(enc->log_tab_size_ == MAX_LOG_TAB_SIZE);
   if (k & 1) {
-    const Symbol* const s1 = &enc->symbols_[in[--k]];
+    const int c1 = in[--k];
+    const Symbol* const s1 = &enc->symbols_[c1];
     FLUSH_STATE(state1, norm * s1->freq_);
-    RENORMALIZE_STATE_ALIAS(state1, s1);
+    RENORMALIZE_STATE_ALIAS(state1, s1, c1);
   }
   while (k > 0) {
-    const Symbol* const s0 = &enc->symbols_[in[--k]];
-    const Symbol* const s1 = &enc->symbols_[in[--k]];
+    const int c0 = in[--k];
+    const int c1 = in[--k];
+    const Symbol* const s0 = &enc->symbols_[c0];
+    const Symbol* const s1 = &enc->symbols_[c1];
     FLUSH_STATE(state0, norm * s0->freq_);
     FLUSH_STATE(state1, norm * s1->freq_);
-    RENORMALIZE_STATE_ALIAS(state0, s0);
-    RENORMALIZE_STATE_ALIAS(state1, s1);
+    RENORMALIZE_STATE_ALIAS(state0, s0, c0);
+    RENORMALIZE_STATE_ALIAS(state1, s1, c1);
   }
   FLUSH_STATE(state0, 0);
   FLUSH_STATE(state1, 0);
@@ -492,17 +682,63 @@ static int DoPutBlockAliasW2(const FSCEncoder* enc, const uint8_t* in, int size,
   return pos;
 }
 
+static int DoPutBlockAliasW4(const FSCEncoder* enc, const uint8_t* in,
+                             int size, FSCType output[], int pos) {
+  FSCStateW states[4] = { FSC_MAX, FSC_MAX, FSC_MAX, FSC_MAX };
+  const int log_tab_size = enc->log_tab_size_;
+  const FSCStateW norm = (FSC_MAX >> log_tab_size) << FSC_BITS;
+  int k = size;
+  int r = size & 3;
+  while (r-- > 0) {
+    const int c = in[--k];
+    const Symbol* const s = &enc->symbols_[c];
+    FLUSH_STATE(states[3 - r], norm * s->freq_);
+    RENORMALIZE_STATE_ALIAS(states[3 - r], s, c);
+  }
+  while (k > 0) {
+    const int c0 = in[--k];
+    const int c1 = in[--k];
+    const int c2 = in[--k];
+    const int c3 = in[--k];
+    const Symbol* const s0 = &enc->symbols_[c0];
+    const Symbol* const s1 = &enc->symbols_[c1];
+    const Symbol* const s2 = &enc->symbols_[c2];
+    const Symbol* const s3 = &enc->symbols_[c3];
+    FLUSH_STATE(states[0], norm * s0->freq_);
+    FLUSH_STATE(states[1], norm * s1->freq_);
+    FLUSH_STATE(states[2], norm * s2->freq_);
+    FLUSH_STATE(states[3], norm * s3->freq_);
+    RENORMALIZE_STATE_ALIAS(states[0], s0, c0);
+    RENORMALIZE_STATE_ALIAS(states[1], s1, c1);
+    RENORMALIZE_STATE_ALIAS(states[2], s2, c2);
+    RENORMALIZE_STATE_ALIAS(states[3], s3, c3);
+  }
+  for (r = 0; r < 4; ++r) {
+    FLUSH_STATE(states[r], 0);
+  }
+  for (r = 0; r < 4; ++r) {
+    if (size > 0) FLUSH_STATE(states[r], 0);
+  }
+  return pos;
+}
+
 // -----------------------------------------------------------------------------
 
+// The kernels write their words backward, from output[pos - 1] down, right
+// into the space reserved at the end of the bit-writer's buffer. The result
+// is then moved down in place to the current position.
 #define PUT_BLOCK_WRAPPER(FUNC_NAME, CALL)                                  \
 static void FUNC_NAME(const FSCEncoder* enc, const uint8_t* in, int size,   \
                       FSCBitWriter* const bw) {                             \
-  FSCType output[BLOCK_SIZE];                                               \
-  assert(size <= BLOCK_SIZE);                                               \
-  const int pos = CALL(enc, in, size, output);                              \
+  const int end = size + BLOCK_SLACK / sizeof(FSCType);                     \
+  FSCType* const output =                                                   \
+      (FSCType*)FSCBitWriterGetBuffer(bw, end * sizeof(FSCType));           \
+  if (output == NULL) return;                                               \
+  const int pos = CALL(enc, in, size, output, end);                         \
   assert(pos >= 0);                                                         \
-  FSCAppend(bw, (const uint8_t*)&output[pos],                               \
-            (BLOCK_SIZE - pos) * sizeof(output[0]));                        \
+  const size_t len = (end - pos) * sizeof(FSCType);                         \
+  if (pos > 0) memmove(output, &output[pos], len);                          \
+  FSCBitWriterAdvance(bw, len);                                             \
 }
 
 PUT_BLOCK_WRAPPER(PutBlockW1, DoPutBlockW1)
@@ -510,6 +746,7 @@ PUT_BLOCK_WRAPPER(PutBlockW2, DoPutBlockW2)
 PUT_BLOCK_WRAPPER(PutBlockW4, DoPutBlockW4)
 PUT_BLOCK_WRAPPER(PutBlockAliasW1, DoPutBlockAliasW1)
 PUT_BLOCK_WRAPPER(PutBlockAliasW2, DoPutBlockAliasW2)
+PUT_BLOCK_WRAPPER(PutBlockAliasW4, DoPutBlockAliasW4)
 
 // -----------------------------------------------------------------------------
 // Coding
@@ -569,20 +806,19 @@ static int WriteHeader(FSCEncoder* const enc, const uint32_t counts[MAX_SYMBOLS]
 
   assert(enc->unique_symbol_ < 0);
   assert(max_symbol > 1);
+  FSCWriteBits(bw, enc->dense_, 1);
   FSCWriteBits(bw, max_symbol - 1, 8);
+  if (enc->dense_) WriteSymbolSet(enc->remap_, max_symbol, bw);
 
   if (max_symbol < HDR_SYMBOL_LIMIT) {  // Method #1 for small alphabet
     if (WriteSequence(counts, max_symbol, 2, log_tab_size, bw) < 0) {
       return 0;
     }
   } else {  // Method #2 for large alphabet
-    int ok = 0;
     int i;
     uint8_t bins[MAX_SYMBOLS];
-    uint32_t* const bHisto =
-        (uint32_t*)calloc(sizeof(*bHisto), log_tab_size + 1);
+    uint32_t bHisto[MAX_SYMBOLS] = { 0 };   // only log_tab_size + 1 used
     uint16_t bits[MAX_SYMBOLS];
-    if (bHisto == NULL) return 0;
     // Decompose into prefix and suffix
     {
       uint32_t total = tab_size;
@@ -590,42 +826,41 @@ static int WriteHeader(FSCEncoder* const enc, const uint32_t counts[MAX_SYMBOLS]
         const int c = counts[i] + 1;
         int bin, b;
         for (bin = 0, b = c; b != 1; ++bin) { b >>= 1; }
-        if (bin > log_tab_size) goto Error;
+        if (bin > log_tab_size) return 0;
         bins[i] = bin;             // prefix
         bits[i] = c - (1 << bin);  // suffix
         ++bHisto[bin];             // record prefix distribution
-        if (total < counts[i]) goto Error;
+        if (total < counts[i]) return 0;
         total -= counts[i];
       }
-      if (total != 0) goto Error;   // Unnormalized distribution!?
+      if (total != 0) return 0;   // Unnormalized distribution!?
     }
     if (bHisto[0] == max_symbol - 1) {   // only one symbol?
       FSCWriteBits(bw, 32 - 1, 5);   // special marker for sparse case
-    } else {  // Compress the prefix sequence using a sub-encoder
-      FSCEncoder enc2;
-      if (!EncoderInit(&enc2, bHisto, log_tab_size + 1,
-                       TAB_HDR_BITS, CODING_METHOD_BUCKET)) {
-        fprintf(stderr, "Sub-Encoder initialization failed!\n");
-        goto Error;
+    } else {  // Compress the prefix sequence with small bucket-spread tables
+      const int hlen = FSCNormalizeCounts(bHisto, log_tab_size + 1,
+                                          TAB_HDR_BITS);
+      uint16_t states[1 << TAB_HDR_BITS];
+      transf_t transforms[MAX_LOG_TAB_SIZE + 1];
+      uint8_t symbols[1 << TAB_HDR_BITS];
+      if (hlen < 1 ||
+          !BuildStates(bHisto, hlen, TAB_HDR_BITS, BuildSpreadTableBucket,
+                       states, transforms, symbols)) {
+        fprintf(stderr, "Header tables initialization failed!\n");
+        return 0;
       }
-      const int hlen = enc2.max_symbol_;
       FSCWriteBits(bw, hlen - 1, 5);
       if (WriteSequence(bHisto, hlen, 2, TAB_HDR_BITS, bw) < 0) {
         fprintf(stderr, "Error during WriteSequence()!\n");
-        goto Error;
+        return 0;
       }
-      enc2.methods_.put_block(&enc2, bins, max_symbol - 1, bw);
+      PutSymbols(states, transforms, TAB_HDR_BITS, bins, max_symbol - 1, bw);
       // Write the suffix sequence
       for (i = 0; i < max_symbol - 1; ++i) {
         FSCWriteBits(bw, bits[i], bins[i]);
       }
     }
-    ok = 1;
- Error:
-    free(bHisto);
-    if (!ok) return 0;
   }
- End:
   return !bw->error_;
 }
 
@@ -637,9 +872,18 @@ static int WriteParams(FSCEncoder* const enc, const uint32_t counts[MAX_SYMBOLS]
 
 static int WriteParamsW(FSCEncoder* const enc, const uint32_t counts[MAX_SYMBOLS],
                         FSCBitWriter* const bw) {
+  FSCWriteBits(bw, MAX_LOG_TAB_SIZE - enc->log_tab_size_, 4);
   return WriteHeader(enc, counts, bw);
 }
 
+static int WriteParamsAliasW(FSCEncoder* const enc,
+                             const uint32_t counts[MAX_SYMBOLS],
+                             FSCBitWriter* const bw) {
+  if (!WriteParamsW(enc, counts, bw)) return 0;
+  FSCWriteBits(bw, enc->alias_log2_size_, 4);
+  return !bw->error_;
+}
+
 // -----------------------------------------------------------------------------
 
 static int WriteParamsUnique(FSCEncoder* const enc, const uint32_t counts[MAX_SYMBOLS],
@@ -725,70 +969,1088 @@ static const EncMethods kEncMethods[CODING_METHOD_LAST] = {
 
   { WriteParamsW, PutBlockW1, BuildTablesW, NULL },
   { WriteParamsW, PutBlockW2, BuildTablesW, NULL },
-  { WriteParamsW, PutBlockAliasW1, BuildTablesAliasW, NULL },
-  { WriteParamsW, PutBlockAliasW2, BuildTablesAliasW, NULL },
+  { WriteParamsAliasW, PutBlockAliasW1, BuildTablesAliasW, NULL },
+  { WriteParamsAliasW, PutBlockAliasW2, BuildTablesAliasW, NULL },
   { WriteParamsW, PutBlockW4, BuildTablesW, NULL },
+  { WriteParamsAliasW, PutBlockAliasW4, BuildTablesAliasW, NULL },
 
   { WriteParamsUnique, PutBlockUnique, BuildTablesUnique, NULL },
 };
 
-static int Encode(const uint8_t* in, size_t size,
-                  uint32_t counts[MAX_SYMBOLS],
-                  uint8_t** out, size_t* out_size, int log_tab_size,
-                  FSCCodingMethod method) {
-  int ok = 0;
-  FSCEncoder enc;
-  FSCBitWriter bw;
-
-  if (!FSCBitWriterInit(&bw, size >> 8)) return 0;
+// Normalizes the counts and builds the tables (if 'build' is true).
+static int PrepareEncoder(FSCEncoder* const enc, uint32_t counts[MAX_SYMBOLS],
+                          int build) {
+  uint8_t remap[MAX_SYMBOLS];
+  const int nb_used = CompactCounts(counts, remap);
 
-  if (!EncoderInit(&enc, counts, 0, log_tab_size, method)) {
+  if (!EncoderInit(enc, counts, nb_used, build)) {
     fprintf(stderr, "Error during EncoderInit() call\n");
-    goto end;
+    return 0;
   }
-  size_t val = size;
-  while (val) {
-    FSCWriteBits(&bw, 1, 1);
-    FSCWriteBits(&bw, val & 0xff, 8);
-    val >>= 8;
+  if (nb_used > 0) {
+    if (enc->unique_symbol_ >= 0) {
+      enc->unique_symbol_ = remap[enc->unique_symbol_];
+    } else {
+      enc->dense_ = 1;
+      memcpy(enc->remap_, remap, nb_used * sizeof(remap[0]));
+      if (build) RemapTables(enc);
+    }
   }
-  FSCWriteBits(&bw, 0, 1);
+  return 1;
+}
 
-  FSCWriteBits(&bw, enc.method_, 4);
-  if (!enc.methods_.write_params(&enc, counts, &bw)) {
+// Size, method and params.
+static int WriteStreamHeader(FSCEncoder* const enc, size_t size,
+                             const uint32_t counts[MAX_SYMBOLS],
+                             FSCBitWriter* const bw) {
+  if (!FSCBitWriterReserve(bw, MAX_HDR_SIZE)) return 0;
+  FSCWriteSize(bw, size);
+  FSCWriteBits(bw, enc->method_, 4);
+  if (!enc->methods_.write_params(enc, counts, bw)) {
     fprintf(stderr, "Error during WriteParams() call\n");
-    goto end;
+    return 0;
   }
-#ifdef SHOW_SIMULATION
-  SimulateCoding(&enc, counts, in, size, 1 << log_tab_size);
-#endif
+  return 1;
+}
 
-  FSCPutBlockFunc put_block = enc.methods_.put_block;
+static int PutBlocks(const FSCEncoder* const enc,
+                     const uint8_t* in, size_t size, FSCBitWriter* const bw) {
+  FSCPutBlockFunc put_block = enc->methods_.put_block;
   while (size > 0) {
     const int next = (size > BLOCK_SIZE) ? BLOCK_SIZE : size;
-    put_block(&enc, in, next, &bw);
+    if (!FSCBitWriterReserve(bw, BlockBound(next, enc->ctx_method_))) return 0;
+    put_block(enc, in, next, bw);
     in += next;
     size -= next;
   }
-  FSCBitWriterFlush(&bw);
-  ok = !bw.error_;
+  FSCBitWriterFlush(bw);
+  return !bw->error_;
+}
 
- end:
-  if (ok) {
-    *out = FSCBitWriterFinish(&bw);
-    *out_size = FSCBitWriterNumBytes(&bw);
-  } else {
+static int Encode(FSCEncoder* const enc, const uint8_t* in, size_t size,
+                  uint32_t counts[MAX_SYMBOLS], FSCBitWriter* const bw) {
+  if (!PrepareEncoder(enc, counts, 1) ||
+      !WriteStreamHeader(enc, size, counts, bw)) {
+    return 0;
+  }
+#ifdef SHOW_SIMULATION
+  SimulateCoding(enc, counts, in, size, 1 << enc->log_tab_size_);
+#endif
+  return PutBlocks(enc, in, size, bw);
+}
+
+// Clamps the precision for the word-based methods. Returns 0 upon error.
+static int CheckParams(int* const log_tab_size, FSCCodingMethod method) {
+  if (*log_tab_size < 1) return 0;
+  if (method >= CODING_METHOD_LAST) return 0;
+  if (method >= CODING_METHOD_16B) {
+    if (*log_tab_size < MIN_LOG_TAB_SIZE_W) *log_tab_size = MIN_LOG_TAB_SIZE_W;
+    if (*log_tab_size > MAX_LOG_TAB_SIZE) *log_tab_size = MAX_LOG_TAB_SIZE;
+  } else if (*log_tab_size > LOG_TAB_SIZE) {
+    fprintf(stderr, "!! log_tab_size: %d\n", *log_tab_size);
+    return 0;
+  }
+  return 1;
+}
+
+FSCEncoderCtx* FSCEncoderCtxNew(int log_tab_size, FSCCodingMethod method) {
+  FSCEncoder* const enc = (FSCEncoder*)FSCMalloc(sizeof(*enc));
+  if (enc == NULL) return NULL;
+  InitMem(enc, NULL, 0);
+  if (!FSCEncoderCtxReset(enc, log_tab_size, method)) {
+    FSCEncoderCtxDelete(enc);
+    return NULL;
+  }
+  return enc;
+}
+
+int FSCEncoderCtxReset(FSCEncoderCtx* ctx,
+                       int log_tab_size, FSCCodingMethod method) {
+  if (ctx == NULL || !CheckParams(&log_tab_size, method)) return 0;
+  ctx->ctx_log_tab_size_ = log_tab_size;
+  ctx->ctx_method_ = method;
+  return AllocTables(ctx);
+}
+
+void FSCEncoderCtxDelete(FSCEncoderCtx* ctx) {
+  if (ctx != NULL && ctx->own_mem_) FSCFree(ctx->mem_);
+  FSCFree(ctx);
+}
+
+int FSCEncodeWithCtx(FSCEncoderCtx* ctx, const uint8_t* in, size_t in_size,
+                     uint8_t** out, size_t* out_size) {
+  uint32_t counts[MAX_SYMBOLS];
+  FSCBitWriter bw;
+  if (ctx == NULL || out == NULL || out_size == NULL) return 0;
+  FSCCountSymbols(in, in_size, counts);
+  // Most inputs compress, so this usually avoids any reallocation.
+  if (!FSCBitWriterInit(&bw, in_size + MAX_HDR_SIZE)) return 0;
+  if (!Encode(ctx, in, in_size, counts, &bw)) {
     FSCBitWriterDestroy(&bw);
+    return 0;
   }
-  return ok;
+  *out = FSCBitWriterFinish(&bw);
+  *out_size = FSCBitWriterNumBytes(&bw);
+  return 1;
+}
+
+int FSCEncodeToBufferWithCtx(FSCEncoderCtx* ctx,
+                             const uint8_t* in, size_t in_size,
+                             uint8_t* out, size_t out_capacity,
+                             size_t* out_size) {
+  uint32_t counts[MAX_SYMBOLS];
+  FSCBitWriter bw;
+  if (ctx == NULL || out == NULL || out_size == NULL) return 0;
+  FSCCountSymbols(in, in_size, counts);
+  FSCBitWriterInitBuffer(&bw, out, out_capacity);
+  if (!Encode(ctx, in, in_size, counts, &bw)) return 0;
+  *out_size = FSCBitWriterNumBytes(&bw);
+  return 1;
 }
 
 int FSCEncode(const uint8_t* in, size_t in_size,
               uint8_t** out, size_t* out_size, int log_tab_size,
               FSCCodingMethod method) {
+  FSCEncoder enc;
+  int ok;
+  InitMem(&enc, NULL, 0);
+  ok = FSCEncoderCtxReset(&enc, log_tab_size, method) &&
+       FSCEncodeWithCtx(&enc, in, in_size, out, out_size);
+  FSCFree(enc.mem_);
+  return ok;
+}
+
+size_t FSCCompressBound(size_t in_size, FSCCodingMethod method) {
+  const size_t nb_blocks = (in_size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+  if (method >= CODING_METHOD_LAST) method = CODING_METHOD_16B;
+  return MAX_HDR_SIZE + BlockBound(in_size, method) + nb_blocks * BLOCK_SLACK
+       + sizeof(fsc_val_t);   // room for the bit-writer's word stores
+}
+
+int FSCEncodeToBuffer(const uint8_t* in, size_t in_size,
+                      uint8_t* out, size_t out_capacity, size_t* out_size,
+                      int log_tab_size, FSCCodingMethod method) {
+  FSCEncoder enc;
+  int ok;
+  InitMem(&enc, NULL, 0);
+  ok = FSCEncoderCtxReset(&enc, log_tab_size, method) &&
+       FSCEncodeToBufferWithCtx(&enc, in, in_size, out, out_capacity,
+                                out_size);
+  FSCFree(enc.mem_);
+  return ok;
+}
+
+//------------------------------------------------------------------------------
+// Workspace: the encoder and its tables, 16b-aligned.
+
+size_t FSCEncoderWorkspaceSize(FSCCodingMethod method, int log_tab_size) {
+  FSCEncoder enc;
+  if (!CheckParams(&log_tab_size, method)) return 0;
+  enc.ctx_log_tab_size_ = log_tab_size;
+  enc.ctx_method_ = method;
+  return 15 + ALIGN_SIZE(sizeof(enc)) + SetTables(&enc, NULL);
+}
+
+int FSCEncodeWithWorkspace(const uint8_t* in, size_t in_size,
+                           uint8_t* out, size_t out_capacity,
+                           size_t* out_size,
+                           int log_tab_size, FSCCodingMethod method,
+                           void* workspace, size_t workspace_size) {
+  uint8_t* const start =
+      (uint8_t*)(((uintptr_t)workspace + 15) & ~(uintptr_t)15);
+  const size_t used = (start - (uint8_t*)workspace) +
+                      ALIGN_SIZE(sizeof(FSCEncoder));
+  FSCEncoder* const enc = (FSCEncoder*)start;
+  if (workspace == NULL || workspace_size < used) return 0;
+  InitMem(enc, start + ALIGN_SIZE(sizeof(*enc)), workspace_size - used);
+  return FSCEncoderCtxReset(enc, log_tab_size, method) &&
+         FSCEncodeToBufferWithCtx(enc, in, in_size, out, out_capacity,
+                                  out_size);
+}
+
+//------------------------------------------------------------------------------
+// Size estimation
+//
+// The header is written for real, into a stack buffer. The payload is costed
+// from the normalized counts, without building any table: each symbol costs
+// log2(tab_size / freq) bits, in 16b fixed-point, and each block adds its
+// initial state (tANS) or the final flush of its states (rANS).
+
+#define COST_BITS 16
+
+// log2(v) in COST_BITS fixed-point, for v > 0.
+static uint32_t Log2Fix(uint32_t v) {
+  uint64_t x;   // mantissa in [1, 2), with 30 fractional bits
+  uint32_t log;
+  int b = 0, i;
+  while (v >> (b + 1)) ++b;
+  x = ((uint64_t)v << 30) >> b;
+  log = (uint32_t)b << COST_BITS;
+  for (i = COST_BITS - 1; i >= 0; --i) {   // one bit per squaring
+    x = (x * x) >> 30;
+    if (x >= (2ull << 30)) {
+      x >>= 1;
+      log |= 1u << i;
+    }
+  }
+  return log;
+}
+
+// Average overhead of each rANS state per block, in bits: the 32 bits of
+// the final flush, minus the half-filled state left unused. The W1 and W2
+// kernels pre-load the first bytes into their states, which saves a byte.
+static int StatesOverheadBits(FSCCodingMethod method) {
+  switch (method) {
+    case CODING_METHOD_16B: return 16;
+    case CODING_METHOD_16B_2X: return 2 * 16;
+    case CODING_METHOD_16B_ALIAS: return 24;
+    case CODING_METHOD_16B_ALIAS_2X: return 2 * 24;
+    default: return 4 * 24;
+  }
+}
+
+size_t FSCEstimateSizeFromCounts(const uint32_t counts[MAX_SYMBOLS],
+                                 size_t in_size, FSCCodingMethod method,
+                                 int log_tab_size) {
+  uint32_t norm[MAX_SYMBOLS];
+  uint8_t hdr[MAX_HDR_SIZE + sizeof(fsc_val_t)];
+  const size_t nb_blocks = (in_size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+  uint64_t bits = 0;   // payload, in COST_BITS fixed-point
+  size_t hdr_bits;
+  FSCEncoder enc;
+  FSCBitWriter bw;
+  int s;
+  if (counts == NULL || in_size == 0) return 0;
+  if (!CheckParams(&log_tab_size, method)) return 0;
+  enc.ctx_log_tab_size_ = log_tab_size;
+  enc.ctx_method_ = method;
+  memcpy(norm, counts, sizeof(norm));
+  if (!PrepareEncoder(&enc, norm, 0)) return 0;
+
+  FSCBitWriterInitBuffer(&bw, hdr, sizeof(hdr));
+  if (!WriteStreamHeader(&enc, in_size, norm, &bw)) return 0;
+  hdr_bits = 8 * FSCBitWriterNumBytes(&bw) + bw.used_;
+  if (enc.method_ == CODING_METHOD_UNIQUE) return (hdr_bits + 7) >> 3;
+
+  for (s = 0; s < enc.max_symbol_; ++s) {
+    const int sym = enc.dense_ ? enc.remap_[s] : s;
+    if (norm[s] > 0) {
+      const uint32_t cost =
+          ((uint32_t)log_tab_size << COST_BITS) - Log2Fix(norm[s]);
+      bits += (uint64_t)counts[sym] * cost;
+    }
+  }
+  bits = (bits + (1u << COST_BITS) - 1) >> COST_BITS;
+  if (enc.method_ < CODING_METHOD_16B) {   // one bit-stream after the header
+    bits += nb_blocks * log_tab_size;
+    return (size_t)((hdr_bits + bits + 7) >> 3);
+  }
+  // byte-aligned header, then 16b words
+  bits += nb_blocks * StatesOverheadBits(enc.method_);
+  return ((hdr_bits + 7) >> 3) + 2 * (size_t)((bits + 15) >> 4);
+}
+
+size_t FSCEstimateSize(const uint8_t* in, size_t in_size,
+                       FSCCodingMethod method, int log_tab_size) {
   uint32_t counts[MAX_SYMBOLS];
+  if (in == NULL) return 0;
   FSCCountSymbols(in, in_size, counts);
-  return Encode(in, in_size, counts, out, out_size, log_tab_size, method);
+  return FSCEstimateSizeFromCounts(counts, in_size, method, log_tab_size);
+}
+
+//------------------------------------------------------------------------------
+// Symbol costs
+//
+// With rANS, coding a symbol of frequency 'freq' adds log2(tab_size / freq)
+// bits to the state, up to rounding. With tANS, it costs nb_bits_ bits, plus
+// one when the state is at or above wrap_: the cost depends on the states'
+// distribution, which depends on the spread table. From any state in
+// [n << nb, (n + 1) << nb), symbol s (of probability freq / tab_size) leads
+// to the position of its n-th slot. Starting from the usual 1/x density, a
+// few steps of this chain give the actual distribution, which is far from
+// 1/x for poorly spread tables.
+
+#define COST_ITERATIONS 4
+
+// The densities are cumulated in 32 bits, each state weighing at most
+// 1 << COST_SCALE: the sums stay below 1 << (LOG_TAB_SIZE + COST_SCALE).
+#define COST_SCALE 15
+
+// Resets the walk over the slots: the states leading to the n-th slot of
+// symbol s are [next[s] << nb[s], (next[s] + 1) << nb[s]), minus tab_size.
+static void InitCostWalk(const uint32_t counts[], int max_symbol,
+                         int log_tab_size, uint32_t next[], int nb[]) {
+  int s;
+  for (s = 0; s < max_symbol; ++s) {
+    next[s] = counts[s];
+    nb[s] = (counts[s] > 0) ? log_tab_size + 1 - Log2Ceil(counts[s] + 1) : 0;
+  }
+}
+
+// Only uses the stack (~144k at most), so that it can be called per block.
+static int GetTANSCosts(const uint32_t counts[], int max_symbol,
+                        int log_tab_size, FSCBuildSpreadTableFunc spread,
+                        uint16_t cost_q8[]) {
+  const uint32_t tab_size = 1u << log_tab_size;
+  uint32_t next[MAX_SYMBOLS];
+  int nb[MAX_SYMBOLS];   // log2 of the length of the range for next[]
+  uint8_t symbols[TAB_SIZE];
+  // cumulated probabilities of the states, before and after one step
+  uint32_t mem[2 * (TAB_SIZE + 1)];
+  uint32_t* cur = mem;
+  uint32_t* nxt = mem + tab_size + 1;
+  uint32_t pos;
+  int s, it;
+  if (log_tab_size > LOG_TAB_SIZE ||
+      !spread(max_symbol, counts, log_tab_size, symbols)) {
+    return 0;
+  }
+  cur[0] = 0;
+  for (pos = 0; pos < tab_size; ++pos) {
+    cur[pos + 1] = cur[pos] + (tab_size << COST_SCALE) / (tab_size + pos);
+  }
+  for (it = 0; it < COST_ITERATIONS; ++it) {
+    uint32_t* const tmp = cur;
+    InitCostWalk(counts, max_symbol, log_tab_size, next, nb);
+    nxt[0] = 0;
+    for (pos = 0; pos < tab_size; ++pos) {
+      const int sym = symbols[pos];
+      const uint32_t n = next[sym]++;
+      const uint32_t start = (n << nb[sym]) - tab_size;
+      const uint32_t end = start + (1u << nb[sym]);
+      if (((n + 1) << nb[sym]) == 2 * tab_size) --nb[sym];
+      nxt[pos + 1] = nxt[pos] + (uint32_t)(((uint64_t)counts[sym] *
+                                 (cur[end] - cur[start])) >> log_tab_size);
+    }
+    cur = nxt;
+    nxt = tmp;
+  }
+  for (s = 0; s < max_symbol; ++s) {
+    if (counts[s] > 0) {
+      const int nb_bits = log_tab_size - Log2Ceil(counts[s]);
+      const uint64_t wrap = (uint64_t)counts[s] << (1 + nb_bits);
+      const uint64_t total = cur[tab_size];
+      const uint64_t above =
+          (wrap < 2u * tab_size) ? total - cur[wrap - tab_size] : 0;
+      cost_q8[s] = (nb_bits << 8) + (((above << 8) + total / 2) / total);
+    }
+  }
+  return 1;
+}
+
+int FSCGetSymbolCosts(const uint32_t counts[MAX_SYMBOLS],
+                      FSCCodingMethod method, uint16_t cost_q8[MAX_SYMBOLS]) {
+  uint32_t dense[MAX_SYMBOLS];
+  uint8_t remap[MAX_SYMBOLS];
+  uint64_t total = 0;
+  int s, nb_used, log_tab_size = 0;
+  if (counts == NULL || cost_q8 == NULL) return 0;
+  for (s = 0; s < MAX_SYMBOLS; ++s) {
+    total += counts[s];
+    cost_q8[s] = 0xffff;
+  }
+  if (method >= CODING_METHOD_UNIQUE) return 0;
+  if (total == 1) {   // unique symbol: nothing is coded, whatever the method
+    for (s = 0; s < MAX_SYMBOLS; ++s) {
+      if (counts[s] > 0) cost_q8[s] = 0;
+    }
+    return 1;
+  }
+  while (log_tab_size <= MAX_LOG_TAB_SIZE && (1ull << log_tab_size) < total) {
+    ++log_tab_size;
+  }
+  if (total != (1ull << log_tab_size) ||
+      !CheckParams(&log_tab_size, method) ||
+      total != (1ull << log_tab_size)) {   // not normalized for the method
+    return 0;
+  }
+  if (method >= CODING_METHOD_16B) {
+    for (s = 0; s < MAX_SYMBOLS; ++s) {
+      if (counts[s] > 0) {
+        const uint32_t cost =
+            ((uint32_t)log_tab_size << COST_BITS) - Log2Fix(counts[s]);
+        cost_q8[s] = (cost + (1u << (COST_BITS - 9))) >> (COST_BITS - 8);
+      }
+    }
+    return 1;
+  }
+  // same (dense) alphabet as the encoder's tables
+  memcpy(dense, counts, sizeof(dense));
+  nb_used = CompactCounts(dense, remap);
+  if (nb_used == 0) {
+    return GetTANSCosts(counts, MAX_SYMBOLS, log_tab_size,
+                        kEncMethods[method].spread, cost_q8);
+  }
+  if (!GetTANSCosts(dense, nb_used, log_tab_size,
+                    kEncMethods[method].spread, cost_q8)) {
+    return 0;
+  }
+  for (s = nb_used - 1; s >= 0; --s) {   // remap[s] >= s
+    const uint16_t cost = cost_q8[s];
+    cost_q8[s] = 0xffff;
+    cost_q8[remap[s]] = cost;
+  }
+  return 1;
+}
+
+//------------------------------------------------------------------------------
+// Batch of records
+//
+// The records share one set of tables, stored in a regular header for their
+// total size. It is followed by the number of records and the bit-widths of
+// the index fields, then, byte-aligned, the index of (offset, size) of each
+// record, and the payload. Each record is coded as the blocks of a message
+// of its own, starting at its byte offset in the payload, so that it can be
+// decoded alone.
+
+static int NumBits(uint64_t v) {
+  int n = 0;
+  while (v) {
+    ++n;
+    v >>= 1;
+  }
+  return n;
+}
+
+static void WriteBitsWide(FSCBitWriter* const bw, uint64_t v, int nb) {
+  while (nb > 0) {
+    const int n = (nb > MAX_BITS) ? MAX_BITS : nb;
+    FSCWriteBits(bw, (uint32_t)(v & ((1u << n) - 1)), n);
+    v >>= n;
+    nb -= n;
+  }
+}
+
+int FSCEncodeBatch(const uint8_t* const records[], const size_t sizes[],
+                   size_t nb_records, uint8_t** out, size_t* out_size,
+                   int log_tab_size, FSCCodingMethod method) {
+  uint32_t counts[MAX_SYMBOLS] = { 0 };
+  size_t* offsets = NULL;
+  size_t total = 0, max_size = 0, n;
+  int size_bits, off_bits, s;
+  FSCEncoder enc;
+  FSCBitWriter payload, bw;
+  int ok = 0;
+  if (out == NULL || out_size == NULL) return 0;
+  if (nb_records > 0 && (records == NULL || sizes == NULL)) return 0;
+
+  for (n = 0; n < nb_records; ++n) {
+    uint32_t tmp[MAX_SYMBOLS];
+    if (records[n] == NULL && sizes[n] > 0) return 0;
+    FSCCountSymbols(records[n], sizes[n], tmp);
+    for (s = 0; s < MAX_SYMBOLS; ++s) counts[s] += tmp[s];
+    total += sizes[n];
+    if (sizes[n] > max_size) max_size = sizes[n];
+  }
+  if (total == 0) counts[0] = 1;   // any table will do
+
+  InitMem(&enc, NULL, 0);
+  if (!FSCEncoderCtxReset(&enc, log_tab_size, method) ||
+      !PrepareEncoder(&enc, counts, 1)) {
+    FSCFree(enc.mem_);
+    return 0;
+  }
+  offsets = (size_t*)FSCMalloc((nb_records + 1) * sizeof(*offsets));
+  if (offsets == NULL || !FSCBitWriterInit(&payload, total + MAX_HDR_SIZE)) {
+    FSCFree(offsets);
+    FSCFree(enc.mem_);
+    return 0;
+  }
+  for (n = 0; n < nb_records; ++n) {
+    offsets[n] = FSCBitWriterNumBytes(&payload);
+    if (!PutBlocks(&enc, records[n], sizes[n], &payload)) goto End;
+  }
+  offsets[nb_records] = FSCBitWriterNumBytes(&payload);
+
+  size_bits = NumBits(max_size);
+  off_bits = NumBits(offsets[nb_records]);
+  {
+    const size_t index_size =
+        (nb_records * (size_bits + off_bits) + 7) >> 3;
+    if (!FSCBitWriterInit(&bw, MAX_HDR_SIZE + index_size +
+                               offsets[nb_records])) {
+      goto End;
+    }
+    if (!WriteStreamHeader(&enc, total, counts, &bw)) goto Error;
+    FSCWriteSize(&bw, nb_records);
+    FSCWriteBits(&bw, size_bits, 6);
+    FSCWriteBits(&bw, off_bits, 6);
+    FSCBitWriterFlush(&bw);
+    if (!FSCBitWriterReserve(&bw, index_size + sizeof(uint64_t))) goto Error;
+    for (n = 0; n < nb_records; ++n) {
+      WriteBitsWide(&bw, offsets[n], off_bits);
+      WriteBitsWide(&bw, sizes[n], size_bits);
+    }
+    FSCBitWriterFlush(&bw);
+    if (!FSCAppend(&bw, payload.buf_, offsets[nb_records])) {
+      goto Error;
+    }
+    FSCBitWriterFlush(&bw);
+    if (bw.error_) goto Error;
+    *out = FSCBitWriterFinish(&bw);
+    *out_size = FSCBitWriterNumBytes(&bw);
+    ok = 1;
+    goto End;
+  }
+
+ Error:
+  FSCBitWriterDestroy(&bw);
+ End:
+  FSCBitWriterDestroy(&payload);
+  FSCFree(offsets);
+  FSCFree(enc.mem_);
+  return ok;
+}
+
+//------------------------------------------------------------------------------
+// Clustered tables
+//
+// The input is cut into blocks of BLOCK_SIZE symbols, whose histograms are
+// clustered into at most 'max_tables' tables. The first table is built from
+// the whole input. Then, as long as it pays for a header, a new table is
+// seeded with the block worst coded by the current tables (compared to its
+// entropy). After each seed, the blocks are assigned to the table coding
+// them cheapest (as given by FSCGetSymbolCosts()), and the tables are rebuilt
+// from their blocks. A few more such rounds refine the clusters.
+//
+// Layout: the total size and the number of tables, then the headers of the
+// tables (each for the size of its blocks), the table ID of each block, and
+// the blocks, each coded with its table, as the blocks of one message.
+
+#define CLUSTER_ITERATIONS 4   // refinement rounds, after the seeding
+
+typedef struct {
+  uint32_t counts_[MAX_SYMBOLS];
+  size_t size_;
+  uint16_t costs_[MAX_SYMBOLS];   // in 1/256th of a bit, see BlockCost()
+  size_t hdr_bits_;
+} Cluster;
+
+static size_t BlockSize(size_t in_size, size_t b) {
+  const size_t start = b * BLOCK_SIZE;
+  return (in_size - start > BLOCK_SIZE) ? BLOCK_SIZE : in_size - start;
+}
+
+// Normalizes the counts as the encoder would, and gets the cost of each
+// symbol, as well as the header's size, with the resulting table. A symbol
+// missing from the table costs what it would once added to it with the
+// lowest frequency, since tables are rebuilt from the blocks using them.
+static int GetTableCosts(const uint32_t counts[MAX_SYMBOLS], size_t size,
+                         int log_tab_size, FSCCodingMethod method,
+                         uint16_t costs[MAX_SYMBOLS], size_t* const hdr_bits) {
+  uint32_t norm[MAX_SYMBOLS], full[MAX_SYMBOLS];
+  uint8_t hdr[MAX_HDR_SIZE + sizeof(fsc_val_t)];
+  FSCEncoder enc;
+  FSCBitWriter bw;
+  int s;
+  enc.ctx_log_tab_size_ = log_tab_size;
+  enc.ctx_method_ = method;
+  memcpy(norm, counts, sizeof(norm));
+  if (!PrepareEncoder(&enc, norm, 0)) return 0;
+  FSCBitWriterInitBuffer(&bw, hdr, sizeof(hdr));
+  if (!WriteStreamHeader(&enc, size, norm, &bw)) return 0;
+  *hdr_bits = 8 * FSCBitWriterNumBytes(&bw) + bw.used_;
+  if (enc.method_ == CODING_METHOD_UNIQUE) {
+    for (s = 0; s < MAX_SYMBOLS; ++s) costs[s] = (counts[s] > 0) ? 0 : 0xffff;
+  } else {
+    memset(full, 0, sizeof(full));
+    for (s = 0; s < enc.max_symbol_; ++s) {
+      full[enc.dense_ ? enc.remap_[s] : s] = norm[s];
+    }
+    if (!FSCGetSymbolCosts(full, method, costs)) return 0;
+  }
+  for (s = 0; s < MAX_SYMBOLS; ++s) {
+    if (costs[s] == 0xffff) costs[s] = log_tab_size << 8;
+  }
+  return 1;
+}
+
+// Cost of a block with a table, in 1/256th of a bit.
+static uint64_t BlockCost(const uint32_t counts[MAX_SYMBOLS],
+                          const uint16_t costs[MAX_SYMBOLS]) {
+  uint64_t cost = 0;
+  int s;
+  for (s = 0; s < MAX_SYMBOLS; ++s) cost += (uint64_t)counts[s] * costs[s];
+  return cost;
+}
+
+// Same unit, for the ideal table of the block.
+static uint64_t BlockEntropy(const uint32_t counts[MAX_SYMBOLS], size_t size) {
+  const uint32_t log_size = Log2Fix((uint32_t)size);
+  uint64_t cost = 0;
+  int s;
+  for (s = 0; s < MAX_SYMBOLS; ++s) {
+    if (counts[s] > 0) {
+      cost += (uint64_t)counts[s] * (log_size - Log2Fix(counts[s]));
+    }
+  }
+  return cost >> (COST_BITS - 8);
+}
+
+// Assigns each block to its cheapest table, and stores its cost in costs[].
+// Returns the number of blocks which changed table.
+static size_t AssignBlocks(const uint32_t (*blocks)[MAX_SYMBOLS],
+                           size_t nb_blocks, const Cluster clusters[],
+                           int nb_clusters, uint8_t ids[], uint64_t costs[]) {
+  size_t b, nb_moves = 0;
+  for (b = 0; b < nb_blocks; ++b) {
+    uint64_t best_cost = BlockCost(blocks[b], clusters[ids[b]].costs_);
+    int k, best = ids[b];
+    for (k = 0; k < nb_clusters; ++k) {
+      const uint64_t cost = BlockCost(blocks[b], clusters[k].costs_);
+      if (cost < best_cost) {
+        best_cost = cost;
+        best = k;
+      }
+    }
+    nb_moves += (best != ids[b]);
+    ids[b] = best;
+    costs[b] = best_cost;
+  }
+  return nb_moves;
+}
+
+// Rebuilds the tables from their blocks, dropping the unused ones. Returns
+// the new number of tables, or 0 upon error.
+static int RebuildClusters(const uint32_t (*blocks)[MAX_SYMBOLS],
+                           size_t nb_blocks, size_t in_size,
+                           Cluster clusters[], int nb_clusters, uint8_t ids[],
+                           int log_tab_size, FSCCodingMethod method) {
+  uint8_t remap[FSC_MAX_TABLES];
+  size_t b;
+  int k, s, nb = 0;
+  for (k = 0; k < nb_clusters; ++k) {
+    memset(clusters[k].counts_, 0, sizeof(clusters[k].counts_));
+    clusters[k].size_ = 0;
+  }
+  for (b = 0; b < nb_blocks; ++b) {
+    Cluster* const c = &clusters[ids[b]];
+    for (s = 0; s < MAX_SYMBOLS; ++s) c->counts_[s] += blocks[b][s];
+    c->size_ += BlockSize(in_size, b);
+  }
+  for (k = 0; k < nb_clusters; ++k) {
+    if (clusters[k].size_ == 0) continue;
+    if (nb != k) clusters[nb] = clusters[k];
+    if (!GetTableCosts(clusters[nb].counts_, clusters[nb].size_,
+                       log_tab_size, method, clusters[nb].costs_,
+                       &clusters[nb].hdr_bits_)) {
+      return 0;
+    }
+    remap[k] = nb++;
+  }
+  for (b = 0; b < nb_blocks; ++b) ids[b] = remap[ids[b]];
+  return nb;
+}
+
+// Returns the number of tables, or 0 upon error.
+static int ClusterBlocks(const uint32_t (*blocks)[MAX_SYMBOLS],
+                         size_t nb_blocks, size_t in_size, int max_tables,
+                         int log_tab_size, FSCCodingMethod method,
+                         Cluster clusters[], uint8_t ids[]) {
+  uint64_t* const costs =
+      (uint64_t*)FSCMalloc(2 * (nb_blocks + 1) * sizeof(*costs));
+  uint64_t* const entropies = costs + nb_blocks + 1;
+  size_t b;
+  int nb = 1, i;
+  if (costs == NULL) return 0;
+  for (b = 0; b < nb_blocks; ++b) {
+    entropies[b] = BlockEntropy(blocks[b], BlockSize(in_size, b));
+  }
+  memset(ids, 0, nb_blocks * sizeof(*ids));
+  nb = RebuildClusters(blocks, nb_blocks, in_size, clusters, nb, ids,
+                       log_tab_size, method);
+  if (nb == 0) goto End;
+  AssignBlocks(blocks, nb_blocks, clusters, nb, ids, costs);
+
+  for (i = 1; i < max_tables && nb < max_tables; ++i) {
+    // seed a new table with the block wasting the most bits, unless it
+    // already has a table of its own
+    uint64_t best_waste = 0;
+    size_t best = 0;
+    for (b = 0; b < nb_blocks; ++b) {
+      const uint64_t waste =
+          (costs[b] > entropies[b]) ? costs[b] - entropies[b] : 0;
+      if (waste > best_waste &&
+          clusters[ids[b]].size_ > BlockSize(in_size, b)) {
+        best_waste = waste;
+        best = b;
+      }
+    }
+    if (best_waste == 0) break;
+    if (!GetTableCosts(blocks[best], BlockSize(in_size, best),
+                       log_tab_size, method, clusters[nb].costs_,
+                       &clusters[nb].hdr_bits_)) {
+      nb = 0;
+      goto End;
+    }
+    if (best_waste <= ((uint64_t)clusters[nb].hdr_bits_ << 8)) break;
+    ids[best] = nb++;
+    nb = RebuildClusters(blocks, nb_blocks, in_size, clusters, nb, ids,
+                         log_tab_size, method);
+    if (nb == 0) goto End;
+    AssignBlocks(blocks, nb_blocks, clusters, nb, ids, costs);
+  }
+  for (i = 0; ; ++i) {
+    nb = RebuildClusters(blocks, nb_blocks, in_size, clusters, nb, ids,
+                         log_tab_size, method);
+    if (nb == 0 || i == CLUSTER_ITERATIONS) break;
+    if (AssignBlocks(blocks, nb_blocks, clusters, nb, ids, costs) == 0) break;
+  }
+ End:
+  FSCFree(costs);
+  return nb;
+}
+
+int FSCEncodeClustered(const uint8_t* in, size_t in_size,
+                       uint8_t** out, size_t* out_size,
+                       int log_tab_size, FSCCodingMethod method,
+                       int max_tables) {
+  const size_t nb_blocks = (in_size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+  uint32_t (*blocks)[MAX_SYMBOLS] = NULL;
+  Cluster* clusters = NULL;
+  FSCEncoder* encs = NULL;
+  uint8_t* ids = NULL;
+  int nb_tables, id_bits, k, ok = 0;
+  size_t b;
+  FSCBitWriter bw;
+  if (out == NULL || out_size == NULL) return 0;
+  if (in == NULL && in_size > 0) return 0;
+  if (max_tables < 1 || max_tables > FSC_MAX_TABLES) return 0;
+  if (!CheckParams(&log_tab_size, method)) return 0;
+
+  blocks = (uint32_t (*)[MAX_SYMBOLS])FSCMalloc((nb_blocks + 1) *
+                                                sizeof(*blocks));
+  clusters = (Cluster*)FSCMalloc(max_tables * sizeof(*clusters));
+  encs = (FSCEncoder*)FSCMalloc(max_tables * sizeof(*encs));
+  ids = (uint8_t*)FSCMalloc(nb_blocks + 1);
+  if (blocks == NULL || clusters == NULL || encs == NULL || ids == NULL) {
+    goto End;
+  }
+  for (k = 0; k < max_tables; ++k) InitMem(&encs[k], NULL, 0);
+  for (b = 0; b < nb_blocks; ++b) {
+    FSCCountSymbols(in + b * BLOCK_SIZE, BlockSize(in_size, b), blocks[b]);
+  }
+  if (nb_blocks == 0) {   // any table will do
+    memset(clusters[0].counts_, 0, sizeof(clusters[0].counts_));
+    clusters[0].counts_[0] = 1;
+    clusters[0].size_ = 0;
+    nb_tables = 1;
+  } else {
+    nb_tables = ClusterBlocks((const uint32_t (*)[MAX_SYMBOLS])blocks,
+                              nb_blocks, in_size, max_tables,
+                              log_tab_size, method, clusters, ids);
+    if (nb_tables == 0) goto End;
+  }
+
+  if (!FSCBitWriterInit(&bw, in_size + MAX_HDR_SIZE)) goto End;
+  if (!FSCBitWriterReserve(&bw, MAX_HDR_SIZE)) goto Error;
+  FSCWriteSize(&bw, in_size);
+  FSCWriteBits(&bw, nb_tables - 1, 4);
+  for (k = 0; k < nb_tables; ++k) {
+    uint32_t norm[MAX_SYMBOLS];
+    memcpy(norm, clusters[k].counts_, sizeof(norm));
+    if (!FSCEncoderCtxReset(&encs[k], log_tab_size, method) ||
+        !PrepareEncoder(&encs[k], norm, 1) ||
+        !WriteStreamHeader(&encs[k], clusters[k].size_, norm, &bw)) {
+      goto Error;
+    }
+  }
+  id_bits = NumBits(nb_tables - 1);
+  if (!FSCBitWriterReserve(&bw, ((nb_blocks * id_bits + 7) >> 3) +
+                                sizeof(uint64_t))) {
+    goto Error;
+  }
+  for (b = 0; id_bits > 0 && b < nb_blocks; ++b) {
+    FSCWriteBits(&bw, ids[b], id_bits);
+  }
+  for (b = 0; b < nb_blocks; ++b) {
+    const FSCEncoder* const enc = &encs[ids[b]];
+    const int size = (int)BlockSize(in_size, b);
+    if (!FSCBitWriterReserve(&bw, BlockBound(size, enc->ctx_method_))) {
+      goto Error;
+    }
+    enc->methods_.put_block(enc, in + b * BLOCK_SIZE, size, &bw);
+  }
+  FSCBitWriterFlush(&bw);
+  if (bw.error_) goto Error;
+  *out = FSCBitWriterFinish(&bw);
+  *out_size = FSCBitWriterNumBytes(&bw);
+  ok = 1;
+  goto End;
+
+ Error:
+  FSCBitWriterDestroy(&bw);
+ End:
+  if (encs != NULL) {
+    for (k = 0; k < max_tables; ++k) FSCFree(encs[k].mem_);
+  }
+  FSCFree(ids);
+  FSCFree(encs);
+  FSCFree(clusters);
+  FSCFree(blocks);
+  return ok;
+}
+
+//------------------------------------------------------------------------------
+// Filters
+//
+// Format: total size, FSC_FILTERED_CODE in place of the method, the filter,
+// width - 1 and the trailing bytes. Then the stream header of each plane,
+// and the blocks of the planes, one row of 'width' blocks after the other,
+// so that the decoder can reverse the filter one row at a time.
+// The planes are transposed one row at a time too, just before coding: the
+// only full pass over the input, besides the coding, is the counting. The
+// predictors (delta or XOR with the previous element) are applied during the
+// transposition, the previous element being carried from one row to the next.
+
+// Element of 'width' bytes, as a little-endian integer.
+static FSC_INLINE uint64_t LoadElement(const uint8_t* const p, int width) {
+  uint64_t v = 0;
+  int i;
+  for (i = width - 1; i >= 0; --i) v = (v << 8) | p[i];
+  return v;
+}
+
+static FSC_INLINE uint64_t Predict(uint64_t x, uint64_t prev, int filter,
+                                   uint64_t mask) {
+  return (filter == FSC_FILTER_DELTA) ? (x - prev) & mask
+       : (filter == FSC_FILTER_XOR) ? x ^ prev : x;
+}
+
+#if defined(__SSE2__)
+// Splits the bytes of x and y by the parity of their index.
+static FSC_INLINE void Deinterleave(__m128i* const x, __m128i* const y) {
+  const __m128i mask = _mm_set1_epi16(0x00ff);
+  const __m128i even = _mm_packus_epi16(_mm_and_si128(*x, mask),
+                                        _mm_and_si128(*y, mask));
+  const __m128i odd = _mm_packus_epi16(_mm_srli_epi16(*x, 8),
+                                       _mm_srli_epi16(*y, 8));
+  *x = even;
+  *y = odd;
+}
+
+// Elements preceding those of x, the one before x[0] being the last of 'last'.
+static FSC_INLINE __m128i PrevElements(__m128i x, __m128i last, int width) {
+  switch (width) {
+    case 1: return _mm_or_si128(_mm_slli_si128(x, 1), _mm_srli_si128(last, 15));
+    case 2: return _mm_or_si128(_mm_slli_si128(x, 2), _mm_srli_si128(last, 14));
+    case 4: return _mm_or_si128(_mm_slli_si128(x, 4), _mm_srli_si128(last, 12));
+    default: return _mm_or_si128(_mm_slli_si128(x, 8), _mm_srli_si128(last, 8));
+  }
+}
+
+static FSC_INLINE __m128i PredictSSE2(__m128i x, __m128i prev, int filter,
+                                      int width) {
+  if (filter == FSC_FILTER_XOR) return _mm_xor_si128(x, prev);
+  switch (width) {
+    case 1: return _mm_sub_epi8(x, prev);
+    case 2: return _mm_sub_epi16(x, prev);
+    case 4: return _mm_sub_epi32(x, prev);
+    default: return _mm_sub_epi64(x, prev);
+  }
+}
+
+// 16 elements at a time, for a width of 1, 2, 4 or 8. Each round sorts the
+// bytes by one more bit of their index in the element.
+static int ShuffleRowSSE2(const uint8_t* in, int size, int width, int filter,
+                          uint64_t* const prev, uint8_t* const planes) {
+  const int predict = (filter == FSC_FILTER_DELTA || filter == FSC_FILTER_XOR);
+  __m128i last = _mm_set1_epi64x((int64_t)(*prev << (64 - 8 * width)));
+  int e, i, k;
+  for (e = 0; e + 16 <= size; e += 16) {
+    __m128i v[FSC_MAX_FILTER_WIDTH], tmp[FSC_MAX_FILTER_WIDTH];
+    for (i = 0; i < width; ++i) {
+      v[i] = _mm_loadu_si128((const __m128i*)(in + e * width + 16 * i));
+    }
+    if (predict) {
+      for (i = 0; i < width; ++i) {
+        const __m128i x = v[i];
+        v[i] = PredictSSE2(x, PrevElements(x, last, width), filter, width);
+        last = x;
+      }
+    }
+    for (k = 1; k < width; k <<= 1) {
+      for (i = 0; i < width; i += 2) {
+        Deinterleave(&v[i], &v[i + 1]);
+        tmp[i >> 1] = v[i];
+        tmp[(width + i) >> 1] = v[i + 1];
+      }
+      memcpy(v, tmp, width * sizeof(v[0]));
+    }
+    for (i = 0; i < width; ++i) {
+      _mm_storeu_si128((__m128i*)(planes + i * BLOCK_SIZE + e), v[i]);
+    }
+  }
+  if (e > 0) *prev = LoadElement(in + (e - 1) * width, width);
+  return e;
+}
+#endif   // __SSE2__
+
+// Transposes 'size' elements into the 'width' planes, BLOCK_SIZE apart,
+// after prediction from the previous element (*prev, updated).
+static void ShuffleRow(const uint8_t* in, int size, int width, int filter,
+                       uint64_t* const prev, uint8_t* const planes) {
+  const uint64_t mask = (width == 8) ? ~(uint64_t)0
+                                     : ((uint64_t)1 << (8 * width)) - 1;
+  int e = 0, i;
+#if defined(__SSE2__)
+  if (width == 1 || width == 2 || width == 4 || width == 8) {
+    e = ShuffleRowSSE2(in, size, width, filter, prev, planes);
+  }
+#endif
+  for (; e < size; ++e) {
+    const uint64_t x = LoadElement(in + e * width, width);
+    const uint64_t r = Predict(x, *prev, filter, mask);
+    for (i = 0; i < width; ++i) {
+      planes[i * BLOCK_SIZE + e] = (uint8_t)(r >> (8 * i));
+    }
+    *prev = x;
+  }
+}
+
+int FSCEncodeFiltered(const uint8_t* in, size_t in_size,
+                      uint8_t** out, size_t* out_size,
+                      int log_tab_size, FSCCodingMethod method,
+                      FSCFilter filter, int width) {
+  uint32_t (*counts)[MAX_SYMBOLS] = NULL;
+  FSCEncoder* encs = NULL;
+  uint8_t* planes = NULL;
+  size_t nb_elements, n, e;
+  uint64_t prev = 0;
+  int k, ok = 0;
+  FSCBitWriter bw;
+  if (out == NULL || out_size == NULL) return 0;
+  if (in == NULL && in_size > 0) return 0;
+  if (filter >= FSC_FILTER_LAST) return 0;
+  if (width < 1 || width > FSC_MAX_FILTER_WIDTH) return 0;
+  if (!CheckParams(&log_tab_size, method)) return 0;
+  if (filter == FSC_FILTER_NONE) width = 1;
+  nb_elements = in_size / width;
+
+  counts = (uint32_t (*)[MAX_SYMBOLS])FSCMalloc(width * sizeof(*counts));
+  encs = (FSCEncoder*)FSCMalloc(width * sizeof(*encs));
+  planes = (uint8_t*)FSCMalloc(width * BLOCK_SIZE);
+  if (counts == NULL || encs == NULL || planes == NULL) goto End;
+  for (k = 0; k < width; ++k) InitMem(&encs[k], NULL, 0);
+  memset(counts, 0, width * sizeof(*counts));
+  if (filter == FSC_FILTER_DELTA || filter == FSC_FILTER_XOR) {
+    const uint64_t mask = (width == 8) ? ~(uint64_t)0
+                                       : ((uint64_t)1 << (8 * width)) - 1;
+    uint64_t last = 0;   // 'prev' is only used by the coding pass below
+    for (e = 0; e < nb_elements; ++e) {
+      const uint64_t x = LoadElement(in + e * width, width);
+      const uint64_t r = Predict(x, last, filter, mask);
+      for (k = 0; k < width; ++k) ++counts[k][(uint8_t)(r >> (8 * k))];
+      last = x;
+    }
+  } else {
+    for (e = 0; e < nb_elements; ++e) {
+      for (k = 0; k < width; ++k) ++counts[k][in[e * width + k]];
+    }
+  }
+  if (nb_elements == 0) {   // any table will do
+    for (k = 0; k < width; ++k) counts[k][0] = 1;
+  }
+
+  if (!FSCBitWriterInit(&bw, in_size + MAX_HDR_SIZE)) goto End;
+  if (!FSCBitWriterReserve(&bw, MAX_HDR_SIZE)) goto Error;
+  FSCWriteSize(&bw, in_size);
+  FSCWriteBits(&bw, FSC_FILTERED_CODE, 4);
+  FSCWriteBits(&bw, filter, 4);
+  FSCWriteBits(&bw, width - 1, 3);
+  for (n = nb_elements * width; n < in_size; ++n) FSCWriteBits(&bw, in[n], 8);
+  for (k = 0; k < width; ++k) {
+    if (!FSCEncoderCtxReset(&encs[k], log_tab_size, method) ||
+        !PrepareEncoder(&encs[k], counts[k], 1) ||
+        !WriteStreamHeader(&encs[k], nb_elements, counts[k], &bw)) {
+      goto Error;
+    }
+  }
+  for (e = 0; e < nb_elements; e += BLOCK_SIZE) {
+    const int size = (int)BlockSize(nb_elements, e / BLOCK_SIZE);
+    ShuffleRow(in + e * width, size, width, filter, &prev, planes);
+    for (k = 0; k < width; ++k) {
+      const FSCEncoder* const enc = &encs[k];
+      if (!FSCBitWriterReserve(&bw, BlockBound(size, enc->ctx_method_))) {
+        goto Error;
+      }
+      enc->methods_.put_block(enc, planes + k * BLOCK_SIZE, size, &bw);
+    }
+  }
+  FSCBitWriterFlush(&bw);
+  if (bw.error_) goto Error;
+  *out = FSCBitWriterFinish(&bw);
+  *out_size = FSCBitWriterNumBytes(&bw);
+  ok = 1;
+  goto End;
+
+ Error:
+  FSCBitWriterDestroy(&bw);
+ End:
+  if (encs != NULL) {
+    for (k = 0; k < width; ++k) FSCFree(encs[k].mem_);
+  }
+  FSCFree(planes);
+  FSCFree(encs);
+  FSCFree(counts);
+  return ok;
+}
+
+//------------------------------------------------------------------------------
+// Packed symbols
+
+static int PackedBitsCode(int bits_per_symbol) {
+  switch (bits_per_symbol) {
+    case 1: return 0;
+    case 2: return 1;
+    case 4: return 2;
+    case 8: return 3;
+    default: return -1;
+  }
+}
+
+int FSCEncodePacked(const uint8_t* in, size_t nb_symbols, int bits_per_symbol,
+                    uint8_t** out, size_t* out_size,
+                    int log_tab_size, FSCCodingMethod method) {
+  const int code = PackedBitsCode(bits_per_symbol);
+  if (code < 0 || out == NULL || out_size == NULL) return 0;
+  const int syms_per_byte = 8 / bits_per_symbol;
+  const size_t in_size = (nb_symbols + syms_per_byte - 1) / syms_per_byte;
+  const int pad = (int)(in_size * syms_per_byte - nb_symbols);
+  const int last_mask = (1 << ((syms_per_byte - pad) * bits_per_symbol)) - 1;
+  uint32_t counts[MAX_SYMBOLS];
+  uint8_t* clean = NULL;
+  FSCEncoder enc;
+  FSCBitWriter bw;
+  InitMem(&enc, NULL, 0);
+  if (pad > 0 && (in[in_size - 1] & ~last_mask)) {
+    // the unused bits are garbage: code a copy with them cleared
+    clean = (uint8_t*)FSCMalloc(in_size);
+    if (clean == NULL) goto ErrorCtx;
+    memcpy(clean, in, in_size);
+    clean[in_size - 1] &= last_mask;
+    in = clean;
+  }
+  if (!FSCEncoderCtxReset(&enc, log_tab_size, method)) goto ErrorCtx;
+  FSCCountSymbols(in, in_size, counts);
+  if (!FSCBitWriterInit(&bw, in_size + MAX_HDR_SIZE)) goto ErrorCtx;
+  // One byte in front of the regular stream: 2 bits for bits_per_symbol,
+  // 3 bits for the number of unused symbols in the last byte.
+  if (!FSCBitWriterReserve(&bw, 1)) goto Error;
+  FSCWriteBits(&bw, code | (pad << 2), 8);
+  if (!Encode(&enc, in, in_size, counts, &bw)) goto Error;
+  FSCFree(enc.mem_);
+  FSCFree(clean);
+  *out = FSCBitWriterFinish(&bw);
+  *out_size = FSCBitWriterNumBytes(&bw);
+  return 1;
+
+ Error:
+  FSCBitWriterDestroy(&bw);
+ ErrorCtx:
+  FSCFree(enc.mem_);
+  FSCFree(clean);
+  return 0;
 }
 
 // -----------------------------------------------------------------------------
@@ -0,0 +1,249 @@
+//Copyright 2014 The FSC Authors. All Rights Reserved.
+//
+//Licensed under the Apache License, Version 2.0 (the "License");
+//you may not use this file except in compliance with the License.
+//You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+//    Unless required by applicable law or agreed to in writing, software
+//    distributed under the License is distributed on an "AS IS" BASIS,
+//    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//    See the License for the specific language governing permissions and
+//    limitations under the License.
+//------------------------------------------------------------------------------
+//
+// Coding of 32-bit and 64-bit integers
+//
+// Each value v is split into a bucket b (its bit-length: 0 for v = 0, and
+// 1 + log2(v) otherwise) and the b - 1 bits below the leading one. Buckets
+// are entropy-coded with FSCEncode(), the extra bits are written raw.
+// This is the same scheme as for the counts in the header.
+//
+// Author: Skal (pascal.massimino@gmail.com)
+
+#include "./fsc.h"
+#include <stdlib.h>
+#include <string.h>
+
+#include "./bits.h"
+
+
+//------------------------------------------------------------------------------
+
+static int BitLength(uint64_t v) {
+#if defined(__GNUC__)
+  return v ? 64 - __builtin_clzll(v) : 0;
+#else
+  int b = 0;
+  while (v) {
+    ++b;
+    v >>= 1;
+  }
+  return b;
+#endif
+}
+
+//------------------------------------------------------------------------------
+// Encoding
+//
+// Format: size, 1 bit for 64-bit values, then the size of the coded buckets
+// followed by their bytes, and the extra bits.
+
+static int EncodeInts(const uint32_t* in32, const uint64_t* in64,
+                      size_t in_size, uint8_t** out, size_t* out_size,
+                      int log_tab_size, FSCCodingMethod method) {
+  uint8_t* buckets = NULL;
+  uint8_t* tmp = NULL;
+  size_t tmp_size = 0, n;
+  uint64_t nb_bits = 0;   // total number of extra bits
+  FSCBitWriter bw;
+  if (out == NULL || out_size == NULL) return 0;
+  if (in32 == NULL && in64 == NULL && in_size > 0) return 0;
+
+  buckets = (uint8_t*)FSCMalloc(in_size + 1);
+  if (buckets == NULL) return 0;
+  for (n = 0; n < in_size; ++n) {
+    buckets[n] = BitLength(in64 ? in64[n] : in32[n]);
+    if (buckets[n] > 1) nb_bits += buckets[n] - 1;
+  }
+  if (in_size > 0 &&
+      !FSCEncode(buckets, in_size, &tmp, &tmp_size, log_tab_size, method)) {
+    goto Error;
+  }
+  if (!FSCBitWriterInit(&bw, tmp_size + (nb_bits >> 3) + MAX_HDR_SIZE)) {
+    goto Error;
+  }
+  if (!FSCBitWriterReserve(&bw, MAX_HDR_SIZE)) goto ErrorBW;
+  FSCWriteSize(&bw, in_size);
+  FSCWriteBits(&bw, (in64 != NULL), 1);
+  if (in_size > 0) {
+    FSCWriteSize(&bw, tmp_size);
+    if (!FSCAppend(&bw, tmp, tmp_size)) goto ErrorBW;
+  }
+  if (nb_bits > 0) {
+    // the extra bits are accumulated in 'bits' and stored by whole words
+    const size_t len = (size_t)((nb_bits + 7) >> 3);
+    uint8_t* const dst = FSCBitWriterGetBuffer(&bw, len + sizeof(uint64_t));
+    uint64_t bits = 0;
+    size_t pos = 0;
+    int used = 0;
+    if (dst == NULL) goto ErrorBW;
+    for (n = 0; n < in_size; ++n) {
+      const int b = buckets[n] - 1;
+      uint64_t v;
+      if (b <= 0) continue;
+      v = (in64 ? in64[n] : in32[n]) & ((1ull << b) - 1);
+      bits |= v << used;
+      used += b;
+      if (used >= 64) {
+        const uint64_t w = htole64(bits);
+        memcpy(dst + pos, &w, sizeof(w));
+        pos += sizeof(w);
+        used -= 64;
+        bits = (used > 0) ? v >> (b - used) : 0;
+      }
+    }
+    bits = htole64(bits);
+    memcpy(dst + pos, &bits, sizeof(bits));
+    FSCBitWriterAdvance(&bw, len);
+  }
+  FSCBitWriterFlush(&bw);
+  if (bw.error_) goto ErrorBW;
+  FSCFree(tmp);
+  FSCFree(buckets);
+  *out = FSCBitWriterFinish(&bw);
+  *out_size = FSCBitWriterNumBytes(&bw);
+  return 1;
+
+ ErrorBW:
+  FSCBitWriterDestroy(&bw);
+ Error:
+  FSCFree(tmp);
+  FSCFree(buckets);
+  return 0;
+}
+
+int FSCEncodeU32(const uint32_t* in, size_t in_size,
+                 uint8_t** out, size_t* out_size,
+                 int log_tab_size, FSCCodingMethod method) {
+  return EncodeInts(in, NULL, in_size, out, out_size, log_tab_size, method);
+}
+
+int FSCEncodeU64(const uint64_t* in, size_t in_size,
+                 uint8_t** out, size_t* out_size,
+                 int log_tab_size, FSCCodingMethod method) {
+  return EncodeInts(NULL, in, in_size, out, out_size, log_tab_size, method);
+}
+
+//------------------------------------------------------------------------------
+// Decoding
+
+// The extra bits are read with unaligned 64-bit loads at any bit position,
+// the total size being checked beforehand.
+typedef struct {
+  const uint8_t* buf_;
+  const uint8_t* end_;
+  uint64_t pos_;          // in bits
+} ExtraReader;
+
+static FSC_INLINE uint64_t Load64(const uint8_t* p, const uint8_t* end) {
+  uint64_t v = 0;
+  memcpy(&v, p, (end - p >= 8) ? 8 : (size_t)(end - p));
+  return le64toh(v);
+}
+
+static FSC_INLINE uint64_t ReadExtra(ExtraReader* const er, int nb) {
+  const uint64_t bits = Load64(er->buf_ + (er->pos_ >> 3), er->end_)
+                      >> (er->pos_ & 7);
+  er->pos_ += nb;
+  return bits & ((1ull << nb) - 1);
+}
+
+// Bucket b > 0 is the leading one plus b - 1 extra bits.
+static FSC_INLINE uint64_t ReadValue(ExtraReader* const er, int b) {
+  if (b <= 1) return b;
+  if (b - 1 > 56) {   // won't fit in one load
+    const uint64_t lo = ReadExtra(er, 32);
+    return (1ull << (b - 1)) | (ReadExtra(er, b - 33) << 32) | lo;
+  }
+  return (1ull << (b - 1)) | ReadExtra(er, b - 1);
+}
+
+static int DecodeInts(const uint8_t* in, size_t in_size, int is_64b,
+                      uint32_t** out32, uint64_t** out64, size_t* out_size) {
+  const int max_bucket = is_64b ? 64 : 32;
+  FSCBitReader br;
+  ExtraReader er;
+  uint64_t nb_bits = 0;   // total number of extra bits
+  uint8_t* buckets = NULL;
+  void* dst = NULL;
+  size_t size, buckets_size = 0, len, n;
+  const uint8_t* buf;
+  er.buf_ = er.end_ = in;
+  if (in == NULL || out_size == NULL) return 0;
+
+  FSCInitBitReader(&br, in, in_size);
+  size = FSCReadSize(&br);
+  if (FSCReadBits(&br, 1) != (uint32_t)is_64b) return 0;
+  if (size > ((size_t)-1) / sizeof(uint64_t) - 1) return 0;
+  if (size > 0) {
+    len = FSCReadSize(&br);
+    buf = FSCBitAlign(&br);
+    if (buf > FSCGetByteEnd(&br) ||
+        len > (size_t)(FSCGetByteEnd(&br) - buf)) {
+      return 0;
+    }
+    if (!FSCDecode(buf, len, &buckets, &buckets_size) ||
+        buckets_size != size) {
+      goto Error;
+    }
+    er.buf_ = buf + len;   // extra bits follow
+    er.end_ = FSCGetByteEnd(&br);
+    er.pos_ = 0;
+  } else if (br.eof_) {
+    return 0;
+  }
+
+  for (n = 0; n < size; ++n) {
+    if (buckets[n] > max_bucket) goto Error;
+    if (buckets[n] > 1) nb_bits += buckets[n] - 1;
+  }
+  if (nb_bits > 8 * (uint64_t)(er.end_ - er.buf_)) goto Error;
+  dst = FSCMalloc((size + 1) * (is_64b ? sizeof(uint64_t) : sizeof(uint32_t)));
+  if (dst == NULL) goto Error;
+  if (is_64b) {
+    uint64_t* const out = (uint64_t*)dst;
+    for (n = 0; n < size; ++n) out[n] = ReadValue(&er, buckets[n]);
+  } else {
+    uint32_t* const out = (uint32_t*)dst;
+    for (n = 0; n < size; ++n) out[n] = (uint32_t)ReadValue(&er, buckets[n]);
+  }
+  FSCFree(buckets);
+  if (is_64b) {
+    *out64 = (uint64_t*)dst;
+  } else {
+    *out32 = (uint32_t*)dst;
+  }
+  *out_size = size;
+  return 1;
+
+ Error:
+  FSCFree(dst);
+  FSCFree(buckets);
+  return 0;
+}
+
+int FSCDecodeU32(const uint8_t* in, size_t in_size,
+                 uint32_t** out, size_t* out_size) {
+  if (out == NULL) return 0;
+  return DecodeInts(in, in_size, 0, out, NULL, out_size);
+}
+
+int FSCDecodeU64(const uint8_t* in, size_t in_size,
+                 uint64_t** out, size_t* out_size) {
+  if (out == NULL) return 0;
+  return DecodeInts(in, in_size, 1, NULL, out, out_size);
+}
+
+//------------------------------------------------------------------------------
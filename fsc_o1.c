@@ -0,0 +1,743 @@
+//Copyright 2014 The FSC Authors. All Rights Reserved.
+//
+//Licensed under the Apache License, Version 2.0 (the "License");
+//you may not use this file except in compliance with the License.
+//You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+//    Unless required by applicable law or agreed to in writing, software
+//    distributed under the License is distributed on an "AS IS" BASIS,
+//    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//    See the License for the specific language governing permissions and
+//    limitations under the License.
+//------------------------------------------------------------------------------
+//
+// Context coding: order-1 and positional contexts
+//
+// Each symbol is coded with the table selected by its context, using the
+// same word coder as CODING_METHOD_16B_4X. The precision is capped to
+// FSC_O1_MAX_LOG_TAB_SIZE, so that the decoder's tables (a slot -> symbol
+// map and 1k of symbols each) stay in cache.
+// In order-1 mode, the context is the previous byte. Each of the 4 states
+// codes a quarter of the block, so that the decoder follows 4 independent
+// chains of contexts instead of a serial one. Table 0 is shared by the
+// contexts too rare to pay for a table of their own.
+// In positional mode, the context is the position modulo a stride.
+//
+// Author: Skal (pascal.massimino@gmail.com)
+
+#include "./fsc.h"
+#include <stdlib.h>
+#include <string.h>
+
+#include "./bits.h"
+
+#define PROBA_BITS MAX_LOG_TAB_SIZE
+typedef uint32_t ANSProba;
+typedef FSCStateW ANSStateW;
+#define RECIPROCAL_BITS 16
+#include "./divide.h"
+
+#define BINS_LOG_TAB_SIZE 10   // precision for the sub-coded bins
+#define BLOCK_SLACK_O1 16      // in words: 8 for the final states, + margin
+#define NB_BINS (MAX_SYMBOLS - 1)   // the last count of a table is implied
+
+//------------------------------------------------------------------------------
+// Counts
+//
+// The counts of all the tables are coded as for the wide alphabets: a bin
+// b = log2(count + 1) followed by b bits of residue, with all the bins
+// sub-coded together with FSCEncode().
+
+static int WriteCountsO1(FSCBitWriter* const bw, int nb_tables,
+                         const uint32_t (*counts)[MAX_SYMBOLS]) {
+  uint8_t* const bins = (uint8_t*)FSCMalloc(nb_tables * NB_BINS);
+  uint8_t* tmp = NULL;
+  size_t tmp_size = 0;
+  int t, i;
+  if (bins == NULL) return 0;
+  for (t = 0; t < nb_tables; ++t) {
+    for (i = 0; i < NB_BINS; ++i) {
+      bins[t * NB_BINS + i] = FSCLog2Floor(counts[t][i] + 1);
+    }
+  }
+  if (!FSCEncode(bins, nb_tables * NB_BINS, &tmp, &tmp_size,
+                 BINS_LOG_TAB_SIZE, CODING_METHOD_16B_4X)) {
+    goto Error;
+  }
+  if (!FSCBitWriterReserve(bw, MAX_HDR_SIZE)) goto Error;
+  FSCWriteSize(bw, tmp_size);
+  if (!FSCAppend(bw, tmp, tmp_size)) goto Error;
+  if (!FSCBitWriterReserve(bw, nb_tables * NB_BINS * 2 + 8)) goto Error;
+  for (t = 0; t < nb_tables; ++t) {
+    for (i = 0; i < NB_BINS; ++i) {
+      const int b = bins[t * NB_BINS + i];
+      if (b > 0) FSCWriteBits(bw, counts[t][i] + 1 - (1u << b), b);
+    }
+  }
+  FSCFree(tmp);
+  FSCFree(bins);
+  return !bw->error_;
+
+ Error:
+  FSCFree(tmp);
+  FSCFree(bins);
+  return 0;
+}
+
+static int ReadCountsO1(FSCBitReader* const br, uint32_t (*counts)[MAX_SYMBOLS],
+                        int nb_tables, int log_tab_size) {
+  const size_t len = FSCReadSize(br);
+  const uint8_t* buf;
+  uint8_t* bins = NULL;
+  size_t bins_size = 0;
+  int t, i;
+  if (br->eof_) return 0;
+  buf = FSCBitAlign(br);
+  if (buf > FSCGetByteEnd(br) || len > (size_t)(FSCGetByteEnd(br) - buf)) {
+    return 0;
+  }
+  if (!FSCDecode(buf, len, &bins, &bins_size) ||
+      bins_size != (size_t)nb_tables * NB_BINS) {
+    FSCFree(bins);
+    return 0;
+  }
+  FSCSetReadBufferPos(br, buf + len);
+  for (t = 0; t < nb_tables; ++t) {
+    uint32_t total = 1u << log_tab_size;
+    for (i = 0; i < NB_BINS; ++i) {
+      const int b = bins[t * NB_BINS + i];
+      if (b > log_tab_size) goto Error;
+      counts[t][i] = ((1u << b) | ((b > 0) ? FSCReadBits(br, b) : 0)) - 1;
+      if (counts[t][i] > total) goto Error;
+      total -= counts[t][i];
+    }
+    counts[t][NB_BINS] = total;   // remaining part
+  }
+  FSCFree(bins);
+  return !br->eof_;
+
+ Error:
+  FSCFree(bins);
+  return 0;
+}
+
+//------------------------------------------------------------------------------
+// Encoding
+
+typedef struct {
+  inv_t inv_;          // to divide by freq_
+  uint16_t start_;
+  uint16_t freq_;
+} EncSymbolO1;
+
+// Normalizes the counts of the tables and sets up their symbols.
+static int InitEncSymbolsO1(uint32_t (*counts)[MAX_SYMBOLS], int nb_tables,
+                            int log_tab_size,
+                            EncSymbolO1 (*syms)[MAX_SYMBOLS]) {
+  int t, s;
+  for (t = 0; t < nb_tables; ++t) {
+    uint32_t start = 0;
+    if (FSCNormalizeCounts(counts[t], MAX_SYMBOLS, log_tab_size) < 1) {
+      return 0;
+    }
+    for (s = 0; s < MAX_SYMBOLS; ++s) {
+      EncSymbolO1* const sym = &syms[t][s];
+      sym->start_ = (uint16_t)start;
+      sym->freq_ = (uint16_t)counts[t][s];
+      FSCInitDivide(counts[t][s], &sym->inv_);
+      start += counts[t][s];
+    }
+  }
+  return 1;
+}
+
+// Appends the block's words, written backward by DoPutBlock*() before
+// output[end], to the bitstream.
+static void AdvanceBlock(FSCBitWriter* const bw, FSCType* const output,
+                         int pos, int end) {
+  const size_t len = (end - pos) * sizeof(FSCType);
+  if (pos > 0) memmove(output, &output[pos], len);
+  FSCBitWriterAdvance(bw, len);
+}
+
+// x' = (x / freq) << log_tab_size + (x % freq) + start
+//    = x + (x / freq) * (tab_size - freq) + start
+// A symbol of frequency tab_size (only one in its context) costs nothing.
+#define PUT_SYMBOL(state, sym) do {                                        \
+  const EncSymbolO1* const s = (sym);                                      \
+  if ((uint64_t)(state) >= ((uint64_t)s->freq_ << (32 - log_tab_size))) {  \
+    output[--pos] = (FSCType)((state) & FSC_BITS_MASK);                    \
+    (state) >>= FSC_BITS;                                                  \
+  }                                                                        \
+  (state) += FSCDivide((state), s->inv_) * (tab_size - s->freq_)          \
+           + s->start_;                                                    \
+} while (0)
+
+// Cost of coding counts[] with a table of the given costs, in bytes.
+static size_t CodedSize(const uint32_t counts[MAX_SYMBOLS],
+                        const uint16_t costs[MAX_SYMBOLS]) {
+  uint64_t bits = 0;   // in 1/256th of a bit
+  int s;
+  for (s = 0; s < MAX_SYMBOLS; ++s) {
+    if (counts[s] > 0) bits += (uint64_t)counts[s] * costs[s];
+  }
+  return (size_t)(bits >> 11);
+}
+
+// Gives a table of their own to the contexts that save more than the table's
+// size, by decreasing number of occurrences, the others sharing table 0.
+// Returns the number of tables and stores the counts of each in tables[],
+// its context in contexts[], and the table of each context in ctx_map[].
+static int SelectTables(const uint32_t (*ctx_counts)[MAX_SYMBOLS],
+                        const size_t ctx_sizes[MAX_SYMBOLS], size_t in_size,
+                        int log_tab_size, int max_tables,
+                        uint32_t (*tables)[MAX_SYMBOLS],
+                        uint8_t contexts[], uint8_t ctx_map[MAX_SYMBOLS]) {
+  uint32_t norm[MAX_SYMBOLS];
+  uint16_t costs[MAX_SYMBOLS];
+  uint8_t order[MAX_SYMBOLS];
+  int nb = 1, c, i, s;
+  memset(tables[0], 0, sizeof(tables[0]));
+  for (c = 0; c < MAX_SYMBOLS; ++c) {
+    for (s = 0; s < MAX_SYMBOLS; ++s) tables[0][s] += ctx_counts[c][s];
+    ctx_map[c] = 0;
+    order[c] = c;
+  }
+  contexts[0] = 0;
+  if (in_size == 0) tables[0][0] = 1;   // any table will do
+  if (max_tables > 1) {
+    memcpy(norm, tables[0], sizeof(norm));
+    if (FSCNormalizeCounts(norm, MAX_SYMBOLS, log_tab_size) < 1 ||
+        !FSCGetSymbolCosts(norm, CODING_METHOD_16B_4X, costs)) {
+      return 0;
+    }
+  }
+  for (i = 1; i < MAX_SYMBOLS; ++i) {   // insertion sort, by decreasing size
+    const uint8_t o = order[i];
+    int j = i;
+    for (; j > 0 && ctx_sizes[order[j - 1]] < ctx_sizes[o]; --j) {
+      order[j] = order[j - 1];
+    }
+    order[j] = o;
+  }
+  for (i = 0; i < MAX_SYMBOLS && nb < max_tables; ++i) {
+    const int ctx = order[i];
+    size_t own_size;
+    if (ctx_sizes[ctx] == 0) break;
+    own_size = FSCEstimateSizeFromCounts(ctx_counts[ctx], ctx_sizes[ctx],
+                                         CODING_METHOD_16B_4X, log_tab_size);
+    if (own_size == 0 || own_size >= CodedSize(ctx_counts[ctx], costs)) {
+      continue;
+    }
+    for (s = 0; s < MAX_SYMBOLS; ++s) tables[0][s] -= ctx_counts[ctx][s];
+    memcpy(tables[nb], ctx_counts[ctx], sizeof(tables[nb]));
+    contexts[nb] = ctx;
+    ctx_map[ctx] = nb++;
+  }
+  for (s = 0; s < MAX_SYMBOLS && tables[0][s] == 0; ++s) {}
+  if (s == MAX_SYMBOLS) tables[0][0] = 1;   // unused
+  return nb;
+}
+
+// 'lane' is the input of the state, 'prev' the context of its first symbol.
+#define PUT_LANE_SYMBOL(state, lane, n)                                    \
+  PUT_SYMBOL(state,                                                        \
+      &syms[ctx_map[((n) > 0) ? (lane)[(n) - 1] : prev]][(lane)[(n)]])
+
+// The block is cut into 4 lanes, one per state, the last one also getting
+// the remaining size % 4 symbols. Each lane has its own chain of contexts,
+// starting with 'prev', the byte preceding the block, so that the decoder
+// can follow the 4 chains in parallel.
+// Writes the words backward, ending at output[pos]. Returns the new start.
+static int DoPutBlockO1(const EncSymbolO1 (*syms)[MAX_SYMBOLS],
+                        const uint8_t ctx_map[MAX_SYMBOLS], int log_tab_size,
+                        const uint8_t* in, int size, uint8_t prev,
+                        FSCType output[], int pos) {
+  FSCStateW states[4] = { FSC_MAX, FSC_MAX, FSC_MAX, FSC_MAX };
+  const uint32_t tab_size = 1u << log_tab_size;
+  const int len = size >> 2;
+  const uint8_t* const in1 = in + len;
+  const uint8_t* const in2 = in + 2 * len;
+  const uint8_t* const in3 = in + 3 * len;
+  int n = size - 3 * len, r;
+  while (n > len) {
+    --n;
+    PUT_LANE_SYMBOL(states[3], in3, n);
+  }
+  while (n > 0) {
+    --n;
+    PUT_LANE_SYMBOL(states[3], in3, n);
+    PUT_LANE_SYMBOL(states[2], in2, n);
+    PUT_LANE_SYMBOL(states[1], in1, n);
+    PUT_LANE_SYMBOL(states[0], in, n);
+  }
+  for (r = 3; r >= 0; --r) {
+    output[--pos] = (FSCType)(states[r] & FSC_BITS_MASK);
+    output[--pos] = (FSCType)(states[r] >> FSC_BITS);
+  }
+  return pos;
+}
+#undef PUT_LANE_SYMBOL
+
+int FSCEncodeO1(const uint8_t* in, size_t in_size,
+                uint8_t** out, size_t* out_size,
+                int log_tab_size, int max_tables) {
+  uint32_t (*ctx_counts)[MAX_SYMBOLS] = NULL;
+  uint32_t (*tables)[MAX_SYMBOLS] = NULL;
+  EncSymbolO1 (*syms)[MAX_SYMBOLS] = NULL;
+  size_t ctx_sizes[MAX_SYMBOLS] = { 0 };
+  uint8_t contexts[FSC_O1_MAX_TABLES];
+  uint8_t ctx_map[MAX_SYMBOLS];
+  FSCBitWriter bw;
+  size_t n;
+  int nb_tables, t, ok = 0;
+  if (out == NULL || out_size == NULL) return 0;
+  if (in == NULL && in_size > 0) return 0;
+  if (max_tables < 1 || max_tables > FSC_O1_MAX_TABLES) return 0;
+  if (log_tab_size < MIN_LOG_TAB_SIZE_W) log_tab_size = MIN_LOG_TAB_SIZE_W;
+  if (log_tab_size > FSC_O1_MAX_LOG_TAB_SIZE) {
+    log_tab_size = FSC_O1_MAX_LOG_TAB_SIZE;
+  }
+
+  ctx_counts = (uint32_t (*)[MAX_SYMBOLS])FSCMalloc(
+      MAX_SYMBOLS * sizeof(*ctx_counts));
+  tables = (uint32_t (*)[MAX_SYMBOLS])FSCMalloc(
+      max_tables * sizeof(*tables));
+  if (ctx_counts == NULL || tables == NULL) goto End;
+  memset(ctx_counts, 0, MAX_SYMBOLS * sizeof(*ctx_counts));
+  for (n = 0; n < in_size; n += BLOCK_SIZE) {   // same contexts as the lanes
+    const int size = (in_size - n > BLOCK_SIZE) ? BLOCK_SIZE
+                                                : (int)(in_size - n);
+    const int len = size >> 2;
+    int k;
+    for (k = 0; k < size; ++k) {
+      const int lane_start = (len > 0) ? (k % len == 0 && k < 4 * len)
+                                       : (k == 0);
+      const int ctx = !lane_start ? in[n + k - 1] : (n > 0) ? in[n - 1] : 0;
+      ++ctx_counts[ctx][in[n + k]];
+      ++ctx_sizes[ctx];
+    }
+  }
+  nb_tables = SelectTables((const uint32_t (*)[MAX_SYMBOLS])ctx_counts,
+                           ctx_sizes, in_size, log_tab_size, max_tables,
+                           tables, contexts, ctx_map);
+  if (nb_tables == 0) goto End;
+
+  syms = (EncSymbolO1 (*)[MAX_SYMBOLS])FSCMalloc(nb_tables * sizeof(*syms));
+  if (syms == NULL) goto End;
+  if (!InitEncSymbolsO1(tables, nb_tables, log_tab_size, syms)) goto End;
+
+  // Header: size, log_tab_size, number of tables and the context of each
+  // table but the shared one, then the counts.
+  if (!FSCBitWriterInit(&bw, in_size + MAX_HDR_SIZE)) goto End;
+  if (!FSCBitWriterReserve(&bw, MAX_HDR_SIZE + nb_tables)) goto Error;
+  FSCWriteSize(&bw, in_size);
+  FSCWriteBits(&bw, MAX_LOG_TAB_SIZE - log_tab_size, 4);
+  FSCWriteBits(&bw, nb_tables - 1, 8);
+  for (t = 1; t < nb_tables; ++t) FSCWriteBits(&bw, contexts[t], 8);
+  if (!WriteCountsO1(&bw, nb_tables,
+                     (const uint32_t (*)[MAX_SYMBOLS])tables)) {
+    goto Error;
+  }
+  for (n = 0; n < in_size; n += BLOCK_SIZE) {
+    const int size = (in_size - n > BLOCK_SIZE) ? BLOCK_SIZE
+                                                : (int)(in_size - n);
+    const int end = size + BLOCK_SLACK_O1;
+    FSCType* const output =
+        (FSCType*)FSCBitWriterGetBuffer(&bw, end * sizeof(FSCType));
+    if (output == NULL) goto Error;
+    AdvanceBlock(&bw, output,
+                 DoPutBlockO1((const EncSymbolO1 (*)[MAX_SYMBOLS])syms,
+                              ctx_map, log_tab_size, in + n, size,
+                              (n > 0) ? in[n - 1] : 0, output, end),
+                 end);
+  }
+  FSCBitWriterFlush(&bw);
+  if (bw.error_) goto Error;
+  *out = FSCBitWriterFinish(&bw);
+  *out_size = FSCBitWriterNumBytes(&bw);
+  ok = 1;
+  goto End;
+
+ Error:
+  FSCBitWriterDestroy(&bw);
+ End:
+  FSCFree(syms);
+  FSCFree(tables);
+  FSCFree(ctx_counts);
+  return ok;
+}
+
+//------------------------------------------------------------------------------
+// Decoding
+
+typedef struct {
+  uint16_t start_;
+  uint16_t freq_;
+} DecSymbolO1;
+
+typedef struct {           // the tables of a context
+  const DecSymbolO1* symbols_;
+  const uint8_t* map_;     // slot -> symbol
+} DecTableO1;
+
+// Sets up the symbols and slot -> symbol maps of the tables.
+static void InitDecSymbolsO1(const uint32_t (*counts)[MAX_SYMBOLS],
+                             int nb_tables, int log_tab_size,
+                             DecSymbolO1 (*syms)[MAX_SYMBOLS], uint8_t* maps) {
+  int t, s;
+  for (t = 0; t < nb_tables; ++t) {
+    uint8_t* const map = maps + ((size_t)t << log_tab_size);
+    uint32_t start = 0;
+    for (s = 0; s < MAX_SYMBOLS; ++s) {
+      syms[t][s].start_ = (uint16_t)start;
+      syms[t][s].freq_ = (uint16_t)counts[t][s];
+      memset(map + start, s, counts[t][s]);
+      start += counts[t][s];
+    }
+  }
+}
+
+static FSC_INLINE uint8_t NextSymbolO1(const DecTableO1* const tab,
+                                      int log_tab_size,
+                                      FSCStateW* const state) {
+  const uint32_t r = (*state) & ((1u << log_tab_size) - 1);
+  const uint8_t s = tab->map_[r];
+  const DecSymbolO1* const sym = &tab->symbols_[s];
+  *state = sym->freq_ * ((*state) >> log_tab_size) + (r - sym->start_);
+  return s;
+}
+
+// Reads the 4 initial states of a block. Returns the position of the next
+// word and stores the end of the whole words in *buf_end, NULL upon error.
+static const FSCType* ReadStatesO1(FSCBitReader* const br,
+                                   FSCStateW states[4],
+                                   const FSCType** const buf_end) {
+  const uint8_t* const start = FSCBitAlign(br);
+  const FSCType* buf = (const FSCType*)start;
+  int r;
+  *buf_end = buf + (FSCGetByteEnd(br) - start) / (int)sizeof(FSCType);
+  if (*buf_end - buf < 8) return NULL;
+  for (r = 0; r < 4; ++r) {
+    states[r] = ((FSCStateW)buf[0] << FSC_BITS) | buf[1];
+    buf += 2;
+  }
+  return buf;
+}
+
+// Each state reads at most one word per symbol: the first 'fast_limit'
+// symbols can be decoded without checking the end of the buffer.
+#define RENORMALIZE_STATE_FAST(state) do {                             \
+  if ((state) < FSC_MAX) (state) = ((state) << FSC_BITS) | (*buf++);   \
+} while (0)
+
+#define RENORMALIZE_STATE(state) do {                                  \
+  if ((state) < FSC_MAX) {                                             \
+    if (buf >= buf_end) return 0;                                      \
+    (state) = ((state) << FSC_BITS) | (*buf++);                        \
+  }                                                                    \
+} while (0)
+
+#define GET_SYMBOL_FAST(state, ctx, dst) do {                 \
+  (ctx) = NextSymbolO1(&tabs[(ctx)], log_tab_size, &(state)); \
+  (dst) = (ctx);                                              \
+  RENORMALIZE_STATE_FAST(state);                              \
+} while (0)
+
+#define GET_SYMBOL(state, ctx, dst) do {                      \
+  (ctx) = NextSymbolO1(&tabs[(ctx)], log_tab_size, &(state)); \
+  (dst) = (ctx);                                              \
+  RENORMALIZE_STATE(state);                                   \
+} while (0)
+
+// Same lanes as DoPutBlockO1(). 'prev' is the byte preceding the block.
+static int GetBlockO1(const DecTableO1 tabs[MAX_SYMBOLS], int log_tab_size,
+                      uint8_t* out, int size, uint8_t prev,
+                      FSCBitReader* const br) {
+  const FSCType* buf_end;
+  FSCStateW states[4];
+  const FSCType* buf = ReadStatesO1(br, states, &buf_end);
+  const int len = size >> 2;
+  uint8_t* const out1 = out + len;
+  uint8_t* const out2 = out + 2 * len;
+  uint8_t* const out3 = out + 3 * len;
+  uint8_t ctx0 = prev, ctx1 = prev, ctx2 = prev, ctx3 = prev;
+  int n, fast_limit;
+  if (buf == NULL) return 0;
+  fast_limit = ((buf_end - buf) / 4 < len) ? (int)((buf_end - buf) / 4) : len;
+  for (n = 0; n < fast_limit; ++n) {
+    GET_SYMBOL_FAST(states[0], ctx0, out[n]);
+    GET_SYMBOL_FAST(states[1], ctx1, out1[n]);
+    GET_SYMBOL_FAST(states[2], ctx2, out2[n]);
+    GET_SYMBOL_FAST(states[3], ctx3, out3[n]);
+  }
+  for (; n < len; ++n) {
+    GET_SYMBOL(states[0], ctx0, out[n]);
+    GET_SYMBOL(states[1], ctx1, out1[n]);
+    GET_SYMBOL(states[2], ctx2, out2[n]);
+    GET_SYMBOL(states[3], ctx3, out3[n]);
+  }
+  for (; n < size - 3 * len; ++n) GET_SYMBOL(states[3], ctx3, out3[n]);
+  FSCSetReadBufferPos(br, (const uint8_t*)buf);
+  // all states should be back to their initial value
+  return (states[0] == FSC_MAX) && (states[1] == FSC_MAX) &&
+         (states[2] == FSC_MAX) && (states[3] == FSC_MAX);
+}
+#undef GET_SYMBOL
+#undef GET_SYMBOL_FAST
+
+int FSCDecodeO1(const uint8_t* in, size_t in_size,
+                uint8_t** out, size_t* out_size) {
+  uint32_t (*counts)[MAX_SYMBOLS] = NULL;
+  DecSymbolO1 (*syms)[MAX_SYMBOLS] = NULL;
+  uint8_t* maps = NULL;
+  uint8_t* dst = NULL;
+  DecTableO1 tabs[MAX_SYMBOLS];
+  FSCBitReader br;
+  size_t size, n;
+  int log_tab_size, nb_tables, t, s;
+  if (in == NULL || out == NULL || out_size == NULL) return 0;
+
+  FSCInitBitReader(&br, in, in_size);
+  size = FSCReadSize(&br);
+  log_tab_size = MAX_LOG_TAB_SIZE - FSCReadBits(&br, 4);
+  nb_tables = 1 + FSCReadBits(&br, 8);
+  if (log_tab_size < MIN_LOG_TAB_SIZE_W ||
+      log_tab_size > FSC_O1_MAX_LOG_TAB_SIZE) {
+    return 0;
+  }
+  if (size > ((size_t)-1) - BLOCK_SIZE) return 0;
+
+  counts = (uint32_t (*)[MAX_SYMBOLS])FSCMalloc(nb_tables * sizeof(*counts));
+  syms = (DecSymbolO1 (*)[MAX_SYMBOLS])FSCMalloc(nb_tables * sizeof(*syms));
+  maps = (uint8_t*)FSCMalloc((size_t)nb_tables << log_tab_size);
+  if (counts == NULL || syms == NULL || maps == NULL) goto Error;
+  for (s = 0; s < MAX_SYMBOLS; ++s) {
+    tabs[s].symbols_ = syms[0];
+    tabs[s].map_ = maps;
+  }
+  for (t = 1; t < nb_tables; ++t) {
+    const int ctx = FSCReadBits(&br, 8);
+    tabs[ctx].symbols_ = syms[t];
+    tabs[ctx].map_ = maps + ((size_t)t << log_tab_size);
+  }
+  if (!ReadCountsO1(&br, counts, nb_tables, log_tab_size)) goto Error;
+  InitDecSymbolsO1((const uint32_t (*)[MAX_SYMBOLS])counts, nb_tables,
+                   log_tab_size, syms, maps);
+
+  dst = (uint8_t*)FSCMalloc(size + 1);
+  if (dst == NULL) goto Error;
+  for (n = 0; n < size; n += BLOCK_SIZE) {
+    const int next = (size - n > BLOCK_SIZE) ? BLOCK_SIZE : (int)(size - n);
+    if (!GetBlockO1(tabs, log_tab_size, dst + n, next,
+                    (n > 0) ? dst[n - 1] : 0, &br)) {
+      goto Error;
+    }
+  }
+  FSCFree(maps);
+  FSCFree(syms);
+  FSCFree(counts);
+  *out = dst;
+  *out_size = size;
+  return 1;
+
+ Error:
+  FSCFree(dst);
+  FSCFree(maps);
+  FSCFree(syms);
+  FSCFree(counts);
+  return 0;
+}
+
+//------------------------------------------------------------------------------
+// Positional contexts
+//
+// Symbol k is coded with table k % stride. The 4 states are interleaved as
+// for CODING_METHOD_16B_4X, the table following the position, so that the
+// decoder writes each byte at its place in a single pass.
+// Header: size, log_tab_size and stride, then the counts.
+
+static int DoPutBlockStride(const EncSymbolO1 (*syms)[MAX_SYMBOLS],
+                            int stride, int log_tab_size,
+                            const uint8_t* in, int size, int phase,
+                            FSCType output[], int pos) {
+  FSCStateW states[4] = { FSC_MAX, FSC_MAX, FSC_MAX, FSC_MAX };
+  const uint32_t tab_size = 1u << log_tab_size;
+  int t = (int)(((size_t)phase + size + stride - 1) % stride);
+  int k, r;
+  for (k = size - 1; k >= 0; --k) {
+    PUT_SYMBOL(states[k & 3], &syms[t][in[k]]);
+    t = (t > 0) ? t - 1 : stride - 1;
+  }
+  for (r = 3; r >= 0; --r) {
+    output[--pos] = (FSCType)(states[r] & FSC_BITS_MASK);
+    output[--pos] = (FSCType)(states[r] >> FSC_BITS);
+  }
+  return pos;
+}
+
+int FSCEncodeStride(const uint8_t* in, size_t in_size,
+                    uint8_t** out, size_t* out_size,
+                    int log_tab_size, int stride) {
+  uint32_t (*counts)[MAX_SYMBOLS] = NULL;
+  EncSymbolO1 (*syms)[MAX_SYMBOLS] = NULL;
+  FSCBitWriter bw;
+  size_t n;
+  int t, ok = 0;
+  if (out == NULL || out_size == NULL) return 0;
+  if (in == NULL && in_size > 0) return 0;
+  if (stride < 1 || stride > FSC_MAX_STRIDE) return 0;
+  if (log_tab_size < MIN_LOG_TAB_SIZE_W) log_tab_size = MIN_LOG_TAB_SIZE_W;
+  if (log_tab_size > FSC_O1_MAX_LOG_TAB_SIZE) {
+    log_tab_size = FSC_O1_MAX_LOG_TAB_SIZE;
+  }
+
+  counts = (uint32_t (*)[MAX_SYMBOLS])FSCMalloc(stride * sizeof(*counts));
+  syms = (EncSymbolO1 (*)[MAX_SYMBOLS])FSCMalloc(stride * sizeof(*syms));
+  if (counts == NULL || syms == NULL) goto End;
+  memset(counts, 0, stride * sizeof(*counts));
+  for (n = 0, t = 0; n < in_size; ++n) {
+    ++counts[t][in[n]];
+    if (++t == stride) t = 0;
+  }
+  for (t = 0; t < stride; ++t) {   // unused tables
+    if ((size_t)t >= in_size) counts[t][0] = 1;
+  }
+  if (!InitEncSymbolsO1(counts, stride, log_tab_size, syms)) goto End;
+
+  if (!FSCBitWriterInit(&bw, in_size + MAX_HDR_SIZE)) goto End;
+  if (!FSCBitWriterReserve(&bw, MAX_HDR_SIZE)) goto Error;
+  FSCWriteSize(&bw, in_size);
+  FSCWriteBits(&bw, MAX_LOG_TAB_SIZE - log_tab_size, 4);
+  FSCWriteBits(&bw, stride - 1, 8);
+  if (!WriteCountsO1(&bw, stride, (const uint32_t (*)[MAX_SYMBOLS])counts)) {
+    goto Error;
+  }
+  for (n = 0; n < in_size; n += BLOCK_SIZE) {
+    const int size = (in_size - n > BLOCK_SIZE) ? BLOCK_SIZE
+                                                : (int)(in_size - n);
+    const int end = size + BLOCK_SLACK_O1;
+    FSCType* const output =
+        (FSCType*)FSCBitWriterGetBuffer(&bw, end * sizeof(FSCType));
+    if (output == NULL) goto Error;
+    AdvanceBlock(&bw, output,
+                 DoPutBlockStride((const EncSymbolO1 (*)[MAX_SYMBOLS])syms,
+                                  stride, log_tab_size, in + n, size,
+                                  (int)(n % stride), output, end),
+                 end);
+  }
+  FSCBitWriterFlush(&bw);
+  if (bw.error_) goto Error;
+  *out = FSCBitWriterFinish(&bw);
+  *out_size = FSCBitWriterNumBytes(&bw);
+  ok = 1;
+  goto End;
+
+ Error:
+  FSCBitWriterDestroy(&bw);
+ End:
+  FSCFree(syms);
+  FSCFree(counts);
+  return ok;
+}
+
+#define GET_STRIDE_SYMBOL(state, dst) do {                   \
+  (dst) = NextSymbolO1(&tabs[t], log_tab_size, &(state));    \
+  if (++t == stride) t = 0;                                  \
+} while (0)
+
+// 'phase' is the table of the block's first symbol.
+static int GetBlockStride(const DecTableO1 tabs[], int stride,
+                          int log_tab_size, uint8_t* out, int size,
+                          int phase, FSCBitReader* const br) {
+  const FSCType* buf_end;
+  FSCStateW states[4];
+  const FSCType* buf = ReadStatesO1(br, states, &buf_end);
+  int n, t = phase, fast_limit;
+  if (buf == NULL) return 0;
+  fast_limit = (int)((buf_end - buf < size) ? buf_end - buf : size) & ~3;
+  for (n = 0; n < fast_limit; n += 4) {
+    GET_STRIDE_SYMBOL(states[0], out[n + 0]);
+    GET_STRIDE_SYMBOL(states[1], out[n + 1]);
+    GET_STRIDE_SYMBOL(states[2], out[n + 2]);
+    GET_STRIDE_SYMBOL(states[3], out[n + 3]);
+    RENORMALIZE_STATE_FAST(states[0]);
+    RENORMALIZE_STATE_FAST(states[1]);
+    RENORMALIZE_STATE_FAST(states[2]);
+    RENORMALIZE_STATE_FAST(states[3]);
+  }
+  for (; n < size; ++n) {
+    GET_STRIDE_SYMBOL(states[n & 3], out[n]);
+    RENORMALIZE_STATE(states[n & 3]);
+  }
+  FSCSetReadBufferPos(br, (const uint8_t*)buf);
+  // all states should be back to their initial value
+  return (states[0] == FSC_MAX) && (states[1] == FSC_MAX) &&
+         (states[2] == FSC_MAX) && (states[3] == FSC_MAX);
+}
+#undef GET_STRIDE_SYMBOL
+
+int FSCDecodeStride(const uint8_t* in, size_t in_size,
+                    uint8_t** out, size_t* out_size) {
+  uint32_t (*counts)[MAX_SYMBOLS] = NULL;
+  DecSymbolO1 (*syms)[MAX_SYMBOLS] = NULL;
+  uint8_t* maps = NULL;
+  uint8_t* dst = NULL;
+  DecTableO1 tabs[FSC_MAX_STRIDE];
+  FSCBitReader br;
+  size_t size, n;
+  int log_tab_size, stride, t;
+  if (in == NULL || out == NULL || out_size == NULL) return 0;
+
+  FSCInitBitReader(&br, in, in_size);
+  size = FSCReadSize(&br);
+  log_tab_size = MAX_LOG_TAB_SIZE - FSCReadBits(&br, 4);
+  stride = 1 + FSCReadBits(&br, 8);
+  if (log_tab_size < MIN_LOG_TAB_SIZE_W ||
+      log_tab_size > FSC_O1_MAX_LOG_TAB_SIZE) {
+    return 0;
+  }
+  if (size > ((size_t)-1) - BLOCK_SIZE) return 0;
+
+  counts = (uint32_t (*)[MAX_SYMBOLS])FSCMalloc(stride * sizeof(*counts));
+  syms = (DecSymbolO1 (*)[MAX_SYMBOLS])FSCMalloc(stride * sizeof(*syms));
+  maps = (uint8_t*)FSCMalloc((size_t)stride << log_tab_size);
+  if (counts == NULL || syms == NULL || maps == NULL) goto Error;
+  if (!ReadCountsO1(&br, counts, stride, log_tab_size)) goto Error;
+  InitDecSymbolsO1((const uint32_t (*)[MAX_SYMBOLS])counts, stride,
+                   log_tab_size, syms, maps);
+  for (t = 0; t < stride; ++t) {
+    tabs[t].symbols_ = syms[t];
+    tabs[t].map_ = maps + ((size_t)t << log_tab_size);
+  }
+
+  dst = (uint8_t*)FSCMalloc(size + 1);
+  if (dst == NULL) goto Error;
+  for (n = 0; n < size; n += BLOCK_SIZE) {
+    const int next = (size - n > BLOCK_SIZE) ? BLOCK_SIZE : (int)(size - n);
+    if (!GetBlockStride(tabs, stride, log_tab_size, dst + n, next,
+                        (int)(n % stride), &br)) {
+      goto Error;
+    }
+  }
+  FSCFree(maps);
+  FSCFree(syms);
+  FSCFree(counts);
+  *out = dst;
+  *out_size = size;
+  return 1;
+
+ Error:
+  FSCFree(dst);
+  FSCFree(maps);
+  FSCFree(syms);
+  FSCFree(counts);
+  return 0;
+}
+#undef RENORMALIZE_STATE
+#undef RENORMALIZE_STATE_FAST
+#undef PUT_SYMBOL
+
+//------------------------------------------------------------------------------
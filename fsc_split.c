@@ -0,0 +1,285 @@
+//Copyright 2014 The FSC Authors. All Rights Reserved.
+//
+//Licensed under the Apache License, Version 2.0 (the "License");
+//you may not use this file except in compliance with the License.
+//You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+//    Unless required by applicable law or agreed to in writing, software
+//    distributed under the License is distributed on an "AS IS" BASIS,
+//    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//    See the License for the specific language governing permissions and
+//    limitations under the License.
+//------------------------------------------------------------------------------
+//
+// Splitting of the input into segments of different statistics
+//
+// The input is cut into units of SPLIT_UNIT bytes, each one being a segment
+// at first. Adjacent segments are then merged greedily, the most profitable
+// pair first, as long as merging makes the coded size (as estimated by
+// FSCEstimateSizeFromCounts(), header included) smaller. Each segment is
+// finally coded as a message of its own, with its own tables.
+//
+// Author: Skal (pascal.massimino@gmail.com)
+
+#include "./fsc.h"
+#include <stdlib.h>
+#include <string.h>
+
+#include "./bits.h"
+
+#define SPLIT_UNIT 2048     // granularity of the segments' boundaries
+#define SPLIT_WINDOW 64     // number of units merged at once, when bounded
+
+typedef struct {
+  size_t start_, size_;
+  uint32_t counts_[MAX_SYMBOLS];
+  size_t cost_;             // estimated coded size
+  size_t merged_cost_;      // ... when merged with the next segment
+} Segment;
+
+typedef struct {
+  int log_tab_size_;
+  FSCCodingMethod method_;
+  Segment* segs_;           // SPLIT_WINDOW + 1 segments
+  int nb_segs_;
+} Splitter;
+
+static size_t Cost(const Splitter* const sp, const uint32_t counts[],
+                   size_t size) {
+  const size_t cost =
+      FSCEstimateSizeFromCounts(counts, size, sp->method_, sp->log_tab_size_);
+  return (cost > 0) ? cost : (~(size_t)0 >> 2);   // not codable
+}
+
+static void SetMergedCost(const Splitter* const sp, int i) {
+  Segment* const a = &sp->segs_[i];
+  const Segment* const b = &sp->segs_[i + 1];
+  uint32_t counts[MAX_SYMBOLS];
+  int s;
+  for (s = 0; s < MAX_SYMBOLS; ++s) counts[s] = a->counts_[s] + b->counts_[s];
+  a->merged_cost_ = Cost(sp, counts, a->size_ + b->size_);
+}
+
+static void AddUnit(Splitter* const sp, const uint8_t* in, size_t start,
+                    size_t size) {
+  Segment* const seg = &sp->segs_[sp->nb_segs_++];
+  seg->start_ = start;
+  seg->size_ = size;
+  FSCCountSymbols(in + start, size, seg->counts_);
+  seg->cost_ = Cost(sp, seg->counts_, size);
+  if (sp->nb_segs_ > 1) SetMergedCost(sp, sp->nb_segs_ - 2);
+}
+
+// Merges the segments while it pays.
+static void MergeSegments(Splitter* const sp) {
+  while (sp->nb_segs_ > 1) {
+    int i, best = -1;
+    size_t best_gain = 0;
+    for (i = 0; i + 1 < sp->nb_segs_; ++i) {
+      const Segment* const a = &sp->segs_[i];
+      const size_t sum = a->cost_ + sp->segs_[i + 1].cost_;
+      if (a->merged_cost_ < sum && sum - a->merged_cost_ > best_gain) {
+        best_gain = sum - a->merged_cost_;
+        best = i;
+      }
+    }
+    if (best < 0) break;
+    {
+      Segment* const a = &sp->segs_[best];
+      const Segment* const b = &sp->segs_[best + 1];
+      int s;
+      for (s = 0; s < MAX_SYMBOLS; ++s) a->counts_[s] += b->counts_[s];
+      a->size_ += b->size_;
+      a->cost_ = a->merged_cost_;
+      --sp->nb_segs_;
+      memmove(&sp->segs_[best + 1], &sp->segs_[best + 2],
+              (sp->nb_segs_ - best - 1) * sizeof(*sp->segs_));
+      if (best + 1 < sp->nb_segs_) SetMergedCost(sp, best);
+      if (best > 0) SetMergedCost(sp, best - 1);
+    }
+  }
+}
+
+// Appends the ends of the first 'nb' segments to *ends and removes them.
+static int FlushSegments(Splitter* const sp, int nb,
+                         size_t** const ends, size_t* const nb_ends,
+                         size_t* const ends_size) {
+  int i;
+  if (*nb_ends + nb > *ends_size) {
+    const size_t new_size = 2 * (*ends_size) + nb;
+    size_t* const new_ends = (size_t*)FSCMalloc(new_size * sizeof(*new_ends));
+    if (new_ends == NULL) return 0;
+    if (*nb_ends > 0) memcpy(new_ends, *ends, *nb_ends * sizeof(*new_ends));
+    FSCFree(*ends);
+    *ends = new_ends;
+    *ends_size = new_size;
+  }
+  for (i = 0; i < nb; ++i) {
+    (*ends)[(*nb_ends)++] = sp->segs_[i].start_ + sp->segs_[i].size_;
+  }
+  sp->nb_segs_ -= nb;
+  memmove(&sp->segs_[0], &sp->segs_[nb], sp->nb_segs_ * sizeof(*sp->segs_));
+  return 1;
+}
+
+int FSCSplit(const uint8_t* in, size_t in_size,
+             int log_tab_size, FSCCodingMethod method, FSCSplitMode mode,
+             size_t** ends, size_t* nb_segments) {
+  const size_t nb_units = (in_size + SPLIT_UNIT - 1) / SPLIT_UNIT;
+  const size_t window = (mode == FSC_SPLIT_BOUNDED) ? SPLIT_WINDOW : nb_units;
+  size_t ends_size = 0, n;
+  Splitter sp;
+  if (ends == NULL || nb_segments == NULL) return 0;
+  if (in == NULL && in_size > 0) return 0;
+  *ends = NULL;
+  *nb_segments = 0;
+  sp.log_tab_size_ = log_tab_size;
+  sp.method_ = method;
+  sp.nb_segs_ = 0;
+  // one more segment, for the one carried over from the previous window
+  sp.segs_ = (Segment*)FSCMalloc((window + 1) * sizeof(*sp.segs_));
+  if (sp.segs_ == NULL) return 0;
+
+  for (n = 0; n < nb_units; ++n) {
+    const size_t start = n * SPLIT_UNIT;
+    const size_t size = (in_size - start > SPLIT_UNIT) ? SPLIT_UNIT
+                                                       : in_size - start;
+    AddUnit(&sp, in, start, size);
+    if (sp.nb_segs_ == (int)window + 1) {
+      // Only the last segment can still grow with the next units.
+      MergeSegments(&sp);
+      if (!FlushSegments(&sp, sp.nb_segs_ - 1, ends, nb_segments,
+                         &ends_size)) {
+        goto Error;
+      }
+    }
+  }
+  MergeSegments(&sp);
+  if (!FlushSegments(&sp, sp.nb_segs_, ends, nb_segments, &ends_size)) {
+    goto Error;
+  }
+  FSCFree(sp.segs_);
+  return 1;
+
+ Error:
+  FSCFree(*ends);
+  *ends = NULL;
+  *nb_segments = 0;
+  FSCFree(sp.segs_);
+  return 0;
+}
+
+//------------------------------------------------------------------------------
+// Coding
+//
+// Format: total size, number of segments and their coded sizes, then the
+// coded segments, byte-aligned.
+
+int FSCEncodeSplit(const uint8_t* in, size_t in_size,
+                   uint8_t** out, size_t* out_size,
+                   int log_tab_size, FSCCodingMethod method,
+                   FSCSplitMode mode) {
+  size_t* ends = NULL;
+  size_t* sizes = NULL;
+  size_t nb = 0, n, start, capacity = 1, payload_size = 0;
+  FSCEncoderCtx* ctx = NULL;
+  uint8_t* payload = NULL;
+  FSCBitWriter bw;
+  if (out == NULL || out_size == NULL) return 0;
+  if (!FSCSplit(in, in_size, log_tab_size, method, mode, &ends, &nb)) {
+    return 0;
+  }
+  for (n = 0, start = 0; n < nb; start = ends[n++]) {
+    capacity += FSCCompressBound(ends[n] - start, method);
+  }
+  ctx = FSCEncoderCtxNew(log_tab_size, method);
+  sizes = (size_t*)FSCMalloc((nb + 1) * sizeof(*sizes));
+  payload = (uint8_t*)FSCMalloc(capacity);
+  if (ctx == NULL || sizes == NULL || payload == NULL) goto Error;
+  for (n = 0, start = 0; n < nb; start = ends[n++]) {
+    if (!FSCEncodeToBufferWithCtx(ctx, in + start, ends[n] - start,
+                                  payload + payload_size,
+                                  FSCCompressBound(ends[n] - start, method),
+                                  &sizes[n])) {
+      goto Error;
+    }
+    payload_size += sizes[n];
+  }
+  if (!FSCBitWriterInit(&bw, (nb + 2) * FSC_MAX_SIZE_BYTES + payload_size)) {
+    goto Error;
+  }
+  if (!FSCBitWriterReserve(&bw, (nb + 2) * FSC_MAX_SIZE_BYTES)) goto ErrorBW;
+  FSCWriteSize(&bw, in_size);
+  FSCWriteSize(&bw, nb);
+  for (n = 0; n < nb; ++n) FSCWriteSize(&bw, sizes[n]);
+  FSCBitWriterFlush(&bw);
+  if (!FSCAppend(&bw, payload, payload_size) || bw.error_) goto ErrorBW;
+  *out = FSCBitWriterFinish(&bw);
+  *out_size = FSCBitWriterNumBytes(&bw);
+  FSCFree(payload);
+  FSCFree(sizes);
+  FSCFree(ends);
+  FSCEncoderCtxDelete(ctx);
+  return 1;
+
+ ErrorBW:
+  FSCBitWriterDestroy(&bw);
+ Error:
+  FSCFree(payload);
+  FSCFree(sizes);
+  FSCFree(ends);
+  FSCEncoderCtxDelete(ctx);
+  return 0;
+}
+
+int FSCDecodeSplit(const uint8_t* in, size_t in_size,
+                   uint8_t** out, size_t* out_size) {
+  FSCBitReader br;
+  FSCDecoderCtx* ctx = NULL;
+  uint8_t* dst = NULL;
+  size_t* sizes = NULL;
+  size_t total, nb, n, pos = 0;
+  const uint8_t* buf;
+  if (in == NULL || out == NULL || out_size == NULL) return 0;
+  FSCInitBitReader(&br, in, in_size);
+  total = FSCReadSize(&br);
+  nb = FSCReadSize(&br);
+  if (br.eof_ || nb > in_size) return 0;
+  sizes = (size_t*)FSCMalloc((nb + 1) * sizeof(*sizes));
+  if (sizes == NULL) return 0;
+  for (n = 0; n < nb; ++n) sizes[n] = FSCReadSize(&br);
+  if (br.eof_) goto Error;
+  buf = FSCBitAlign(&br);
+  if (buf > in + in_size) goto Error;
+  ctx = FSCDecoderCtxNew();
+  dst = (uint8_t*)FSCMalloc(total + 1);
+  if (ctx == NULL || dst == NULL) goto Error;
+  for (n = 0; n < nb; ++n) {
+    uint8_t* seg = dst + pos;
+    size_t seg_size = total - pos;
+    if (sizes[n] > (size_t)(in + in_size - buf)) goto Error;
+    if (!FSCDecodeWithCtx(ctx, buf, sizes[n], &seg, &seg_size) ||
+        seg != dst + pos) {   // didn't fit
+      if (seg != dst + pos) FSCFree(seg);
+      goto Error;
+    }
+    buf += sizes[n];
+    pos += seg_size;
+  }
+  if (pos != total) goto Error;
+  FSCDecoderCtxDelete(ctx);
+  FSCFree(sizes);
+  *out = dst;
+  *out_size = total;
+  return 1;
+
+ Error:
+  FSCDecoderCtxDelete(ctx);
+  FSCFree(sizes);
+  FSCFree(dst);
+  return 0;
+}
+
+//------------------------------------------------------------------------------
@@ -108,6 +108,8 @@ int FSCParseCodingMethodOpt(const char opt[], FSCCodingMethod* const method) {
     *method = CODING_METHOD_16B_ALIAS;
   } else if (!strcmp(opt, "-a2")) {
     *method = CODING_METHOD_16B_ALIAS_2X;
+  } else if (!strcmp(opt, "-a4")) {
+    *method = CODING_METHOD_16B_ALIAS_4X;
   } else {
     return 0;
   }
@@ -120,6 +122,7 @@ void FSCPrintCodingOptions() {
   printf("-w4                : use word-based coding 4x interleave.\n");
   printf("-a                 : use word-based coding + alias.\n");
   printf("-a2                : use word-based coding + alias + interleave.\n");
+  printf("-a4                : use word-based coding + alias + 4x interleave.\n");
   printf("-mod               : use modulo spread function\n");
   printf("-rev               : use reverse spread function\n");
   printf("-pack              : use pack spread function\n");
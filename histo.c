@@ -85,8 +85,10 @@ void Select(uint32_t* const keys, int M, int N) {
 //------------------------------------------------------------------------------
 // Analyze counts[] and renormalize with Squeaky Wheel fix, so that
 // the total is rescaled to be equal to tab_size exactly.
-int FSCNormalizeCounts(uint32_t counts[MAX_SYMBOLS], int max_symbol,
-                       int log_tab_size) {
+// 'keys' must have room for max_symbol entries. Symbols are packed into them
+// in base 'radix', which must be >= max_symbol.
+static int NormalizeCounts(uint32_t counts[], int max_symbol, int log_tab_size,
+                           uint32_t keys[], uint32_t radix) {
   const int tab_size = 1 << log_tab_size;
   uint64_t total = 0;
   int nb_symbols = 0;
@@ -105,11 +107,10 @@ int FSCNormalizeCounts(uint32_t counts[MAX_SYMBOLS], int max_symbol,
   if (nb_symbols > tab_size) return 0;
   max_symbol = last_nz;
 
-  uint32_t keys[MAX_SYMBOLS];
   int miss = tab_size;
   const float norm = 1.f * tab_size / total;
   int non_zero = 0;
-  const float key_norm = (float)((1u << 24) / MAX_SYMBOLS);
+  const float key_norm = (float)((1u << 24) / radix);
   for (n = 0; n < max_symbol; ++n) {
     if (counts[n] > 0) {
       const float target = norm * counts[n];
@@ -117,7 +118,7 @@ int FSCNormalizeCounts(uint32_t counts[MAX_SYMBOLS], int max_symbol,
       if (counts[n] == 0) counts[n] = 1;
       miss -= counts[n];
       const uint32_t error = (uint32_t)(key_norm * (target - counts[n]));
-      keys[non_zero++] = (error * MAX_SYMBOLS) + n;
+      keys[non_zero++] = (error * radix) + n;
     }
   }
   if (miss == 0) return max_symbol;
@@ -125,7 +126,7 @@ int FSCNormalizeCounts(uint32_t counts[MAX_SYMBOLS], int max_symbol,
   if (miss > 0) {
     Select(keys, miss, non_zero);
     for (n = 0; n < miss; ++n) {
-      ++counts[keys[n] % MAX_SYMBOLS];
+      ++counts[keys[n] % radix];
     }
   } else {
     // Overflow case. We need to decrease some counts, but need extra care
@@ -133,11 +134,11 @@ int FSCNormalizeCounts(uint32_t counts[MAX_SYMBOLS], int max_symbol,
     // the largest elements greater than 2 until we're good. It's garanteed
     // to terminate.
     non_zero = 0;
-    const uint32_t cap_count = (1u << 23) - 1;  // to avoid overflow
+    const uint32_t cap_count = (1u << 31) / radix - 1;  // to avoid overflow
     for (n = 0; n < max_symbol; ++n) {
       if (counts[n] > 1) {
         const uint32_t c = (counts[n] > cap_count) ? cap_count : counts[n];
-        keys[non_zero++] = (c * MAX_SYMBOLS) + n;
+        keys[non_zero++] = (c * radix) + n;
       }
     }
     assert(non_zero > 0);
@@ -146,7 +147,7 @@ int FSCNormalizeCounts(uint32_t counts[MAX_SYMBOLS], int max_symbol,
     int to_fix = miss;
     while (to_fix > 0) {
       for (n = 0; n < miss && to_fix > 0; ++n) {
-        const uint32_t idx = keys[n] % MAX_SYMBOLS;
+        const uint32_t idx = keys[n] % radix;
         if (counts[idx] > 1) {
           --counts[idx];
           --to_fix;
@@ -157,6 +158,20 @@ int FSCNormalizeCounts(uint32_t counts[MAX_SYMBOLS], int max_symbol,
   return max_symbol;
 }
 
+int FSCNormalizeCounts(uint32_t counts[MAX_SYMBOLS], int max_symbol,
+                       int log_tab_size) {
+  uint32_t keys[MAX_SYMBOLS];
+  return NormalizeCounts(counts, max_symbol, log_tab_size, keys, MAX_SYMBOLS);
+}
+
+int FSCNormalizeCounts16(uint32_t counts[FSC16_MAX_SYMBOLS], int max_symbol,
+                         int log_tab_size) {
+  uint32_t keys[FSC16_MAX_SYMBOLS];
+  if (max_symbol > FSC16_MAX_SYMBOLS) return 0;
+  return NormalizeCounts(counts, max_symbol, log_tab_size,
+                         keys, FSC16_MAX_SYMBOLS);
+}
+
 //------------------------------------------------------------------------------
 // Spread functions
 
@@ -183,11 +198,10 @@ int BuildSpreadTableBucket(int max_symbol, const uint32_t counts[],
                            int log_tab_size, uint8_t symbols[]) {
   const int tab_size = 1 << log_tab_size;
   int s, n, pos;
-  int16_t* buckets = NULL;        // entry to linked list of bucket's symbol
+  int16_t buckets[TAB_SIZE];      // entry to linked list of bucket's symbol
   int16_t next[MAX_SYMBOLS];        // linked list of symbols in the same bucket
   double keys[MAX_SYMBOLS];           // key associated to each symbol
-  buckets = (int16_t*)malloc(tab_size * sizeof(*buckets));
-  if (buckets == NULL) return 0;
+  if (log_tab_size > LOG_TAB_SIZE) return 0;
 
   for (n = 0; n < tab_size; ++n) {
     buckets[n] = -1;  // NIL
@@ -208,7 +222,6 @@ int BuildSpreadTableBucket(int max_symbol, const uint32_t counts[],
   }
   // n < tab_size can happen due to rounding errors
   for (; n != tab_size; ++n) symbols[n] = symbols[n - 1];
-  free(buckets);
   return 1;
 }
 
@@ -0,0 +1,62 @@
+//Copyright 2014 The FSC Authors. All Rights Reserved.
+//
+//Licensed under the Apache License, Version 2.0 (the "License");
+//you may not use this file except in compliance with the License.
+//You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+//    Unless required by applicable law or agreed to in writing, software
+//    distributed under the License is distributed on an "AS IS" BASIS,
+//    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//    See the License for the specific language governing permissions and
+//    limitations under the License.
+//------------------------------------------------------------------------------
+//
+// Memory: allocator hooks and workspace size
+//
+// Author: Skal (pascal.massimino@gmail.com)
+
+#include "./fsc.h"
+
+//------------------------------------------------------------------------------
+
+static FSCAllocFunc alloc_func_ = NULL;   // NULL means malloc() / free()
+static FSCFreeFunc free_func_ = NULL;
+static void* opaque_ = NULL;
+
+void FSCSetAllocator(FSCAllocFunc alloc_func, FSCFreeFunc free_func,
+                     void* opaque) {
+  if (alloc_func == NULL || free_func == NULL) {
+    alloc_func = NULL;
+    free_func = NULL;
+    opaque = NULL;
+  }
+  alloc_func_ = alloc_func;
+  free_func_ = free_func;
+  opaque_ = opaque;
+}
+
+void* FSCMalloc(size_t size) {
+  return (alloc_func_ != NULL) ? alloc_func_(opaque_, size) : malloc(size);
+}
+
+void FSCFree(void* ptr) {
+  if (ptr == NULL) return;
+  if (free_func_ != NULL) {
+    free_func_(opaque_, ptr);
+  } else {
+    free(ptr);
+  }
+}
+
+//------------------------------------------------------------------------------
+
+size_t FSCWorkspaceSize(FSCCodingMethod method, int log_tab_size) {
+  const size_t enc_size = FSCEncoderWorkspaceSize(method, log_tab_size);
+  const size_t dec_size = FSCDecoderWorkspaceSize(method, log_tab_size);
+  if (enc_size == 0 || dec_size == 0) return 0;
+  return (enc_size > dec_size) ? enc_size : dec_size;
+}
+
+//------------------------------------------------------------------------------
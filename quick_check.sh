@@ -18,9 +18,21 @@ if [[ $what = "all" ]]; then
     ./test 200001 -s $s -w4   | grep "errors" | grep -v "#0 "
     ./test 200001 -s $s -a    | grep "errors" | grep -v "#0 "
     ./test 200001 -s $s -a2   | grep "errors" | grep -v "#0 "
+    ./test 200001 -s $s -a4   | grep "errors" | grep -v "#0 "
   done
 fi
 
+echo "precision test"
+for l in 8 10 12 16; do
+  for s in 2 17 256; do
+    ./test 100001 -s $s -l $l -w  | grep "errors" | grep -v "#0 "
+    ./test 100001 -s $s -l $l -w4 | grep "errors" | grep -v "#0 "
+    ./test 100001 -s $s -l $l -a  | grep "errors" | grep -v "#0 "
+    ./test 100001 -s $s -l $l -a2 | grep "errors" | grep -v "#0 "
+    ./test 100001 -s $s -l $l -a4 | grep "errors" | grep -v "#0 "
+  done
+done
+
 echo "corner case test #1"
 for n in `seq 0 33`; do
   ./test $n -w  | grep "errors" | grep -v "#0 "
@@ -28,6 +40,7 @@ for n in `seq 0 33`; do
   ./test $n -w4 | grep "errors" | grep -v "#0 "
   ./test $n -a  | grep "errors" | grep -v "#0 "
   ./test $n -a2 | grep "errors" | grep -v "#0 "
+  ./test $n -a4 | grep "errors" | grep -v "#0 "
 done
 
 echo "corner case test #2"
@@ -38,4 +51,62 @@ for n in `seq 8189 8201`; do
   ./test $n -w4 | grep "errors" | grep -v "#0 "
   ./test $n -a  | grep "errors" | grep -v "#0 "
   ./test $n -a2 | grep "errors" | grep -v "#0 "
+  ./test $n -a4 | grep "errors" | grep -v "#0 "
+done
+
+echo "binary coder test"
+for a in 0 1 4 15; do
+  for n in 2 3 100 100001; do
+    ./bit_cmp $n -p 7 -a $a | grep "error"
+    ./bit_cmp $n -p 250 -a $a | grep "error"
+  done
+done
+
+echo "packed bits test"
+for n in 3 8 9 1001; do
+  ./bit_test $n -p 40 -w | grep "error"
+  ./bit_test $n -p 40 -a4 -pack-out | grep "error"
+done
+
+echo "tiny alphabet test"
+for s in 2 3 9 16; do
+  for n in 5 1000 8193 30001; do
+    ./test $n -s $s -l 16 -w4 | grep "errors" | grep -v "#0 "
+    ./test $n -s $s -l 10 -w4 | grep "errors" | grep -v "#0 "
+  done
+done
+
+echo "wide alphabet test"
+for s in 2 17 256; do
+  for n in 1 5 8193 100001; do
+    ./test $n -s $s -l 8 -w4 | grep "errors" | grep -v "#0 "
+    ./test $n -s $s -l 16 -w4 | grep "errors" | grep -v "#0 "
+  done
+done
+
+echo "integer coding test"
+for n in 1 2 98 8193 100001; do
+  ./test $n -s 256 -l 12 | grep "errors" | grep -v "#0 "
+  ./test $n -s 3 -l 10 -w4 | grep "errors" | grep -v "#0 "
+  ./test $n -s 256 -l 16 -a4 | grep "errors" | grep -v "#0 "
+done
+
+echo "sparse alphabet test"
+for s in 2 3 5 100; do
+  for n in 1 3 1000 8193; do
+    ./test $n -s $s -l 10 | grep "errors" | grep -v "#0 "
+    ./test $n -s $s -l 12 -w | grep "errors" | grep -v "#0 "
+    ./test $n -s $s -l 12 -w4 | grep "errors" | grep -v "#0 "
+    ./test $n -s $s -l 12 -a2 | grep "errors" | grep -v "#0 "
+    ./test $n -s $s -l 12 -a4 | grep "errors" | grep -v "#0 "
+  done
+done
+
+echo "map-free alias encoder test"
+for s in 2 17 256; do
+  for n in 5 8193 100001; do
+    ./test_nomap $n -s $s -l 10 -a  | grep "errors" | grep -v "#0 "
+    ./test_nomap $n -s $s -l 12 -a2 | grep "errors" | grep -v "#0 "
+    ./test_nomap $n -s $s -l 16 -a4 | grep "errors" | grep -v "#0 "
+  done
 done
@@ -100,6 +100,7 @@ static void Help() {
   printf("-p <int>           : distribution param (>=0)\n");
   printf("-s <int>           : number of symbols (in [2..256]))\n");
   printf("-l <int>           : max table size bits (<= LOG_TAB_SIZE)\n");
+  printf("                     (in [8..16] for word-based coding)\n");
   printf("-save <string>     : save input message to file\n");
   printf("-d                 : print distribution\n");
   printf("-f <string>        : message file name\n");
@@ -108,6 +109,798 @@ static void Help() {
   exit(0);
 }
 
+// Encoding into a caller-supplied buffer must give the same bitstream, and
+// fail cleanly if the buffer is too small.
+static int CheckEncodeToBuffer(const uint8_t* in, size_t in_size,
+                               const uint8_t* bits, size_t bits_size,
+                               int log_tab_size, FSCCodingMethod method) {
+  const size_t bound = FSCCompressBound(in_size, method);
+  uint8_t* const buf = (uint8_t*)malloc(bound);
+  size_t size = 0;
+  int nb_errors = 0;
+  if (buf == NULL) return 1;
+  if (bits_size > bound) {
+    fprintf(stderr, "FSCCompressBound() too small: %ld > %ld\n",
+            bits_size, bound);
+    ++nb_errors;
+  }
+  if (!FSCEncodeToBuffer(in, in_size, buf, bound, &size,
+                         log_tab_size, method) ||
+      size != bits_size || memcmp(buf, bits, size)) {
+    fprintf(stderr, "FSCEncodeToBuffer() mismatch!\n");
+    ++nb_errors;
+  }
+  if (FSCEncodeToBuffer(in, in_size, buf, bits_size - 1, &size,
+                        log_tab_size, method)) {
+    fprintf(stderr, "FSCEncodeToBuffer() should have failed!\n");
+    ++nb_errors;
+  }
+  free(buf);
+  return nb_errors;
+}
+
+// Decoding with padding after the input must not depend on its content.
+static int CheckDecodePadded(const uint8_t* in, size_t in_size,
+                             const uint8_t* bits, size_t bits_size) {
+  uint8_t* const buf = (uint8_t*)malloc(bits_size + FSC_INPUT_PADDING);
+  uint8_t* out = NULL;
+  size_t out_size = 0;
+  int nb_errors = 0;
+  if (buf == NULL) return 1;
+  memcpy(buf, bits, bits_size);
+  memset(buf + bits_size, 0xff, FSC_INPUT_PADDING);   // garbage
+  if (!FSCDecodePadded(buf, bits_size, &out, &out_size) ||
+      out_size != in_size || memcmp(out, in, in_size)) {
+    fprintf(stderr, "FSCDecodePadded() mismatch!\n");
+    ++nb_errors;
+  }
+  free(out);
+  free(buf);
+  return nb_errors;
+}
+
+// Reads the input as packed 2-bit or 4-bit symbols, last one being dropped.
+// The last byte holds one symbol less than the others, its unused bits being
+// set: they shouldn't change the coded stream.
+static int CheckPacked(const uint8_t* in, size_t in_size, int bits_per_symbol,
+                       int log_tab_size, FSCCodingMethod method) {
+  const int syms_per_byte = 8 / bits_per_symbol;
+  const int mask = (1 << bits_per_symbol) - 1;
+  const size_t nb_symbols = (in_size > 0) ? in_size * syms_per_byte - 1 : 0;
+  const int last_mask = (1 << (8 - bits_per_symbol)) - 1;
+  uint8_t* const dirty = (uint8_t*)malloc(in_size + 1);
+  uint8_t* bits = NULL;
+  uint8_t* clean_bits = NULL;
+  uint8_t* out = NULL;
+  size_t bits_size = 0, clean_size = 0, out_size = 0, nb = 0, n;
+  int nb_errors = 0;
+  if (dirty == NULL) return 1;
+  if (in_size > 0) memcpy(dirty, in, in_size);
+  if (in_size > 0) dirty[in_size - 1] |= ~last_mask;
+  if (!FSCEncodePacked(dirty, nb_symbols, bits_per_symbol, &bits, &bits_size,
+                       log_tab_size, method) ||
+      !FSCDecodePacked(bits, bits_size, 1, &out, &out_size, &nb, NULL) ||
+      out_size != nb_symbols || nb != nb_symbols) {
+    fprintf(stderr, "FSCDecodePacked() error!\n");
+    ++nb_errors;
+  } else {
+    for (n = 0; n < nb_symbols; ++n) {
+      const int shift = (n % syms_per_byte) * bits_per_symbol;
+      const int v = in[n / syms_per_byte] >> shift;
+      if (out[n] != (v & mask)) {
+        fprintf(stderr, "FSCDecodePacked() mismatch at %ld!\n", n);
+        ++nb_errors;
+        break;
+      }
+    }
+    if (in_size > 0) dirty[in_size - 1] &= last_mask;
+    if (!FSCEncodePacked(dirty, nb_symbols, bits_per_symbol,
+                         &clean_bits, &clean_size, log_tab_size, method) ||
+        clean_size != bits_size || memcmp(clean_bits, bits, bits_size)) {
+      fprintf(stderr, "FSCEncodePacked() depends on the unused bits!\n");
+      ++nb_errors;
+    }
+  }
+  free(clean_bits);
+  free(bits);
+  free(out);
+  free(dirty);
+  return nb_errors;
+}
+
+// Codes slices of the input with the same contexts, the decoder also
+// getting a message from another method in between. The output must match
+// FSCEncode()'s.
+static int CheckCtx(const uint8_t* in, size_t in_size,
+                    int log_tab_size, FSCCodingMethod method) {
+  const size_t sizes[4] = { in_size, in_size / 3, 100, in_size / 2 };
+  const size_t capacity = FSCCompressBound(in_size, method);
+  FSCEncoderCtx* const enc = FSCEncoderCtxNew(log_tab_size, method);
+  FSCDecoderCtx* const dec = FSCDecoderCtxNew();
+  uint8_t* const bits = (uint8_t*)malloc(capacity);
+  uint8_t* const out = (uint8_t*)malloc(in_size + 1);
+  int i, nb_errors = 0;
+  if (enc == NULL || dec == NULL || bits == NULL || out == NULL) {
+    ++nb_errors;
+    goto End;
+  }
+  for (i = 0; i < 8; ++i) {
+    const size_t size = (sizes[i % 4] < in_size) ? sizes[i % 4] : in_size;
+    const FSCCodingMethod m = (i == 5) ? CODING_METHOD_16B_ALIAS_4X : method;
+    uint8_t* ref = NULL;
+    uint8_t* dst = out;
+    size_t ref_size = 0, bits_size = 0, out_size = in_size;
+    if (size == 0) continue;   // not supported by FSCEncode()
+    if (!FSCEncoderCtxReset(enc, log_tab_size, m) ||
+        !FSCEncodeToBufferWithCtx(enc, in, size, bits, capacity,
+                                  &bits_size) ||
+        !FSCEncode(in, size, &ref, &ref_size, log_tab_size, m) ||
+        ref_size != bits_size || memcmp(ref, bits, bits_size) ||
+        !FSCDecodeWithCtx(dec, bits, bits_size, &dst, &out_size) ||
+        dst != out || out_size != size || memcmp(out, in, size)) {
+      fprintf(stderr, "Context coding mismatch (message #%d)!\n", i);
+      ++nb_errors;
+    }
+    free(ref);
+  }
+ End:
+  free(out);
+  free(bits);
+  FSCDecoderCtxDelete(dec);
+  FSCEncoderCtxDelete(enc);
+  return nb_errors;
+}
+
+static int nb_allocs = 0;
+static void* CountingAlloc(void* opaque, size_t size) {
+  (void)opaque;
+  ++nb_allocs;
+  return malloc(size);
+}
+static void CountingFree(void* opaque, void* ptr) {
+  (void)opaque;
+  free(ptr);
+}
+
+// Round-trip through a (misaligned) workspace, which must not allocate.
+static int CheckWorkspace(const uint8_t* in, size_t in_size,
+                          int log_tab_size, FSCCodingMethod method) {
+  const size_t ws_size = FSCWorkspaceSize(method, log_tab_size);
+  const size_t capacity = FSCCompressBound(in_size, method);
+  uint8_t* const ws = (uint8_t*)malloc(ws_size + 1);
+  uint8_t* const bits = (uint8_t*)malloc(capacity);
+  uint8_t* const out = (uint8_t*)malloc(in_size + 1);
+  size_t bits_size = 0, out_size = 0;
+  int nb_errors = 0;
+  if (in_size == 0) goto End;   // not supported by FSCEncode()
+  if (ws_size == 0 || ws == NULL || bits == NULL || out == NULL) {
+    ++nb_errors;
+    goto End;
+  }
+  nb_allocs = 0;
+  FSCSetAllocator(CountingAlloc, CountingFree, NULL);
+  if (!FSCEncodeWithWorkspace(in, in_size, bits, capacity, &bits_size,
+                              log_tab_size, method, ws + 1, ws_size) ||
+      !FSCDecodeWithWorkspace(bits, bits_size, out, in_size, &out_size,
+                              ws + 1, ws_size) ||
+      out_size != in_size || memcmp(out, in, in_size) || nb_allocs != 0) {
+    fprintf(stderr, "Workspace coding mismatch (%d allocations)!\n",
+            nb_allocs);
+    ++nb_errors;
+  }
+  FSCSetAllocator(NULL, NULL, NULL);
+  if (FSCDecodeWithWorkspace(bits, bits_size, out, in_size, &out_size,
+                             ws, 64)) {
+    fprintf(stderr, "FSCDecodeWithWorkspace() should have failed!\n");
+    ++nb_errors;
+  }
+ End:
+  free(out);
+  free(bits);
+  free(ws);
+  return nb_errors;
+}
+
+// The estimate should be within a few percent of the real size.
+static int CheckEstimate(const uint8_t* in, size_t in_size, size_t bits_size,
+                         int log_tab_size, FSCCodingMethod method) {
+  const size_t estimate = FSCEstimateSize(in, in_size, method, log_tab_size);
+  const size_t margin = 16 + bits_size / 20;
+  if (in_size == 0) return 0;
+  if (estimate + margin < bits_size || estimate > bits_size + margin) {
+    fprintf(stderr, "Size estimate mismatch: %d vs %d!\n",
+            (int)estimate, (int)bits_size);
+    return 1;
+  }
+  return 0;
+}
+
+// The symbols' costs should add up to about the size of the payload.
+static int CheckSymbolCosts(const uint8_t* in, size_t in_size,
+                            size_t bits_size,
+                            int log_tab_size, FSCCodingMethod method) {
+  uint32_t counts[MAX_SYMBOLS], norm[MAX_SYMBOLS];
+  uint16_t costs[MAX_SYMBOLS];
+  uint64_t bits = 0;
+  const size_t margin = 32 + bits_size / 20;   // plus the header, below
+  size_t s;
+  if (method >= CODING_METHOD_16B) {   // same clamping as the encoder
+    if (log_tab_size < MIN_LOG_TAB_SIZE_W) log_tab_size = MIN_LOG_TAB_SIZE_W;
+    if (log_tab_size > MAX_LOG_TAB_SIZE) log_tab_size = MAX_LOG_TAB_SIZE;
+  }
+  FSCCountSymbols(in, in_size, counts);
+  memcpy(norm, counts, sizeof(norm));
+  if (FSCNormalizeCounts(norm, MAX_SYMBOLS, log_tab_size) < 1 ||
+      !FSCGetSymbolCosts(norm, method, costs)) {
+    fprintf(stderr, "FSCGetSymbolCosts() failed!\n");
+    return 1;
+  }
+  for (s = 0; s < MAX_SYMBOLS; ++s) {
+    if (counts[s] > 0 && (norm[s] == 0) != (costs[s] == 0xffff)) {
+      fprintf(stderr, "Symbol cost mismatch for #%d!\n", (int)s);
+      return 1;
+    }
+    if (counts[s] > 0) bits += (uint64_t)counts[s] * costs[s];
+  }
+  bits >>= 8 + 3;
+  if (bits + margin + MAX_HDR_SIZE / 4 < bits_size ||
+      bits > bits_size + margin) {
+    fprintf(stderr, "Symbol costs mismatch: %d vs %d!\n",
+            (int)bits, (int)bits_size);
+    return 1;
+  }
+  // A single symbol, normalized to a count of 1, is free.
+  memset(norm, 0, sizeof(norm));
+  norm[in[0]] = 1;
+  if (!FSCGetSymbolCosts(norm, method, costs) || costs[in[0]] != 0 ||
+      costs[(in[0] + 1) & 0xff] != 0xffff) {
+    fprintf(stderr, "Unique symbol cost mismatch!\n");
+    return 1;
+  }
+  return 0;
+}
+
+//------------------------------------------------------------------------------
+// Coding modes with their own API (split, clustered, order-1, stride, filtered)
+
+typedef enum {
+  FIXTURE_HALVES,     // the input, then its inverse: statistics change halfway
+  FIXTURE_BLOCKS,     // alternating blocks of the input and of its inverse
+  FIXTURE_CHAIN,      // each byte is the previous one plus the input's: flat
+                      // order-0 statistics, the input's order-1 ones
+  FIXTURE_RECORDS,    // 3-byte records: input byte, constant, inverse byte
+  FIXTURE_ELEMENTS    // 32-bit elements: input byte, inverse, 0x80, 0 (and
+                      // 3 trailing bytes)
+} FixtureType;
+
+// Returns a buffer of *size bytes derived from the input (NULL upon error).
+static uint8_t* NewFixture(const uint8_t* in, size_t in_size,
+                           FixtureType type, size_t* const size) {
+  const size_t kFactors[5] = { 2, 2, 1, 3, 4 };
+  uint8_t* buf;
+  size_t n;
+  *size = kFactors[type] * in_size + ((type == FIXTURE_ELEMENTS) ? 3 : 0);
+  buf = (uint8_t*)malloc(*size + 1);
+  if (buf == NULL) return NULL;
+  for (n = 0; n < *size; ++n) {
+    switch (type) {
+      case FIXTURE_HALVES:
+        buf[n] = (n < in_size) ? in[n] : (uint8_t)(255 - in[n - in_size]);
+        break;
+      case FIXTURE_BLOCKS:
+        buf[n] = ((n / BLOCK_SIZE) & 1) ? (uint8_t)(255 - in[n >> 1])
+                                        : in[n >> 1];
+        break;
+      case FIXTURE_CHAIN:
+        buf[n] = (uint8_t)(in[n] + ((n > 0) ? buf[n - 1] : 0));
+        break;
+      case FIXTURE_RECORDS: {
+        const int b = n % 3;
+        const uint8_t v = in[n / 3];
+        buf[n] = (b == 0) ? v : (b == 1) ? 0x55 : (uint8_t)(255 - v);
+        break;
+      }
+      default: {
+        const int b = n & 3;
+        const uint8_t v = in[(n >> 2) % in_size];
+        buf[n] = (b == 0) ? v : (b == 1) ? (uint8_t)~v : (b == 2) ? 0x80 : 0;
+        break;
+      }
+    }
+  }
+  return buf;
+}
+
+// Size of the plain coding, or 0 if there are too many symbols for
+// log_tab_size.
+static size_t PlainSize(const uint8_t* in, size_t size,
+                        int log_tab_size, FSCCodingMethod method) {
+  uint8_t* bits = NULL;
+  size_t bits_size = 0;
+  if (!FSCEncode(in, size, &bits, &bits_size, log_tab_size, method)) {
+    bits_size = 0;
+  }
+  free(bits);
+  return bits_size;
+}
+
+typedef enum {
+  CODER_SPLIT, CODER_CLUSTERED, CODER_O1, CODER_STRIDE, CODER_FILTERED
+} CoderType;
+static const char* const kCoderNames[5] = {
+  "Split", "Clustered", "O1", "Stride", "Filtered"
+};
+
+typedef struct {
+  CoderType type;
+  int log_tab_size;
+  FSCCodingMethod method;   // not used by CODER_O1 and CODER_STRIDE
+  int param;                // split mode, max_tables, stride or filter
+  int width;                // filter width
+} TestCoder;
+
+static int TestEncode(const TestCoder* const c, const uint8_t* in,
+                      size_t size, uint8_t** bits, size_t* bits_size) {
+  switch (c->type) {
+    case CODER_SPLIT:
+      return FSCEncodeSplit(in, size, bits, bits_size, c->log_tab_size,
+                            c->method, (FSCSplitMode)c->param);
+    case CODER_CLUSTERED:
+      return FSCEncodeClustered(in, size, bits, bits_size, c->log_tab_size,
+                                c->method, c->param);
+    case CODER_O1:
+      return FSCEncodeO1(in, size, bits, bits_size, c->log_tab_size,
+                         c->param);
+    case CODER_STRIDE:
+      return FSCEncodeStride(in, size, bits, bits_size, c->log_tab_size,
+                             c->param);
+    default:
+      return FSCEncodeFiltered(in, size, bits, bits_size, c->log_tab_size,
+                               c->method, (FSCFilter)c->param, c->width);
+  }
+}
+
+static int TestDecode(const TestCoder* const c, const uint8_t* bits,
+                      size_t bits_size, uint8_t** out, size_t* out_size) {
+  switch (c->type) {
+    case CODER_SPLIT: return FSCDecodeSplit(bits, bits_size, out, out_size);
+    case CODER_CLUSTERED:
+      return FSCDecodeClustered(bits, bits_size, out, out_size);
+    case CODER_O1: return FSCDecodeO1(bits, bits_size, out, out_size);
+    case CODER_STRIDE: return FSCDecodeStride(bits, bits_size, out, out_size);
+    default: return FSCDecodeFiltered(bits, bits_size, out, out_size);
+  }
+}
+
+// Codes 'in' and checks that it decodes back, in no more than max_size bytes
+// if max_size is not 0. Returns the number of errors, or -1 if the encoding
+// failed and 'may_fail' is set. The coded size is stored in *bits_size, and
+// the coded bits in *bits if 'bits' is not NULL (to be freed by the caller).
+static int CheckRoundTrip(const TestCoder* const coder,
+                          const uint8_t* in, size_t size, int may_fail,
+                          size_t max_size, uint8_t** bits,
+                          size_t* const bits_size) {
+  const char* const name = kCoderNames[coder->type];
+  uint8_t* tmp = NULL;
+  uint8_t* out = NULL;
+  size_t out_size = 0;
+  int nb_errors = 0;
+  if (bits != NULL) *bits = NULL;
+  *bits_size = 0;
+  if (!TestEncode(coder, in, size, &tmp, bits_size)) {
+    free(tmp);
+    if (may_fail) return -1;
+    fprintf(stderr, "FSCEncode%s() failed!\n", name);
+    return 1;
+  }
+  if (!TestDecode(coder, tmp, *bits_size, &out, &out_size) ||
+      out_size != size || memcmp(out, in, size)) {
+    fprintf(stderr, "%s coding mismatch!\n", name);
+    ++nb_errors;
+  } else if (max_size > 0 && *bits_size > max_size) {
+    fprintf(stderr, "%s coding is larger: %d vs %d!\n",
+            name, (int)*bits_size, (int)max_size);
+    ++nb_errors;
+  }
+  free(out);
+  if (bits != NULL) {
+    *bits = tmp;
+  } else {
+    free(tmp);
+  }
+  return nb_errors;
+}
+
+// Splitting shouldn't cost more than coding everything at once.
+static int CheckSplit(const uint8_t* in, size_t in_size,
+                      int log_tab_size, FSCCodingMethod method) {
+  size_t size, plain_size, bits_size;
+  uint8_t* const mixed = NewFixture(in, in_size, FIXTURE_HALVES, &size);
+  int mode, nb_errors = 0;
+  if (mixed == NULL) return 1;
+  plain_size = PlainSize(mixed, size, log_tab_size, method);
+  for (mode = FSC_SPLIT_FULL; mode <= FSC_SPLIT_BOUNDED; ++mode) {
+    const TestCoder coder = { CODER_SPLIT, log_tab_size, method, mode, 0 };
+    const int err = CheckRoundTrip(&coder, mixed, size, plain_size == 0,
+                                   plain_size ? plain_size + 32 : 0,
+                                   NULL, &bits_size);
+    if (err < 0) break;
+    nb_errors += err;
+  }
+  free(mixed);
+  return nb_errors;
+}
+
+// Clustering should separate the two kinds of blocks into two tables and
+// not cost more than a single one, whatever max_tables.
+static int CheckClustered(const uint8_t* in, size_t in_size,
+                          int log_tab_size, FSCCodingMethod method) {
+  const int kMaxTables[3] = { 1, 2, FSC_MAX_TABLES };
+  size_t size, plain_size, bits_size;
+  uint8_t* const mixed = NewFixture(in, in_size, FIXTURE_BLOCKS, &size);
+  int i, nb_errors = 0;
+  if (mixed == NULL) return 1;
+  plain_size = PlainSize(mixed, size, log_tab_size, method);
+  for (i = 0; i < 3; ++i) {
+    const TestCoder coder =
+        { CODER_CLUSTERED, log_tab_size, method, kMaxTables[i], 0 };
+    const int err = CheckRoundTrip(&coder, mixed, size, plain_size == 0,
+                                   plain_size ? plain_size + 32 : 0,
+                                   NULL, &bits_size);
+    if (err < 0) break;
+    nb_errors += err;
+  }
+  free(mixed);
+  return nb_errors;
+}
+
+// Codes the input and a chain of it. Adding tables shouldn't make the chain,
+// whose order-0 statistics are flat, larger.
+static int CheckO1(const uint8_t* in, size_t in_size, int log_tab_size) {
+  const int kMaxTables[3] = { 1, 16, FSC_O1_MAX_TABLES };
+  size_t size, bits_size, single_size = 0;
+  uint8_t* const chain = NewFixture(in, in_size, FIXTURE_CHAIN, &size);
+  int i, k, nb_errors = 0;
+  if (chain == NULL) return 1;
+  for (k = 0; k < 2; ++k) {
+    const uint8_t* const src = k ? chain : in;
+    for (i = 0; i < 3; ++i) {
+      const TestCoder coder =
+          { CODER_O1, log_tab_size, CODING_METHOD_DEFAULT, kMaxTables[i], 0 };
+      const size_t max_size =
+          (k == 1 && i > 0) ? single_size + single_size / 64 + 32 : 0;
+      const int err = CheckRoundTrip(&coder, src, size, 0, max_size,
+                                     NULL, &bits_size);
+      nb_errors += err;
+      if (err == 0 && k == 1 && i == 0) single_size = bits_size;
+    }
+  }
+  free(chain);
+  return nb_errors;
+}
+
+// Stride 3 shouldn't be larger than 1 on 3-byte records.
+static int CheckStride(const uint8_t* in, size_t in_size, int log_tab_size) {
+  const int kStrides[3] = { 1, 3, FSC_MAX_STRIDE };
+  size_t size, bits_size, single_size = 0;
+  uint8_t* const records = NewFixture(in, in_size, FIXTURE_RECORDS, &size);
+  int i, nb_errors = 0;
+  if (records == NULL) return 1;
+  for (i = 0; i < 3; ++i) {
+    const TestCoder coder =
+        { CODER_STRIDE, log_tab_size, CODING_METHOD_DEFAULT, kStrides[i], 0 };
+    const int err = CheckRoundTrip(&coder, records, size, 0,
+                                   (i == 1) ? single_size + 32 : 0,
+                                   NULL, &bits_size);
+    nb_errors += err;
+    if (err == 0 && i == 0) single_size = bits_size;
+  }
+  free(records);
+  return nb_errors;
+}
+
+// A filtered stream is decoded with a context too, but not with a workspace.
+static int CheckFilteredDecoders(const uint8_t* in, size_t in_size,
+                                 const uint8_t* bits, size_t bits_size,
+                                 int log_tab_size, FSCCodingMethod method) {
+  const size_t ws_size = FSCDecoderWorkspaceSize(method, log_tab_size);
+  FSCDecoderCtx* const dec = FSCDecoderCtxNew();
+  uint8_t* const ws = (uint8_t*)malloc(ws_size);
+  uint8_t* const out = (uint8_t*)malloc(in_size + 1);
+  uint8_t* dst = out;
+  size_t out_size = in_size;
+  int nb_errors = 0;
+  if (dec == NULL || ws == NULL || out == NULL) {
+    ++nb_errors;
+    goto End;
+  }
+  if (!FSCDecodeWithCtx(dec, bits, bits_size, &dst, &out_size) ||
+      dst != out || out_size != in_size || memcmp(out, in, in_size)) {
+    fprintf(stderr, "Filtered context decoding mismatch!\n");
+    ++nb_errors;
+  }
+  if (FSCDecodeWithWorkspace(bits, bits_size, out, in_size, &out_size,
+                             ws, ws_size)) {
+    fprintf(stderr, "Filtered workspace decoding should have failed!\n");
+    ++nb_errors;
+  }
+ End:
+  free(out);
+  free(ws);
+  FSCDecoderCtxDelete(dec);
+  return nb_errors;
+}
+
+// Codes the elements with a few filters and widths. Shuffling them by 4
+// shouldn't be larger than coding them as they are, but for the headers of
+// the planes. The other decoding entry points and a truncated stream are
+// checked too.
+static int CheckFiltered(const uint8_t* in, size_t in_size,
+                         int log_tab_size, FSCCodingMethod method) {
+  const FSCFilter kFilters[10] = {
+    FSC_FILTER_NONE, FSC_FILTER_SHUFFLE, FSC_FILTER_SHUFFLE, FSC_FILTER_SHUFFLE,
+    FSC_FILTER_SHUFFLE, FSC_FILTER_DELTA, FSC_FILTER_DELTA, FSC_FILTER_DELTA,
+    FSC_FILTER_XOR, FSC_FILTER_XOR
+  };
+  const int kWidths[10] = { 1, 3, 4, FSC_MAX_FILTER_WIDTH, 2, 1, 4, 2, 3, 8 };
+  size_t size, plain_size, bits_size, out_size = 0;
+  uint8_t* const elements = NewFixture(in, in_size, FIXTURE_ELEMENTS, &size);
+  uint8_t* bits = NULL;
+  uint8_t* out = NULL;
+  int i, nb_errors = 0;
+  if (elements == NULL) return 1;
+  plain_size = PlainSize(elements, size, log_tab_size, method);
+  for (i = 0; i < 10; ++i) {
+    const TestCoder coder =
+        { CODER_FILTERED, log_tab_size, method, kFilters[i], kWidths[i] };
+    const size_t max_size =
+        (i == 2 && plain_size > 0) ? plain_size + 4 * 32 : 0;   // 3 headers
+    // the residuals of the predictors can have more symbols
+    const int may_fail = (plain_size == 0 || kFilters[i] >= FSC_FILTER_DELTA);
+    const int err = CheckRoundTrip(&coder, elements, size, may_fail,
+                                   max_size, &bits, &bits_size);
+    if (err < 0) {
+      if (plain_size == 0) break;
+      continue;
+    }
+    nb_errors += err;
+    if (bits == NULL) break;   // the encoding failed
+    if (!FSCDecode(bits, bits_size, &out, &out_size) ||
+        out_size != size || memcmp(out, elements, size)) {
+      fprintf(stderr, "FSCDecode() mismatch on a filtered stream!\n");
+      ++nb_errors;
+    }
+    free(out);
+    out = NULL;
+    nb_errors += CheckDecodePadded(elements, size, bits, bits_size);
+    nb_errors += CheckFilteredDecoders(elements, size, bits, bits_size,
+                                       log_tab_size, method);
+    if (FSCDecodeFiltered(bits, bits_size - 1, &out, &out_size)) {
+      fprintf(stderr, "Truncated filtered stream was decoded!\n");
+      ++nb_errors;
+    }
+    free(out);
+    free(bits);
+    out = bits = NULL;
+  }
+  free(elements);
+  return nb_errors;
+}
+
+// Cuts the input into records of varying sizes (one of them empty), codes
+// them as a batch and checks both the full and the random-access decoding.
+static int CheckBatch(const uint8_t* in, size_t in_size,
+                      int log_tab_size, FSCCodingMethod method) {
+  const uint8_t* records[16];
+  size_t sizes[16];
+  size_t nb_records = 0, pos = 0, n;
+  uint8_t* bits = NULL;
+  uint8_t* out = NULL;
+  size_t* out_sizes = NULL;
+  size_t bits_size = 0, out_size = 0, out_nb = 0;
+  FSCBatch* batch = NULL;
+  int nb_errors = 0;
+  while (nb_records < 16) {
+    size_t len = (nb_records == 3) ? 0 : 1 + (in_size >> (1 + nb_records % 5));
+    if (len > in_size - pos) len = in_size - pos;
+    records[nb_records] = in + pos;
+    sizes[nb_records] = len;
+    pos += len;
+    ++nb_records;
+  }
+  if (!FSCEncodeBatch(records, sizes, nb_records, &bits, &bits_size,
+                      log_tab_size, method) ||
+      !FSCDecodeBatch(bits, bits_size, &out, &out_size, &out_sizes, &out_nb) ||
+      out_nb != nb_records || out_size != pos || memcmp(out, in, pos)) {
+    fprintf(stderr, "Batch coding mismatch!\n");
+    ++nb_errors;
+    goto End;
+  }
+  for (n = 0; n < nb_records; ++n) {
+    if (out_sizes[n] != sizes[n]) {
+      fprintf(stderr, "Batch record #%d size mismatch!\n", (int)n);
+      ++nb_errors;
+    }
+  }
+  batch = FSCBatchInit(bits, bits_size);
+  if (batch == NULL || FSCBatchNumRecords(batch) != nb_records) {
+    fprintf(stderr, "FSCBatchInit() failed!\n");
+    ++nb_errors;
+    goto End;
+  }
+  for (n = nb_records; n-- > 0;) {   // in reverse order
+    uint8_t* rec = out;
+    size_t rec_size = out_size;
+    if (!FSCBatchDecodeRecord(batch, n, &rec, &rec_size) ||
+        rec_size != sizes[n] || memcmp(rec, records[n], rec_size)) {
+      fprintf(stderr, "Batch record #%d mismatch!\n", (int)n);
+      ++nb_errors;
+    }
+  }
+  if (FSCBatchDecodeRecord(batch, nb_records, &out, &out_size)) {
+    fprintf(stderr, "FSCBatchDecodeRecord() should have failed!\n");
+    ++nb_errors;
+  }
+ End:
+  FSCBatchDelete(batch);
+  free(out_sizes);
+  free(out);
+  free(bits);
+  return nb_errors;
+}
+
+// Exactly uniform 32-symbol input: all the header's bins are equal.
+static int CheckUniform(int log_tab_size, FSCCodingMethod method) {
+  uint8_t in[4096];
+  uint8_t* bits = NULL;
+  uint8_t* out = NULL;
+  size_t bits_size = 0, out_size = 0;
+  int n, nb_errors = 0;
+  for (n = 0; n < (int)sizeof(in); ++n) in[n] = n % 32;
+  if (!FSCEncode(in, sizeof(in), &bits, &bits_size, log_tab_size, method) ||
+      !FSCDecode(bits, bits_size, &out, &out_size) ||
+      out_size != sizeof(in) || memcmp(out, in, sizeof(in))) {
+    fprintf(stderr, "Uniform alphabet mismatch!\n");
+    ++nb_errors;
+  }
+  free(out);
+  free(bits);
+  return nb_errors;
+}
+
+// Spreads the input's symbols over the whole byte range, so that the
+// alphabet becomes sparse, and checks the round-trip.
+static int CheckSparse(const uint8_t* in, size_t in_size,
+                       int log_tab_size, FSCCodingMethod method) {
+  uint8_t* const sparse = (uint8_t*)malloc(in_size + 1);
+  uint8_t* bits = NULL;
+  uint8_t* out = NULL;
+  size_t bits_size = 0, out_size = 0, n;
+  int nb_errors = 0;
+  if (sparse == NULL) return 1;
+  for (n = 0; n < in_size; ++n) sparse[n] = (uint8_t)(in[n] * 0x9d);
+  if (!FSCEncode(sparse, in_size, &bits, &bits_size, log_tab_size, method) ||
+      !FSCDecode(bits, bits_size, &out, &out_size) ||
+      out_size != in_size || memcmp(out, sparse, in_size)) {
+    fprintf(stderr, "Sparse alphabet mismatch!\n");
+    ++nb_errors;
+  }
+  free(out);
+  free(bits);
+  free(sparse);
+  return nb_errors;
+}
+
+// Truncated streams must be rejected. They and corrupted ones are decoded
+// from buffers of their exact size, so that the memory checkers can catch any
+// read beyond the input.
+static int CheckBroken16(const uint8_t* bits, size_t bits_size) {
+  uint16_t* out = NULL;
+  size_t out_size = 0, len;
+  int n, nb_errors = 0;
+  for (len = bits_size - 1; len > 0; len /= 2) {
+    uint8_t* const cut = (uint8_t*)malloc(len);
+    if (cut == NULL) return nb_errors + 1;
+    memcpy(cut, bits, len);
+    if (FSCDecode16(cut, len, &out, &out_size) && len == bits_size - 1) {
+      fprintf(stderr, "Truncated FSCDecode16() stream was decoded!\n");
+      ++nb_errors;
+    }
+    free(out);
+    free(cut);
+    out = NULL;
+  }
+  for (n = 0; n < 16; ++n) {
+    uint8_t* const bad = (uint8_t*)malloc(bits_size);
+    if (bad == NULL) return nb_errors + 1;
+    memcpy(bad, bits, bits_size);
+    bad[n * bits_size / 16] ^= 1 << (n & 7);
+    FSCDecode16(bad, bits_size, &out, &out_size);   // may or may not fail
+    free(out);
+    free(bad);
+    out = NULL;
+  }
+  return nb_errors;
+}
+// Builds 12-bit symbols from the input, and checks FSCEncode16/Decode16.
+static int CheckWide16(const uint8_t* in, size_t in_size, int log_tab_size) {
+  uint16_t* const syms = (uint16_t*)malloc((in_size + 1) * sizeof(*syms));
+  uint16_t* out = NULL;
+  uint8_t* bits = NULL;
+  size_t bits_size = 0, out_size = 0, n;
+  int nb_errors = 0;
+  if (syms == NULL) return 1;
+  for (n = 0; n < in_size; ++n) {
+    syms[n] = (in[n] << 4) | (in[n / 2] & 0x0f);
+  }
+  if (!FSCEncode16(syms, in_size, &bits, &bits_size, log_tab_size) ||
+      !FSCDecode16(bits, bits_size, &out, &out_size) ||
+      out_size != in_size || memcmp(out, syms, in_size * sizeof(*syms))) {
+    fprintf(stderr, "FSCDecode16() mismatch!\n");
+    ++nb_errors;
+  } else {
+    nb_errors += CheckBroken16(bits, bits_size);
+  }
+  free(bits);
+  syms[in_size] = FSC16_MAX_SYMBOLS;   // out of range
+  if (FSCEncode16(syms, in_size + 1, &bits, &bits_size, log_tab_size)) {
+    fprintf(stderr, "FSCEncode16() should have failed!\n");
+    free(bits);
+    ++nb_errors;
+  }
+  free(out);
+  free(syms);
+  return nb_errors;
+}
+
+// Builds 32-bit and 64-bit values from the input, and checks
+// FSCEncodeU32/U64 and FSCDecodeU32/U64.
+static int CheckInts(const uint8_t* in, size_t in_size,
+                     int log_tab_size, FSCCodingMethod method) {
+  uint32_t* const v32 = (uint32_t*)malloc((in_size + 1) * sizeof(*v32));
+  uint64_t* const v64 = (uint64_t*)malloc((in_size + 1) * sizeof(*v64));
+  uint32_t* out32 = NULL;
+  uint64_t* out64 = NULL;
+  uint8_t* bits = NULL;
+  size_t bits_size = 0, out_size = 0, n;
+  int nb_errors = 0;
+  if (v32 == NULL || v64 == NULL) {
+    free(v32);
+    free(v64);
+    return 1;
+  }
+  for (n = 0; n < in_size; ++n) {
+    v32[n] = (uint32_t)in[n] << (in[n / 2] & 31);
+    v64[n] = (n % 97 == 1) ? ~0ull : (uint64_t)in[n] << (in[n / 2] & 63);
+  }
+  if (!FSCEncodeU32(v32, in_size, &bits, &bits_size, log_tab_size, method) ||
+      !FSCDecodeU32(bits, bits_size, &out32, &out_size) ||
+      out_size != in_size || memcmp(out32, v32, in_size * sizeof(*v32))) {
+    fprintf(stderr, "FSCDecodeU32() mismatch!\n");
+    ++nb_errors;
+  }
+  free(bits);
+  bits = NULL;
+  if (!FSCEncodeU64(v64, in_size, &bits, &bits_size, log_tab_size, method) ||
+      !FSCDecodeU64(bits, bits_size, &out64, &out_size) ||
+      out_size != in_size || memcmp(out64, v64, in_size * sizeof(*v64))) {
+    fprintf(stderr, "FSCDecodeU64() mismatch!\n");
+    ++nb_errors;
+  }
+  free(out32);
+  out32 = NULL;
+  if (bits != NULL && FSCDecodeU32(bits, bits_size, &out32, &out_size)) {
+    fprintf(stderr, "FSCDecodeU32() should have failed!\n");
+    ++nb_errors;
+  }
+  free(out32);
+  free(out64);
+  free(bits);
+  free(v32);
+  free(v64);
+  return nb_errors;
+}
+
 int main(int argc, const char* argv[]) {
   int N = 100000000;
   int pdf_type = 2;
@@ -134,7 +927,7 @@ int main(int argc, const char* argv[]) {
       else if (max_symbol > 256) max_symbol = 256;
     } else if (!strcmp(argv[c], "-l") && c + 1 < argc) {
       log_tab_size = atoi(argv[++c]);
-      if (log_tab_size > LOG_TAB_SIZE) log_tab_size = LOG_TAB_SIZE;
+      if (log_tab_size > MAX_LOG_TAB_SIZE) log_tab_size = MAX_LOG_TAB_SIZE;
     } else if (!strcmp(argv[c], "-f") && c + 1 < argc) {
       in_file = argv[++c];
     } else if (FSCParseCodingMethodOpt(argv[c], &method)) {
@@ -152,6 +945,9 @@ int main(int argc, const char* argv[]) {
       if (N <= 2) N = 2;
     }
   }
+  if (method < CODING_METHOD_16B && log_tab_size > LOG_TAB_SIZE) {
+    log_tab_size = LOG_TAB_SIZE;
+  }
   uint8_t* base;
   FILE* file = NULL;
   if (in_file != NULL) {
@@ -240,6 +1036,25 @@ int main(int argc, const char* argv[]) {
       for (i = 0; i < N; ++i) {
         nb_errors += (out[i] != base[i]);
       }
+      nb_errors += CheckEncodeToBuffer(base, N, bits, bits_size,
+                                       log_tab_size, method);
+      nb_errors += CheckDecodePadded(base, N, bits, bits_size);
+      nb_errors += CheckEstimate(base, N, bits_size, log_tab_size, method);
+      nb_errors += CheckSymbolCosts(base, N, bits_size, log_tab_size, method);
+      nb_errors += CheckPacked(base, N, 2, log_tab_size, method);
+      nb_errors += CheckPacked(base, N, 4, log_tab_size, method);
+      nb_errors += CheckSparse(base, N, log_tab_size, method);
+      nb_errors += CheckCtx(base, N, log_tab_size, method);
+      nb_errors += CheckWorkspace(base, N, log_tab_size, method);
+      nb_errors += CheckBatch(base, N, log_tab_size, method);
+      nb_errors += CheckSplit(base, N, log_tab_size, method);
+      nb_errors += CheckClustered(base, N, log_tab_size, method);
+      nb_errors += CheckO1(base, N, log_tab_size);
+      nb_errors += CheckStride(base, N, log_tab_size);
+      nb_errors += CheckFiltered(base, N, log_tab_size, method);
+      if (log_tab_size >= 5) nb_errors += CheckUniform(log_tab_size, method);
+      nb_errors += CheckWide16(base, N, log_tab_size);
+      nb_errors += CheckInts(base, N, log_tab_size, method);
       printf("#%d errors\n", nb_errors);
       if (nb_errors) fprintf(stderr, "*** PROBLEM!! ***\n");
     }